@@ -0,0 +1,10 @@
+;;===================================================
+;; Benchmark - deep non-tail recursion
+;;===================================================
+(define ack
+  (lambda (m n)
+    (if (= m 0)
+        (+ n 1)
+        (if (= n 0) (ack (- m 1) 1) (ack (- m 1) (ack m (- n 1)))))))
+(ack 2 500)
+(ack 3 6)
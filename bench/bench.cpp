@@ -0,0 +1,775 @@
+/*============================================================================
+ *  nanoscheme
+ *  Copyright (c) 2019-2020 - Trung Truong
+ *
+ *  File name: bench.cpp
+ *
+ *  Description: Benchmarks for the interpreter hot paths
+ *  Usage: Run `make bench && ./bench/bench [name ..] > results.json`
+ *
+ *  Results are printed as a single JSON object, one benchmark per line, so
+ *  runs can be diffed and compared across commits. Only benchmarks whose
+ *  name starts with one of the given names are run.
+ *
+ *  Sources are timed in three phases: tokenizing, or mapping the tokens
+ *  from a cache file, building the AST and evaluating the top-level
+ *  primitives. Calls outside of lambda bodies are reduced by the parser,
+ *  so their cost shows up in the build phase.
+ *
+ *==========================================================================*/
+#include <sys/resource.h>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include "../src/env.h"
+#include "../src/expr.h"
+#include "../src/gc.h"
+#include "../src/hashtable.h"
+#include "../src/numvec.h"
+#include "../src/parser.h"
+#include "../src/pool.h"
+#include "../src/writer.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static double elapsed_ms(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start)
+        .count();
+}
+
+/*============================================================================
+ *  Results
+ *===========================================================================*/
+/**
+ * Timings and allocations of one benchmark. `ops` is the number of
+ * operations they cover, such as runs of a source or list elements.
+ */
+struct Result {
+    std::string name;
+    size_t ops;
+    size_t bytes;
+    double lex_ms;
+    double build_ms;
+    double eval_ms;
+    size_t allocs;
+    size_t alloc_bytes;
+};
+
+/* Names of the benchmarks to run, all of them if empty */
+static std::vector<std::string> selected;
+static bool first_result = true;
+
+/**
+ * Check if a benchmark, or a group of benchmarks, was selected
+ * @param name Name of the benchmark, or common prefix of the group
+ * @returns True if it matches one of the given names
+ */
+static bool is_selected(const std::string &name) {
+    if (selected.empty()) return true;
+    for (const std::string &prefix : selected) {
+        size_t len = std::min(prefix.size(), name.size());
+        if (name.compare(0, len, prefix, 0, len) == 0) return true;
+    }
+    return false;
+}
+
+/**
+ * Start a result, remembering the allocation counters of the heap
+ * @param name Name of the benchmark
+ * @param ops Number of operations
+ * @returns Result with no time spent and allocations so far negated
+ */
+static Result start_result(const std::string &name, size_t ops) {
+    const GCStats &stats = Heap::current().get_stats();
+    Result r = { name, ops, 0, 0.0, 0.0, 0.0, 0, 0 };
+    r.allocs -= stats.allocated_objects;
+    r.alloc_bytes -= stats.allocated_bytes;
+    return r;
+}
+
+/**
+ * Print a result as a JSON object. Peak RSS is the high-water mark of the
+ * whole process at the time the benchmark finished.
+ * @param r Result started by `start_result`
+ * @returns void
+ */
+static void print_result(Result r) {
+    const GCStats &stats = Heap::current().get_stats();
+    r.allocs += stats.allocated_objects;
+    r.alloc_bytes += stats.allocated_bytes;
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    double total_ms = r.lex_ms + r.build_ms + r.eval_ms;
+    double parse_s = (r.lex_ms + r.build_ms) / 1000.0;
+    double mb = r.bytes / (1024.0 * 1024.0);
+
+    printf("%s\n    { \"name\": \"%s\", \"ops\": %zu, \"bytes\": %zu, "
+           "\"lex_ms\": %.3f, \"build_ms\": %.3f, \"eval_ms\": %.3f, "
+           "\"total_ms\": %.3f, \"ops_per_sec\": %.1f, "
+           "\"mb_per_sec\": %.2f, \"allocs_per_op\": %.2f, "
+           "\"alloc_bytes_per_op\": %.1f, \"peak_rss_kb\": %ld }",
+           first_result ? "{ \"benchmarks\": [" : ",", r.name.c_str(),
+           r.ops, r.bytes, r.lex_ms, r.build_ms, r.eval_ms, total_ms,
+           total_ms > 0 ? r.ops / (total_ms / 1000.0) : 0.0,
+           parse_s > 0 ? mb / parse_s : 0.0,
+           double(r.allocs) / r.ops, double(r.alloc_bytes) / r.ops,
+           usage.ru_maxrss);
+    fflush(stdout);
+    first_result = false;
+}
+
+/*============================================================================
+ *  Sources
+ *===========================================================================*/
+/**
+ * Generate a synthetic rule file of roughly `bytes` size. Mixes procedure
+ * definitions, nested arithmetic, quoted lists, strings and comments so
+ * that every token type is exercised.
+ * @param bytes Approximate size of generated source
+ * @returns Generated source
+ */
+static std::string gen_source(size_t bytes) {
+    std::string src;
+    src.reserve(bytes + 256);
+    for (size_t i = 0; src.size() < bytes; i++) {
+        std::string n = std::to_string(i);
+        src += ";; rule " + n + "\n";
+        src += "(define rule-" + n + " (lambda (x y) (if (< x y) "
+               "(+ x (* y " + n + ")) (- (* x 2) (/ y 3)))))\n";
+        src += "(define data-" + n + " '(1 2.5 \"str\" " + n + " #t))\n";
+    }
+    return src;
+}
+
+/**
+ * Read a source file of the corpus
+ * @param path Path of the file
+ * @returns Content of the file
+ */
+static std::string read_source(const std::string &path) {
+    std::ifstream f(path);
+    if (!f.is_open()) throw "Can't open '" + path + "'";
+    return std::string((std::istreambuf_iterator<char>(f)),
+                       std::istreambuf_iterator<char>());
+}
+
+/**
+ * Tokenize, build and evaluate every form of a source in the global env,
+ * adding the time spent in each phase to a result
+ * @param src Source
+ * @param global_env Pointer to global env
+ * @param arena Arena of the compilation unit
+ * @param r Pointer to result, or nullptr
+ * @param cache_path Path of the token cache file, or empty for none
+ * @returns void
+ */
+static void run_source(const std::string &src, Env *global_env,
+                       Arena *arena, Result *r = nullptr,
+                       const std::string &cache_path = "") {
+    Clock::time_point start = Clock::now();
+    TokenStream ts(src, cache_path);
+    if (r != nullptr) r->lex_ms += elapsed_ms(start);
+
+    while (ts.has_next()) {
+        start = Clock::now();
+        Expr *expr = build_AST(ts, ts.next(), global_env, arena);
+        if (r != nullptr) r->build_ms += elapsed_ms(start);
+
+        start = Clock::now();
+        if (expr->get_expr_type() == ExpType::PRIM)
+            expr->eval(NO_BINDING, global_env);
+        if (r != nullptr) r->eval_ms += elapsed_ms(start);
+    }
+}
+
+/**
+ * Tokenize, build and evaluate a single form in the global env, adding
+ * the time spent to a result
+ * @param src Source of the form
+ * @param global_env Pointer to global env
+ * @param arena Arena of the compilation unit
+ * @param r Pointer to result, or nullptr
+ * @returns Value of the form
+ */
+static Value eval_source(const std::string &src, Env *global_env,
+                         Arena *arena, Result *r = nullptr) {
+    Clock::time_point start = Clock::now();
+    TokenStream ts(src);
+    Expr *expr = build_AST(ts, ts.next(), global_env, arena);
+    Value v = expr->eval(NO_BINDING, global_env);
+    if (r != nullptr) r->eval_ms += elapsed_ms(start);
+    return v;
+}
+
+/*============================================================================
+ *  Benchmarks
+ *===========================================================================*/
+/**
+ * Run a source a number of times, each time in a fresh global env
+ * @param name Name of the benchmark
+ * @param src Source
+ * @param runs Number of runs
+ * @param cache_path Path of the token cache file, or empty for none
+ * @returns void
+ */
+static void bench_source(const std::string &name, const std::string &src,
+                         size_t runs, const std::string &cache_path = "") {
+    if (!is_selected(name)) return;
+    Result r = start_result(name, runs);
+    r.bytes = src.size() * runs;
+
+    for (size_t i = 0; i < runs; i++) {
+        Frame std_env_frame {};
+        Env *global_env = gc_new<Env>(std_env_frame);
+        Heap::current().add_root(global_env);
+        Arena *arena = Heap::current().new_arena();
+
+        run_source(src, global_env, arena, &r, cache_path);
+
+        arena->release();
+        Heap::current().remove_root(global_env);
+    }
+    print_result(r);
+}
+
+/**
+ * Time building a list of `n` elements with 'cons', walking it with 'car'
+ * and 'cdr', and running 'map', 'filter' and 'append' over it. Every
+ * element is an operation.
+ * @param n Number of list elements
+ * @returns void
+ */
+static void bench_lists(size_t n) {
+    if (!is_selected("list-")) return;
+    const char *names[] = { "build", "walk", "map", "filter", "append" };
+    std::string forms[] = {
+        "(define l (build " + std::to_string(n) + " '()))",
+        "(walk l 0)",
+        "(map sq l)",
+        "(filter odd l)",
+        "(append l l)"
+    };
+
+    Frame std_env_frame {};
+    Env *global_env = gc_new<Env>(std_env_frame);
+    Heap::current().add_root(global_env);
+    Arena *arena = Heap::current().new_arena();
+
+    run_source(
+        "(define build (lambda (n acc) "
+        "  (if (= n 0) acc (build (- n 1) (cons n acc)))))"
+        "(define walk (lambda (l acc) "
+        "  (if (list? l) (walk (cdr l) (+ acc (car l))) acc)))"
+        "(define sq (lambda (x) (* x x)))"
+        "(define odd (lambda (x) (= (mod x 2) 1)))",
+        global_env, arena);
+
+    for (size_t i = 0; i < 5; i++) {
+        // Later operations need the list, so it is always built
+        std::string name = "list-" + std::string(names[i]) + "-" +
+                           std::to_string(n);
+        if (i > 0 && !is_selected(name)) continue;
+        Result r = start_result(name, n);
+        run_source(forms[i], global_env, arena, &r);
+        if (is_selected(name)) print_result(r);
+    }
+
+    arena->release();
+    Heap::current().remove_root(global_env);
+}
+
+/**
+ * Time 'pmap' and 'pfilter' of compute-bound procedures over a list of
+ * `n` elements, on pools of 1 thread up to twice the number of cores.
+ * Every element is an operation.
+ * @param n Number of list elements
+ * @returns void
+ */
+static void bench_parallel(size_t n) {
+    if (!is_selected("parallel-")) return;
+    Frame std_env_frame {};
+    Env *global_env = gc_new<Env>(std_env_frame);
+    Heap::current().add_root(global_env);
+    Arena *arena = Heap::current().new_arena();
+
+    run_source(
+        "(define build (lambda (n acc) "
+        "  (if (= n 0) acc (build (- n 1) (cons (+ 10 (mod n 5)) acc)))))"
+        "(define fib (lambda (n) "
+        "  (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))"
+        "(define odd (lambda (n) (if (< n 2) (= n 1) (odd (- n 2)))))"
+        "(define l (build " + std::to_string(n) + " '()))",
+        global_env, arena);
+
+    size_t cores = std::max(1u, std::thread::hardware_concurrency());
+    for (size_t threads = 1; threads <= 2 * cores; threads *= 2) {
+        Pool::set_num_threads(threads);
+        Pool::current();
+
+        // Garbage of the previous run would be collected by the main
+        // thread alone, which is not what is measured here
+        std::string t = std::to_string(threads);
+        Heap::current().collect();
+        Result map = start_result("parallel-pmap-" + t + "t", n);
+        run_source("(pmap fib l)", global_env, arena, &map);
+        print_result(map);
+
+        Heap::current().collect();
+        Result filter = start_result("parallel-pfilter-" + t + "t", n);
+        run_source("(pfilter odd l)", global_env, arena, &filter);
+        print_result(filter);
+    }
+    Pool::set_num_threads(0);
+
+    arena->release();
+    Heap::current().remove_root(global_env);
+}
+
+/**
+ * Time rendering a list of `n` integers, and one of `n` floats, into an
+ * in-memory writer. Every element is an operation, `bytes` is the size of
+ * the output.
+ * @param n Number of list elements
+ * @returns void
+ */
+static void bench_print(size_t n) {
+    if (!is_selected("print-")) return;
+    Frame std_env_frame {};
+    Env *global_env = gc_new<Env>(std_env_frame);
+    Heap::current().add_root(global_env);
+    Arena *arena = Heap::current().new_arena();
+
+    run_source(
+        "(define build (lambda (n acc) "
+        "  (if (= n 0) acc (build (- n 1) (cons (* n 7) acc)))))"
+        "(define ints (build " + std::to_string(n) + " '()))"
+        "(define floats (map (lambda (x) (/ x 3.0)) ints))",
+        global_env, arena);
+
+    const char *names[] = { "ints", "floats" };
+    for (const char *list : names) {
+        std::string name = "print-" + std::string(list) + "-" +
+                           std::to_string(n);
+        if (!is_selected(name)) continue;
+        TokenStream ts(list);
+        Value v = build_AST(ts, ts.next(), global_env, arena)
+                      ->eval(NO_BINDING, global_env);
+        Result r = start_result(name, n);
+        Writer w;
+        Clock::time_point start = Clock::now();
+        w.write_value(v);
+        r.eval_ms += elapsed_ms(start);
+        r.bytes = w.str().size();
+        print_result(r);
+    }
+
+    arena->release();
+    Heap::current().remove_root(global_env);
+}
+
+/**
+ * Check if two results of a vector primitive are the same, bit for bit
+ * @param a Value
+ * @param b Value
+ * @returns True if they are equal
+ */
+static bool same_bits(Value a, Value b) {
+    if (a.type() == ExpType::INT && b.type() == ExpType::INT)
+        return a.ival() == b.ival();
+    if (a.type() != ExpType::VECTOR || b.type() != ExpType::VECTOR)
+        return std::memcmp(&a, &b, sizeof(Value)) == 0;
+    const NumVector &x = a.obj()->get_vector(), &y = b.obj()->get_vector();
+    return x.size() == y.size() &&
+           std::memcmp(x.f64(), y.f64(), x.size() * sizeof(double)) == 0;
+}
+
+/**
+ * Time reductions and element-wise operations of a vector of `n` doubles
+ * with the kernels of every instruction set the CPU supports, and the same
+ * operations over a list where there is one. Every element is an
+ * operation. Kernels must give the same result on every instruction set.
+ * @param n Number of elements
+ * @returns void
+ */
+static void bench_vectors(size_t n) {
+    if (!is_selected("vector-")) return;
+    const char *names[] = { "sum", "dot", "map", "sqrt" };
+    const char *list_forms[] = { "(walk l 0)", nullptr, "(map twice l)",
+                                 nullptr };
+    const char *vector_forms[] = { "(vector-sum v)", "(vector-dot v v)",
+                                   "(vector-map * v 2.0)",
+                                   "(vector-map sqrt v)" };
+    const size_t runs = 20;
+    std::string suffix = "-" + std::to_string(n);
+
+    // Lists go first, in an env of their own, so that collections made
+    // while vectors are timed do not trace them
+    {
+        Frame std_env_frame {};
+        Env *global_env = gc_new<Env>(std_env_frame);
+        Heap::current().add_root(global_env);
+        Arena *arena = Heap::current().new_arena();
+
+        run_source(
+            "(define build (lambda (n acc) "
+            "  (if (= n 0) acc (build (- n 1) (cons (/ n 7.0) acc)))))"
+            "(define walk (lambda (l acc) "
+            "  (if (list? l) (walk (cdr l) (+ acc (car l))) acc)))"
+            "(define twice (lambda (x) (* x 2.0)))",
+            global_env, arena);
+        // The list is bound as a value, so that referring to it does not
+        // build it again
+        std::string src = "(build " + std::to_string(n) + " '())";
+        TokenStream ts(src);
+        Value l = build_AST(ts, ts.next(), global_env, arena)
+                      ->eval(NO_BINDING, global_env);
+        global_env->add_key_value_pair(Symbol::intern("l"), l.obj());
+
+        for (size_t i = 0; i < 4; i++) {
+            std::string name = "vector-" + std::string(names[i]) + "-list" +
+                               suffix;
+            if (list_forms[i] == nullptr || !is_selected(name)) continue;
+            Result r = start_result(name, n);
+            run_source(list_forms[i], global_env, arena, &r);
+            print_result(r);
+        }
+
+        arena->release();
+        Heap::current().remove_root(global_env);
+        Heap::current().collect();
+    }
+
+    Frame std_env_frame {};
+    Env *global_env = gc_new<Env>(std_env_frame);
+    Heap::current().add_root(global_env);
+    Arena *arena = Heap::current().new_arena();
+    auto vec = std::make_shared<NumVector>(ElemType::F64, n);
+    for (size_t i = 0; i < n; i++) vec->f64()[i] = (i + 1) / 7.0;
+    global_env->add_key_value_pair(Symbol::intern("v"),
+                                   gc_new<Expr>(std::move(vec)));
+
+    Isa best = NumVector::get_isa();
+    for (size_t i = 0; i < 4; i++) {
+        // Operands are resolved once, only the primitive is timed
+        TokenStream ts(vector_forms[i]);
+        Expr *expr = build_AST(ts, ts.next(), global_env, arena);
+        Value first;
+        for (int isa = int(Isa::SCALAR); isa <= int(best); isa++) {
+            NumVector::set_isa(Isa(isa));
+            std::string name = "vector-" + std::string(names[i]) + "-" +
+                               NumVector::isa_name(Isa(isa)) + suffix;
+            if (!is_selected(name)) continue;
+            Result r = start_result(name, n * runs);
+            Value v;
+            for (size_t run = 0; run < runs; run++) {
+                Clock::time_point start = Clock::now();
+                v = expr->eval(NO_BINDING, global_env);
+                r.eval_ms += elapsed_ms(start);
+            }
+            if (first.is_unbound()) first = v;
+            else if (!same_bits(first, v))
+                throw "Results of '" + std::string(vector_forms[i]) +
+                      "' differ across instruction sets";
+            print_result(r);
+        }
+        NumVector::set_isa(best);
+    }
+
+    arena->release();
+    Heap::current().remove_root(global_env);
+}
+
+/**
+ * Time filling a hash table with `n` integer keys and looking every one of
+ * them up from a Scheme loop, and the same lookups in an association list
+ * when `n` is small enough for it. Every key is an operation.
+ * @param n Number of keys
+ * @returns void
+ */
+static void bench_hash_scheme(size_t n) {
+    if (!is_selected("hash-scheme-")) return;
+    std::string suffix = "-" + std::to_string(n);
+    Frame std_env_frame {};
+    Env *global_env = gc_new<Env>(std_env_frame);
+    Heap::current().add_root(global_env);
+    Arena *arena = Heap::current().new_arena();
+
+    run_source(
+        "(define fill (lambda (h i n) "
+        "  (if (= i n) h (fill (hash-set! h i (* i i)) (+ i 1) n))))"
+        "(define probe (lambda (h i n acc) "
+        "  (if (= i n) acc (probe h (+ i 1) n (+ acc (hash-ref h i))))))"
+        "(define aprobe (lambda (al cur i n acc) "
+        "  (if (= i n) acc "
+        "    (if (= (car (car cur)) i) "
+        "      (aprobe al al (+ i 1) n (+ acc (car (cdr (car cur))))) "
+        "      (aprobe al (cdr cur) i n acc)))))",
+        global_env, arena);
+
+    std::string name = "hash-scheme-insert" + suffix;
+    std::string src = "(fill (make-hash-table) 0 " + std::to_string(n) + ")";
+    Result insert = start_result(name, n);
+    Value h = eval_source(src, global_env, arena, &insert);
+    if (is_selected(name)) print_result(insert);
+
+    // The table is bound as a value, so that referring to it does not fill
+    // it again
+    global_env->add_key_value_pair(Symbol::intern("h"), h.obj());
+    name = "hash-scheme-lookup" + suffix;
+    if (is_selected(name)) {
+        Result r = start_result(name, n);
+        run_source("(probe h 0 " + std::to_string(n) + " 0)", global_env,
+                   arena, &r);
+        print_result(r);
+    }
+
+    // Lookups in a list are linear, so only small ones are timed
+    name = "hash-scheme-lookup-alist" + suffix;
+    if (n <= 1000 && is_selected(name)) {
+        std::string al = "'(";
+        for (size_t i = 0; i < n; i++)
+            al += "(" + std::to_string(i) + " " + std::to_string(i * i) +
+                  ") ";
+        Value l = eval_source(al + ")", global_env, arena);
+        global_env->add_key_value_pair(Symbol::intern("al"), l.obj());
+        Result r = start_result(name, n);
+        run_source("(aprobe al al 0 " + std::to_string(n) + " 0)",
+                   global_env, arena, &r);
+        print_result(r);
+    }
+
+    arena->release();
+    Heap::current().remove_root(global_env);
+}
+
+/**
+ * Time inserting `n` keys into a hash table, looking each of them up,
+ * looking up as many keys that are not there and removing every key,
+ * through the table itself. Keys are integers, or strings looked up by
+ * equal strings of other expressions. Every key is an operation.
+ * @param n Number of keys
+ * @param strings True for string keys
+ * @returns void
+ */
+static void bench_hash_native(size_t n, bool strings) {
+    std::string prefix = strings ? "hash-string-" : "hash-int-";
+    if (!is_selected(prefix)) return;
+    std::string suffix = "-" + std::to_string(n);
+
+    // Keys are only held here, out of sight of the collector
+    GCPause pause;
+    std::vector<Value> keys(n), probes(n), misses(n);
+    for (size_t i = 0; i < n; i++) {
+        if (!strings) {
+            keys[i] = probes[i] = Value(int64_t(i * 7));
+            misses[i] = Value(int64_t(i * 7 + 3));
+            continue;
+        }
+        std::string key = "key-" + std::to_string(i * 7);
+        keys[i] = Value(gc_new<Expr>(key));
+        probes[i] = Value(gc_new<Expr>(key));
+        misses[i] = Value(gc_new<Expr>("key-" + std::to_string(i * 7 + 3)));
+    }
+
+    HashTable t;
+    const char *names[] = { "insert", "lookup", "miss", "remove" };
+    for (size_t op = 0; op < 4; op++) {
+        std::string name = prefix + names[op] + suffix;
+        Result r = start_result(name, n);
+        size_t found = 0;
+        Value v;
+        Clock::time_point start = Clock::now();
+        for (size_t i = 0; i < n; i++) {
+            switch (op) {
+            case 0: t.set(keys[i], keys[i]); break;
+            case 1: found += t.get(probes[i], v); break;
+            case 2: found += t.get(misses[i], v); break;
+            default: found += t.remove(probes[i]); break;
+            }
+        }
+        r.eval_ms += elapsed_ms(start);
+        size_t expected = op == 1 || op == 3 ? n : 0;
+        if (found != expected || t.size() != (op < 3 ? n : 0))
+            throw "Wrong result of '" + name + "'";
+        if (is_selected(name)) print_result(r);
+    }
+}
+
+/**
+ * Time building a string of `n` numbers by appending each one to the
+ * string built so far, splitting it back into `n` parts and taking a
+ * substring of every part. Every number is an operation, so the time per
+ * operation stays flat as long as building is linear.
+ * @param n Number of numbers
+ * @returns void
+ */
+static void bench_strings(size_t n) {
+    if (!is_selected("string-")) return;
+    std::string suffix = "-" + std::to_string(n);
+    Frame std_env_frame {};
+    Env *global_env = gc_new<Env>(std_env_frame);
+    Heap::current().add_root(global_env);
+    Arena *arena = Heap::current().new_arena();
+
+    run_source(
+        "(define build (lambda (s i n) "
+        "  (if (= i n) s "
+        "    (build (string-append s (number->string i) \",\") "
+        "           (+ i 1) n))))"
+        "(define walk (lambda (l acc) "
+        "  (if (list? l) "
+        "    (walk (cdr l) (+ acc (string-length (substring (car l) 0)))) "
+        "    acc)))",
+        global_env, arena);
+
+    // The string is bound as a value, so that referring to it does not
+    // build it again
+    std::string name = "string-build" + suffix;
+    Result build = start_result(name, n);
+    Value s = eval_source("(build \"\" 0 " + std::to_string(n) + ")",
+                          global_env, arena, &build);
+    build.bytes = s.obj()->get_string().size();
+    if (is_selected(name)) print_result(build);
+    global_env->add_key_value_pair(Symbol::intern("s"), s.obj());
+
+    name = "string-split" + suffix;
+    Result split = start_result(name, n);
+    Value l = eval_source("(string-split s \",\")", global_env, arena,
+                          &split);
+    if (is_selected(name)) print_result(split);
+    global_env->add_key_value_pair(Symbol::intern("l"), l.obj());
+
+    name = "string-substring" + suffix;
+    if (is_selected(name)) {
+        Result r = start_result(name, n);
+        run_source("(walk l 0)", global_env, arena, &r);
+        print_result(r);
+    }
+
+    arena->release();
+    Heap::current().remove_root(global_env);
+}
+
+/**
+ * Time calling closures that read variables of the two lambdas around
+ * them on every element of a list of `n` elements, and making `n`
+ * closures, each in the frame of a call that holds a list of 100 elements
+ * the closure does not use. Every element is an operation. `bytes` of the
+ * latter is what the closures keep alive after a collection.
+ * @param n Number of list elements
+ * @returns void
+ */
+static void bench_closures(size_t n) {
+    if (!is_selected("closure-")) return;
+    std::string suffix = "-" + std::to_string(n);
+    Frame std_env_frame {};
+    Env *global_env = gc_new<Env>(std_env_frame);
+    Heap::current().add_root(global_env);
+    Arena *arena = Heap::current().new_arena();
+
+    run_source(
+        "(define build (lambda (n acc) "
+        "  (if (= n 0) acc (build (- n 1) (cons n acc)))))"
+        "(define base (build 100 '()))"
+        "(define sq (lambda (x) (* x x)))"
+        "(define run (lambda (a b l) "
+        "  (map (lambda (x) (map (lambda (y) (+ x y a b)) base)) l)))"
+        "(define expand (lambda (i) (map sq base)))"
+        "(define mk (lambda (big) (lambda (x) (+ x 1))))",
+        global_env, arena);
+    Value l = eval_source("(build " + std::to_string(n) + " '())",
+                          global_env, arena);
+    global_env->add_key_value_pair(Symbol::intern("l"), l.obj());
+
+    std::string name = "closure-call" + suffix;
+    if (is_selected(name)) {
+        Result r = start_result(name, n);
+        run_source("(run 1 2 l)", global_env, arena, &r);
+        print_result(r);
+    }
+
+    name = "closure-retain" + suffix;
+    if (is_selected(name)) {
+        Heap::current().collect();
+        size_t live = Heap::current().get_stats().live_bytes;
+        Result r = start_result(name, n);
+        Value kept = eval_source("(map mk (map expand l))", global_env,
+                                 arena, &r);
+        global_env->add_key_value_pair(Symbol::intern("kept"), kept.obj());
+        Heap::current().collect();
+        r.bytes = Heap::current().get_stats().live_bytes - live;
+        print_result(r);
+    }
+
+    arena->release();
+    Heap::current().remove_root(global_env);
+}
+
+/*============================================================================
+ *  Main driver
+ *===========================================================================*/
+int main(int argc, char *argv[]) {
+    Heap::current().set_stack_base(__builtin_frame_address(0));
+    for (int i = 1; i < argc; i++) selected.push_back(argv[i]);
+
+    // The corpus lives next to the binary
+    std::string dir = argv[0];
+    dir = dir.find('/') == std::string::npos
+        ? "." : dir.substr(0, dir.rfind('/'));
+
+    const char *corpus[] = { "fib", "ackermann", "tail", "lists",
+                             "strings", "bignum", "memo" };
+    // tail.scm is the 10 million call stress test, too slow to run here
+    const char *files[] = { "fib", "ackermann", "tail-1m", "lists",
+                            "strings", "bignum", "memo" };
+    const size_t runs[] = { 3, 3, 3, 5, 10, 3, 10 };
+    int status = EXIT_SUCCESS;
+    try {
+        for (size_t i = 0; i < 7; i++) {
+            if (!is_selected(corpus[i])) continue;
+            bench_source(corpus[i],
+                read_source(dir + "/" + files[i] + ".scm"), runs[i]);
+        }
+        for (size_t mb = 1; mb <= 8; mb *= 2) {
+            std::string name = "generated-" + std::to_string(mb) + "mb";
+            if (is_selected(name))
+                bench_source(name, gen_source(mb * 1024 * 1024), 1);
+
+            // Tokens mapped from a cache file written by an untimed run
+            name += "-cached";
+            if (!is_selected(name)) continue;
+            std::string src = gen_source(mb * 1024 * 1024);
+            std::string path = dir + "/" + name + ".scmc";
+            { TokenStream warm(src, path); }
+            bench_source(name, src, 1, path);
+            std::remove(path.c_str());
+        }
+        for (size_t n = 100000; n <= 1000000; n *= 10)
+            bench_lists(n);
+        bench_parallel(2000);
+        bench_print(1000000);
+        bench_vectors(1000000);
+        for (size_t n = 1000; n <= 1000000; n *= 10)
+            bench_hash_scheme(n);
+        for (size_t n = 10000; n <= 1000000; n *= 10)
+            bench_strings(n);
+        bench_closures(10000);
+        for (size_t n = 1000; n <= 10000000; n *= 10) {
+            bench_hash_native(n, false);
+            if (n <= 1000000) bench_hash_native(n, true);
+        }
+    }
+    catch (const char* e) {
+        fprintf(stderr, "ERR: %s\n", e);
+        status = EXIT_FAILURE;
+    }
+    catch (const std::string &e) {
+        fprintf(stderr, "ERR: %s\n", e.c_str());
+        status = EXIT_FAILURE;
+    }
+
+    printf("%s\n", first_result ? "{ \"benchmarks\": [] }" : "\n] }");
+    return status;
+}
@@ -0,0 +1,14 @@
+;;===================================================
+;; Benchmark - integers past 64 bits
+;;===================================================
+(define pow
+  (lambda (b n)
+    (if (= n 0)
+        1
+        (if (= (mod n 2) 0)
+            (* (pow b (/ n 2)) (pow b (/ n 2)))
+            (* b (pow b (- n 1)))))))
+(define fact
+  (lambda (n acc) (if (< n 2) acc (fact (- n 1) (* n acc)))))
+(> (pow 3 100000) (pow 2 150000))
+(> (fact 2000 1) 0)
@@ -0,0 +1,5 @@
+;;===================================================
+;; Benchmark - recursive calls and arithmetic
+;;===================================================
+(define fib (lambda (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))
+(fib 27)
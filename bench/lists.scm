@@ -0,0 +1,17 @@
+;;===================================================
+;; Benchmark - list construction and traversal
+;;===================================================
+(define range (lambda (a b) (if (>= a b) '() (cons a (range (+ a 1) b)))))
+(define sum-sq 
+  (lambda (l acc) 
+    (if (list? l) 
+        (if (null? l) acc (sum-sq (cdr l) (+ acc (* (car l) (car l)))))
+        acc)))
+(define l (range 0 2000))
+(define sq (lambda (x) (* x x)))
+(define even (lambda (x) (= (mod x 2) 0)))
+(define loop 
+  (lambda (n acc) 
+    (if (= n 0) acc (loop (- n 1) (+ acc (car (cdr (map sq (filter even l)))))))))
+(loop 200 0)
+(sum-sq (range 0 3000) 0)
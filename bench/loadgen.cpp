@@ -0,0 +1,203 @@
+/*============================================================================
+ *  nanoscheme
+ *  Copyright (c) 2019-2020 - Trung Truong
+ *
+ *  File name: loadgen.cpp
+ *
+ *  Description: Load generator for `nscm --serve`
+ *  Usage: Run `make loadgen && ./bench/loadgen <socket> [options]`
+ *
+ *  Every connection is a thread that sends a request, waits for its
+ *  response and sends the next one. Latency is measured per request, from
+ *  the first byte sent to the last byte received. Results are printed as a
+ *  JSON object, like the results of `bench`.
+ *
+ *  Options:
+ *    --connections <n>   Number of concurrent connections, 8 by default
+ *    --requests <n>      Requests per connection, 10000 by default
+ *    --setup <source>    Request sent once per connection, not measured
+ *    --request <source>  Request that is measured, "(+ 1 2)" by default
+ *
+ *==========================================================================*/
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+struct Options {
+    std::string path;
+    size_t connections;
+    size_t requests;
+    std::string setup;
+    std::string request;
+};
+
+/* Latencies and errors of one connection */
+struct Client {
+    std::vector<double> latencies_ms;
+    size_t errors;
+    std::string failure;
+};
+
+/**
+ * Connect to the socket of a server
+ * @param path Path of the socket
+ * @returns Socket, or -1
+ */
+static int connect_to(const std::string &path) {
+    struct sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) return -1;
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, reinterpret_cast<struct sockaddr*>(&addr),
+                sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Send a request, including its NUL byte, and read its response
+ * @param fd Socket
+ * @param request Request
+ * @param response Response, without its NUL byte
+ * @returns False if the connection failed
+ */
+static bool round_trip(int fd, const std::string &request,
+                       std::string &response) {
+    const char *data = request.c_str();
+    size_t len = request.size() + 1;
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n <= 0) return false;
+        data += n;
+        len -= n;
+    }
+
+    response.clear();
+    char buf[4096];
+    for (;;) {
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0) return false;
+        if (buf[n - 1] == '\0') {
+            response.append(buf, n - 1);
+            return true;
+        }
+        response.append(buf, n);
+    }
+}
+
+/**
+ * Run the requests of a connection
+ * @param opts Options
+ * @param client Results of the connection
+ * @returns void
+ */
+static void run_client(const Options &opts, Client &client) {
+    int fd = connect_to(opts.path);
+    if (fd < 0) {
+        client.failure = "Can't connect to '" + opts.path + "'";
+        return;
+    }
+
+    std::string response;
+    if (!opts.setup.empty() && !round_trip(fd, opts.setup, response))
+        client.failure = "Connection closed by the server";
+
+    client.latencies_ms.reserve(opts.requests);
+    for (size_t i = 0; i < opts.requests && client.failure.empty(); i++) {
+        Clock::time_point start = Clock::now();
+        if (!round_trip(fd, opts.request, response)) {
+            client.failure = "Connection closed by the server";
+            break;
+        }
+        client.latencies_ms.push_back(std::chrono::duration<double,
+            std::milli>(Clock::now() - start).count());
+        if (response.compare(0, 4, "ERR:") == 0) client.errors++;
+    }
+    close(fd);
+}
+
+/**
+ * Get a percentile of sorted latencies
+ * @param sorted Latencies, in increasing order
+ * @param p Percentile, between 0 and 100
+ * @returns Latency below which `p` percent of the requests completed
+ */
+static double percentile(const std::vector<double> &sorted, double p) {
+    if (sorted.empty()) return 0.0;
+    size_t i = size_t(p / 100.0 * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(i, sorted.size() - 1)];
+}
+
+/*============================================================================
+ *  Main driver
+ *===========================================================================*/
+int main(int argc, char *argv[]) {
+    Options opts = { "", 8, 10000, "", "(+ 1 2)" };
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--connections") == 0 && has_value)
+            opts.connections = strtoul(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--requests") == 0 && has_value)
+            opts.requests = strtoul(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--setup") == 0 && has_value)
+            opts.setup = argv[++i];
+        else if (strcmp(argv[i], "--request") == 0 && has_value)
+            opts.request = argv[++i];
+        else opts.path = argv[i];
+    }
+    if (opts.path.empty() || opts.connections == 0) {
+        fprintf(stderr, "Usage: %s <socket> [--connections <n>] "
+                "[--requests <n>] [--setup <source>] [--request <source>]\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    std::vector<Client> clients(opts.connections, Client { {}, 0, "" });
+    std::vector<std::thread> threads;
+    Clock::time_point start = Clock::now();
+    for (size_t i = 0; i < opts.connections; i++)
+        threads.emplace_back(run_client, std::cref(opts),
+                             std::ref(clients[i]));
+    for (std::thread &t : threads) t.join();
+    double seconds = std::chrono::duration<double>(Clock::now() - start)
+        .count();
+
+    std::vector<double> latencies;
+    size_t errors = 0;
+    for (Client &client : clients) {
+        if (!client.failure.empty()) {
+            fprintf(stderr, "ERR: %s\n", client.failure.c_str());
+            return EXIT_FAILURE;
+        }
+        latencies.insert(latencies.end(), client.latencies_ms.begin(),
+                         client.latencies_ms.end());
+        errors += client.errors;
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    printf("{ \"connections\": %zu, \"requests\": %zu, \"errors\": %zu, "
+           "\"seconds\": %.3f, \"requests_per_sec\": %.1f, "
+           "\"p50_ms\": %.3f, \"p99_ms\": %.3f, \"max_ms\": %.3f }\n",
+           opts.connections, latencies.size(), errors, seconds,
+           seconds > 0 ? latencies.size() / seconds : 0.0,
+           percentile(latencies, 50), percentile(latencies, 99),
+           latencies.empty() ? 0.0 : latencies.back());
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,12 @@
+;;===================================================
+;; Benchmark - memoized recursion
+;;===================================================
+(define-memo fib
+  (lambda (n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))
+(define-memo paths
+  (lambda (r c)
+    (if (< r 1)
+        1
+        (if (< c 1) 1 (+ (paths (- r 1) c) (paths r (- c 1)))))))
+(fib 1000)
+(paths 80 80)
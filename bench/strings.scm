@@ -0,0 +1,18 @@
+;;===================================================
+;; Benchmark - string literals and string comparisons
+;;===================================================
+(define words 
+  '("alpha" "beta" "gamma" "delta" "epsilon" "zeta" "eta" "theta" "iota"
+    "kappa" "lambda" "mu" "nu" "xi" "omicron" "pi" "rho" "sigma" "tau"
+    "upsilon"))
+(define grow (lambda (n acc) (if (= n 0) acc (grow (- n 1) (append words acc)))))
+(define text (grow 2000 '()))
+(define count 
+  (lambda (l w acc) 
+    (if (list? l) 
+        (count (cdr l) w (if (equal? (car l) w) (+ acc 1) acc)) 
+        acc)))
+(count text "theta" 0)
+(count text "omega" 0)
+(car (filter (lambda (w) (equal? w "upsilon")) text))
+(map (lambda (w) (string? w)) words)
@@ -0,0 +1,8 @@
+;;===================================================
+;; Tail recursive loops of 1 million calls, the size of
+;; tail.scm run by the bench suite
+;;===================================================
+(define count (lambda (n acc) (if (= n 0) acc (count (- n 1) (+ acc 1)))))
+(count 1000000 0)
+(define countdown (lambda (n) (if (> n 0) (countdown (- n 1)) n)))
+(countdown 1000000)
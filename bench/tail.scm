@@ -0,0 +1,8 @@
+;;===================================================
+;; Stress test - tail recursive loop of 10 million calls
+;; Runs in constant native stack and bounded heap
+;;===================================================
+(define count (lambda (n acc) (if (= n 0) acc (count (- n 1) (+ acc 1)))))
+(count 10000000 0)
+(define countdown (lambda (n) (if (> n 0) (countdown (- n 1)) n)))
+(countdown 10000000)
@@ -0,0 +1,94 @@
+/*============================================================================
+ *  nanoscheme
+ *  Copyright (c) 2019-2020 - Trung Truong
+ *
+ *  File name: arena.cpp
+ *  Description: Implementation of `Arena` class
+ *
+ *  Parsed program text is immutable once built, so its nodes are bump
+ *  allocated into chunks instead of going through the heap one by one.
+ *  Nodes keep the usual `GCHeader`, tagged with their arena, so the
+ *  collector can trace into them. An arena is live as a whole: if anything
+ *  points into it, all of its nodes are kept, otherwise all of them are
+ *  freed together.
+ *
+ *==========================================================================*/
+#include <algorithm>
+#include "arena.h"
+#include "counters.h"
+#include "expr.h"
+
+static const size_t ARENA_CHUNK_SIZE = 64 * 1024;
+
+/* Constructors */
+Arena::Arena() : chunks({}), bytes(0), marked(false), pinned(true) {}
+
+/* Destructor */
+Arena::~Arena() {
+    for_each([](GCHeader *header) {
+        void *obj = reinterpret_cast<char*>(header) + GC_HEADER_SIZE;
+        switch (header->kind) {
+            case GCKind::EXPR: static_cast<Expr*>(obj)->~Expr(); break;
+            case GCKind::LIST: {
+                static_cast<std::vector<Expr*>*>(obj)->~vector();
+                break;
+            }
+            default: break;
+        }
+    });
+    for (Chunk &chunk : chunks) ::operator delete(chunk.data);
+}
+
+/*============================================================================
+ *  Allocation
+ *===========================================================================*/
+/**
+ * Bump allocate memory for an object. Objects are laid out back to back in
+ * allocation order, each behind its header.
+ * @param kind Kind of object that will be constructed in the memory
+ * @param size Size of the object
+ * @returns Pointer to uninitialized memory for the object
+ */
+void *Arena::allocate(GCKind kind, size_t size) {
+    Counters::count_object(kind);
+    size_t need = GC_HEADER_SIZE + ((size + 15) & ~size_t(15));
+
+    if (chunks.empty() || chunks.back().used + need > chunks.back().cap) {
+        size_t cap = std::max(ARENA_CHUNK_SIZE, need);
+        chunks.push_back({ static_cast<char*>(::operator new(cap)), 0, cap });
+        bytes += cap;
+    }
+
+    Chunk &chunk = chunks.back();
+    GCHeader *header = reinterpret_cast<GCHeader*>(chunk.data + chunk.used);
+    header->kind = kind;
+    header->marked = false;
+    header->size = static_cast<uint32_t>(size);
+    header->arena = this;
+    chunk.used += need;
+    return reinterpret_cast<char*>(header) + GC_HEADER_SIZE;
+}
+
+/**
+ * Allocate an array of expressions, with every element set to nullptr
+ * @param len Number of elements
+ * @returns Pointer to the first element
+ */
+Expr **Arena::allocate_array(size_t len) {
+    Expr **array = static_cast<Expr**>(
+        allocate(GCKind::ARRAY, len * sizeof(Expr*)));
+    std::fill(array, array + len, nullptr);
+    return array;
+}
+
+/*============================================================================
+ *  Lifetime
+ *===========================================================================*/
+/**
+ * Drop the compilation unit's hold on the arena. From then on the arena
+ * is freed by the collector once no live object points into it.
+ * @returns void
+ */
+void Arena::release() {
+    Heap::current().release_arena(this);
+}
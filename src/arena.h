@@ -0,0 +1,71 @@
+/*============================================================================
+ *  nanoscheme
+ *  Copyright (c) 2019-2020 - Trung Truong
+ *
+ *  File name: arena.h
+ *  Description: Header file for `Arena` class, a bump allocator for the
+ *  AST nodes of one compilation unit
+ *
+ *==========================================================================*/
+#include "gc.h"
+#ifndef ARENA_H_
+#define ARENA_H_
+
+/*============================================================================
+ *  Arena class
+ *===========================================================================*/
+class Arena {
+    friend class Heap;
+
+private:
+    struct Chunk { char *data; size_t used; size_t cap; };
+    std::vector<Chunk> chunks;
+    size_t bytes;
+    bool marked;
+    bool pinned;
+
+    /* Constructors, arenas are created and freed by `Heap` */
+    Arena();
+    ~Arena();
+
+    template <typename F> void for_each(F fn);
+
+public:
+    /* Allocation */
+    void *allocate(GCKind kind, size_t size);
+    Expr **allocate_array(size_t len);
+
+    /* Lifetime */
+    void release();
+};
+
+/**
+ * Visit the header of every object in the arena, in allocation order
+ * @param fn Callback taking a `GCHeader*`
+ * @returns void
+ */
+template <typename F>
+void Arena::for_each(F fn) {
+    for (Chunk &chunk : chunks) {
+        size_t pos = 0;
+        while (pos < chunk.used) {
+            GCHeader *header = reinterpret_cast<GCHeader*>(chunk.data + pos);
+            fn(header);
+            pos += GC_HEADER_SIZE + ((header->size + 15) & ~size_t(15));
+        }
+    }
+}
+
+/**
+ * Construct an object in an arena. Same contract as `gc_new`.
+ * @param arena Arena of the compilation unit
+ * @param args Constructor arguments
+ * @returns Pointer to the new object
+ */
+template <typename T, typename... Args>
+T *arena_new(Arena *arena, Args&&... args) {
+    void *mem = arena->allocate(GCKindOf<T>::kind, sizeof(T));
+    return new (mem) T(std::forward<Args>(args)...);
+}
+
+#endif
@@ -0,0 +1,215 @@
+/*============================================================================
+ *  nanoscheme
+ *  Copyright (c) 2019-2020 - Trung Truong
+ *
+ *  File name: batch.cpp
+ *  Description: Implementation of `Batch` class
+ *
+ *  The collector only scans the stack of the main thread, so threads
+ *  allocate into their own list of objects while they evaluate a batch of
+ *  forms, and no collection runs meanwhile. Between batches a file only
+ *  holds its env, a root, and the arena of its last batch, which stays
+ *  pinned. When a thread finds that a collection is due it wakes the main
+ *  thread, which stops threads from starting new batches, waits for the
+ *  running ones and collects.
+ *
+ *==========================================================================*/
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+#include "batch.h"
+#include "expr.h"
+#include "gc.h"
+#include "lexer.h"
+#include "parser.h"
+#include "writer.h"
+
+/* Constructors */
+Batch::Batch(int num_files, char* file_names[], bool c)
+    : files(), cache(c), threads(), next(0), running(0), collecting(false),
+      due(false) {
+    for (int i = 1; i <= num_files; i++)
+        files.push_back(File { file_names[i], "", "", false });
+}
+
+/* Destructor */
+Batch::~Batch() {
+    for (std::thread &t : threads) t.join();
+}
+
+/*============================================================================
+ *  Main thread
+ *===========================================================================*/
+/**
+ * Evaluate the files and print their outputs in order, each as soon as it
+ * and the files before it are done
+ * @param num_threads Number of threads evaluating files, 0 for one per core
+ * @returns Number of files that failed
+ */
+size_t Batch::run(size_t num_threads) {
+    if (num_threads == 0)
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+    num_threads = std::min(num_threads, files.size());
+    for (size_t i = 0; i < num_threads; i++)
+        threads.emplace_back(&Batch::loop, this);
+
+    size_t failed = 0;
+    for (File &file : files) {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            for (;;) {
+                idle.wait(guard, [&] { return due || file.done; });
+                if (!due) break;
+                collect(guard);
+            }
+        }
+        print(file);
+        if (!file.error.empty()) failed++;
+    }
+    return failed;
+}
+
+/**
+ * Collect once the batches being evaluated are done. Threads do not start
+ * new batches, nor finish files, until the collection is over.
+ * @param guard Lock held by the caller
+ * @returns void
+ */
+void Batch::collect(std::unique_lock<std::mutex> &guard) {
+    collecting = true;
+    idle.wait(guard, [this] { return running == 0; });
+    Heap::current().safepoint();
+    collecting = false;
+    due = false;
+    wake.notify_all();
+}
+
+/**
+ * Print the output of a file that is done, then its error, and free the
+ * output
+ * @param file File
+ * @returns void
+ */
+void Batch::print(File &file) {
+    Writer &out = Writer::out();
+    out.write(file.out);
+    out.flush();
+    std::string().swap(file.out);
+    if (!file.error.empty())
+        std::cerr << "ERR: " << file.name << ": " << file.error << "\n";
+}
+
+/*============================================================================
+ *  Threads
+ *===========================================================================*/
+/**
+ * Main loop of a thread: evaluate the next file that was not started
+ * until there is none left
+ * @returns void
+ */
+void Batch::loop() {
+    for (;;) {
+        File *file;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (next == files.size()) return;
+            file = &files[next++];
+        }
+        eval_file(*file);
+    }
+}
+
+/**
+ * Evaluate a file in an env of its own. The file is read in batches of
+ * forms, or at once if its tokens are cached, see `eval_files`.
+ * @param file File
+ * @returns void
+ */
+void Batch::eval_file(File &file) {
+    Env *env = nullptr;
+    Arena *arena = nullptr;
+    std::ifstream f(file.name);
+    if (!f.is_open())
+        file.error = "Can't open file";
+    else if (cache) {
+        std::string source((std::istreambuf_iterator<char>(f)),
+                           std::istreambuf_iterator<char>());
+        eval_unit(file, std::move(source), env, arena);
+    }
+    else {
+        FormReader reader(f);
+        std::string batch;
+        try {
+            while (reader.next(batch) &&
+                   eval_unit(file, std::move(batch), env, arena)) {}
+        }
+        catch (const char* e)        { file.error = e; }
+        catch (const std::string &e) { file.error = e; }
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (arena != nullptr) arena->release();
+        if (env != nullptr) Heap::current().remove_root(env);
+        file.done = true;
+    }
+    idle.notify_one();
+}
+
+/**
+ * Evaluate a compilation unit of a file and keep what it printed. The
+ * arena of the previous unit of the file is released first.
+ * @param file File
+ * @param source Source of the unit
+ * @param env Global env of the file, created by its first unit
+ * @param arena Arena of the previous unit, replaced by the new one
+ * @returns False if evaluation failed, the error is kept in the file
+ */
+bool Batch::eval_unit(File &file, std::string source, Env *&env,
+                      Arena *&arena) {
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        wake.wait(guard, [this] { return !collecting; });
+        running++;
+        if (arena != nullptr) arena->release();
+    }
+    GCLocal local;
+    Heap::current().attach_thread(&local);
+    if (env == nullptr) {
+        Frame file_frame {};
+        env = gc_new<Env>(file_frame);
+        Heap::current().add_root(env);
+    }
+
+    Writer out;
+    Writer::redirect(&out);
+    arena = Heap::current().new_arena();
+    try {
+        TokenStream ts(std::move(source),
+                       cache ? std::string(file.name) + "c" : "");
+        while (ts.has_next()) {
+            Expr *expr = build_AST(ts, ts.next(), env, arena);
+            if (expr->get_expr_type() == ExpType::PRIM)
+                out.write_value(expr->eval(NO_BINDING, env));
+            else
+                out.write_value(Value(expr));
+            out.put('\n');
+        }
+    }
+    catch (const char* e)        { file.error = e; }
+    catch (const std::string &e) { file.error = e; }
+    catch (...)                  { file.error = "Unexpected error"; }
+    Writer::redirect(nullptr);
+    file.out += out.str();
+    Heap::current().detach_thread();
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        running--;
+        if (Heap::current().collection_due()) due = true;
+    }
+    idle.notify_one();
+    return file.error.empty();
+}
@@ -0,0 +1,79 @@
+/*============================================================================
+ *  nanoscheme
+ *  Copyright (c) 2019-2020 - Trung Truong
+ *
+ *  File name: batch.h
+ *  Description: Header file for `Batch` class, which evaluates independent
+ *  files concurrently
+ *
+ *==========================================================================*/
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "arena.h"
+#include "env.h"
+#ifndef BATCH_H_
+#define BATCH_H_
+
+/*============================================================================
+ *  Batch class
+ *===========================================================================*/
+/**
+ * Files evaluated on a fixed set of threads, see `--jobs`. Each file has a
+ * global env of its own, so definitions of one file are not seen by the
+ * others, and what it prints is kept in memory until it is done. Outputs
+ * are printed in the order the files were given, each followed by the
+ * error that stopped its file, if any; a failed file does not stop the
+ * others.
+ *
+ * Files are read in batches of forms, as they are one at a time. Each
+ * batch is evaluated between two collections, the way a `Server`
+ * evaluates a request.
+ */
+class Batch {
+private:
+    struct File {
+        const char *name;
+        std::string out;                // Printed results
+        std::string error;              // Empty unless it failed
+        bool done;
+    };
+
+    std::vector<File> files;
+    bool cache;
+
+    // Shared with the threads
+    std::vector<std::thread> threads;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    size_t next;                        // Index of the next file to start
+    size_t running;                     // Batches of forms being evaluated
+    bool collecting;
+    bool due;
+
+    /* Main thread */
+    void collect(std::unique_lock<std::mutex> &guard);
+    void print(File &file);
+
+    /* Threads */
+    void loop();
+    void eval_file(File &file);
+    bool eval_unit(File &file, std::string source, Env *&env,
+                   Arena *&arena);
+
+public:
+    /* Constructors */
+    Batch(int num_files, char* file_names[], bool cache);
+    ~Batch();
+    Batch(const Batch &) = delete;
+    Batch &operator=(const Batch &) = delete;
+
+    size_t run(size_t num_threads);
+};
+
+#endif
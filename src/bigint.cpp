@@ -0,0 +1,386 @@
+/*============================================================================
+ *  nanoscheme
+ *  Copyright (c) 2019-2020 - Trung Truong
+ *
+ *  File name: bigint.cpp
+ *  Description: Implementation of `BigInt` class
+ *
+ *  Signs are handled by the public operations, which work on magnitudes.
+ *  Multiplication is schoolbook below `KARATSUBA_THRESHOLD` limbs and
+ *  Karatsuba above it. Division is Knuth's algorithm D.
+ *
+ *==========================================================================*/
+#include <algorithm>
+#include "bigint.h"
+
+typedef std::vector<uint32_t> Limbs;
+
+/* Operands with fewer limbs than this are multiplied the schoolbook way */
+static const size_t KARATSUBA_THRESHOLD = 32;
+
+/* Largest power of 10 that fits in a limb, for decimal conversions */
+static const uint32_t DECIMAL_BASE = 1000000000;
+static const size_t DECIMAL_DIGITS = 9;
+
+/*============================================================================
+ *  Magnitudes
+ *===========================================================================*/
+static void trim(Limbs &a) {
+    while (!a.empty() && a.back() == 0) a.pop_back();
+}
+
+static int compare_mag(const Limbs &a, const Limbs &b) {
+    if (a.size() != b.size()) return a.size() < b.size() ? -1 : 1;
+    for (size_t i = a.size(); i-- > 0;) {
+        if (a[i] != b[i]) return a[i] < b[i] ? -1 : 1;
+    }
+    return 0;
+}
+
+static Limbs add_mag(const Limbs &a, const Limbs &b) {
+    const Limbs &x = a.size() >= b.size() ? a : b;
+    const Limbs &y = a.size() >= b.size() ? b : a;
+    Limbs r(x.size() + 1);
+    uint64_t carry = 0;
+    for (size_t i = 0; i < x.size(); i++) {
+        carry += uint64_t(x[i]) + (i < y.size() ? y[i] : 0);
+        r[i] = uint32_t(carry);
+        carry >>= 32;
+    }
+    r[x.size()] = uint32_t(carry);
+    trim(r);
+    return r;
+}
+
+/* Magnitude of `a - b`, where `a >= b` */
+static Limbs sub_mag(const Limbs &a, const Limbs &b) {
+    Limbs r(a.size());
+    int64_t borrow = 0;
+    for (size_t i = 0; i < a.size(); i++) {
+        int64_t d = int64_t(a[i]) - (i < b.size() ? b[i] : 0) - borrow;
+        borrow = d < 0;
+        r[i] = uint32_t(d + (borrow << 32));
+    }
+    trim(r);
+    return r;
+}
+
+/* Add `b * 2^(32 * shift)` to `r`, which is large enough to hold it */
+static void add_shifted(Limbs &r, const Limbs &b, size_t shift) {
+    uint64_t carry = 0;
+    size_t i = 0;
+    for (; i < b.size(); i++) {
+        carry += uint64_t(r[i + shift]) + b[i];
+        r[i + shift] = uint32_t(carry);
+        carry >>= 32;
+    }
+    for (; carry != 0; i++) {
+        carry += r[i + shift];
+        r[i + shift] = uint32_t(carry);
+        carry >>= 32;
+    }
+}
+
+static Limbs slice(const Limbs &a, size_t from, size_t to) {
+    from = std::min(from, a.size());
+    to = std::min(to, a.size());
+    Limbs r(a.begin() + from, a.begin() + to);
+    trim(r);
+    return r;
+}
+
+static Limbs mul_schoolbook(const Limbs &a, const Limbs &b) {
+    Limbs r(a.size() + b.size());
+    for (size_t i = 0; i < a.size(); i++) {
+        uint64_t carry = 0;
+        for (size_t j = 0; j < b.size(); j++) {
+            carry += uint64_t(a[i]) * b[j] + r[i + j];
+            r[i + j] = uint32_t(carry);
+            carry >>= 32;
+        }
+        r[i + b.size()] = uint32_t(carry);
+    }
+    trim(r);
+    return r;
+}
+
+/**
+ * Multiply magnitudes. Both are split at half the size of the larger one,
+ * `a = a1 * B^m + a0` and likewise for `b`, and the product is assembled
+ * from `a0 * b0`, `a1 * b1` and `(a0 + a1) * (b0 + b1)`.
+ * @param a Magnitude
+ * @param b Magnitude
+ * @returns Magnitude of the product
+ */
+static Limbs mul_mag(const Limbs &a, const Limbs &b) {
+    if (a.empty() || b.empty()) return Limbs();
+    if (std::min(a.size(), b.size()) < KARATSUBA_THRESHOLD)
+        return mul_schoolbook(a, b);
+
+    size_t m = std::max(a.size(), b.size()) / 2;
+    Limbs r(a.size() + b.size() + 1);
+
+    // An operand shorter than the split multiplies both halves of the
+    // other one
+    if (b.size() <= m || a.size() <= m) {
+        const Limbs &x = a.size() > m ? a : b;
+        const Limbs &y = a.size() > m ? b : a;
+        add_shifted(r, mul_mag(slice(x, 0, m), y), 0);
+        add_shifted(r, mul_mag(slice(x, m, x.size()), y), m);
+        trim(r);
+        return r;
+    }
+
+    Limbs a0 = slice(a, 0, m), a1 = slice(a, m, a.size());
+    Limbs b0 = slice(b, 0, m), b1 = slice(b, m, b.size());
+    Limbs z0 = mul_mag(a0, b0);
+    Limbs z2 = mul_mag(a1, b1);
+    Limbs z1 = mul_mag(add_mag(a0, a1), add_mag(b0, b1));
+    z1 = sub_mag(sub_mag(z1, z0), z2);
+
+    add_shifted(r, z0, 0);
+    add_shifted(r, z1, m);
+    add_shifted(r, z2, 2 * m);
+    trim(r);
+    return r;
+}
+
+/* Divide a magnitude by a single limb in place, returning the remainder */
+static uint32_t divmod_small(Limbs &a, uint32_t d) {
+    uint64_t rem = 0;
+    for (size_t i = a.size(); i-- > 0;) {
+        uint64_t cur = (rem << 32) | a[i];
+        a[i] = uint32_t(cur / d);
+        rem = cur % d;
+    }
+    trim(a);
+    return uint32_t(rem);
+}
+
+/**
+ * Divide magnitudes with Knuth's algorithm D. The divisor is shifted so
+ * that its top limb has its high bit set, which keeps every estimated
+ * quotient limb at most 2 above the real one.
+ * @param u Dividend
+ * @param v Divisor, not zero
+ * @param q Reference to quotient
+ * @param r Reference to remainder
+ * @returns void
+ */
+static void divmod_mag(const Limbs &u, const Limbs &v, Limbs &q, Limbs &r) {
+    if (compare_mag(u, v) < 0) {
+        q.clear();
+        r = u;
+        return;
+    }
+    if (v.size() == 1) {
+        q = u;
+        uint32_t rem = divmod_small(q, v[0]);
+        r.clear();
+        if (rem != 0) r.push_back(rem);
+        return;
+    }
+
+    const uint64_t B = uint64_t(1) << 32;
+    size_t n = v.size(), m = u.size() - n;
+    int s = __builtin_clz(v[n - 1]);
+
+    Limbs vn(n), un(u.size() + 1);
+    for (size_t i = n - 1; i > 0; i--)
+        vn[i] = uint32_t(((uint64_t(v[i]) << 32) | v[i - 1]) >> (32 - s));
+    vn[0] = v[0] << s;
+    un[m + n] = uint32_t((uint64_t(u[m + n - 1]) << s) >> 32);
+    for (size_t i = m + n - 1; i > 0; i--)
+        un[i] = uint32_t(((uint64_t(u[i]) << 32) | u[i - 1]) >> (32 - s));
+    un[0] = u[0] << s;
+
+    q.assign(m + 1, 0);
+    for (size_t j = m + 1; j-- > 0;) {
+        uint64_t num = (uint64_t(un[j + n]) << 32) | un[j + n - 1];
+        uint64_t qhat = num / vn[n - 1];
+        uint64_t rhat = num % vn[n - 1];
+        while (qhat >= B ||
+               qhat * vn[n - 2] > ((rhat << 32) | un[j + n - 2])) {
+            qhat--;
+            rhat += vn[n - 1];
+            if (rhat >= B) break;
+        }
+
+        // Multiply and subtract
+        int64_t borrow = 0, t = 0;
+        for (size_t i = 0; i < n; i++) {
+            uint64_t p = qhat * vn[i];
+            t = int64_t(un[i + j]) - borrow - int64_t(p & 0xFFFFFFFF);
+            un[i + j] = uint32_t(t);
+            borrow = int64_t(p >> 32) - (t >> 32);
+        }
+        t = int64_t(un[j + n]) - borrow;
+        un[j + n] = uint32_t(t);
+
+        // Estimate was one too large, add the divisor back
+        q[j] = uint32_t(qhat);
+        if (t < 0) {
+            q[j]--;
+            uint64_t carry = 0;
+            for (size_t i = 0; i < n; i++) {
+                carry += uint64_t(un[i + j]) + vn[i];
+                un[i + j] = uint32_t(carry);
+                carry >>= 32;
+            }
+            un[j + n] += uint32_t(carry);
+        }
+    }
+
+    r.assign(n, 0);
+    for (size_t i = 0; i < n; i++)
+        r[i] = uint32_t(((uint64_t(un[i + 1]) << 32) | un[i]) >> s);
+    trim(q);
+    trim(r);
+}
+
+/*============================================================================
+ *  Constructors
+ *===========================================================================*/
+BigInt::BigInt(bool n, Limbs m) : neg(n), mag(std::move(m)) {
+    trim(mag);
+    if (mag.empty()) neg = false;
+}
+
+BigInt::BigInt() : neg(false), mag() {}
+
+BigInt::BigInt(int64_t i) : neg(i < 0), mag() {
+    uint64_t u = neg ? 0 - uint64_t(i) : uint64_t(i);
+    for (; u != 0; u >>= 32) mag.push_back(uint32_t(u));
+}
+
+/**
+ * Parse a decimal integer with an optional sign
+ * @param s String of the integer
+ * @param out Reference to parsed integer
+ * @returns False if the string is not made of digits only
+ */
+bool BigInt::parse(const std::string &s, BigInt &out) {
+    size_t start = (s[0] == '-' || s[0] == '+') ? 1 : 0;
+    if (s.size() <= start) return false;
+    for (size_t i = start; i < s.size(); i++) {
+        if (s[i] < '0' || s[i] > '9') return false;
+    }
+
+    // Digits are consumed in chunks that fit in a limb
+    Limbs m;
+    for (size_t i = start; i < s.size();) {
+        size_t len = std::min(DECIMAL_DIGITS, s.size() - i);
+        uint64_t chunk = std::stoul(s.substr(i, len));
+        uint64_t scale = 1;
+        for (size_t k = 0; k < len; k++) scale *= 10;
+        for (uint32_t &limb : m) {
+            chunk += limb * scale;
+            limb = uint32_t(chunk);
+            chunk >>= 32;
+        }
+        if (chunk != 0) m.push_back(uint32_t(chunk));
+        i += len;
+    }
+    out = BigInt(s[0] == '-', std::move(m));
+    return true;
+}
+
+/*============================================================================
+ *  Getters
+ *===========================================================================*/
+bool BigInt::is_negative() const {
+    return neg;
+}
+
+bool BigInt::is_zero() const {
+    return mag.empty();
+}
+
+bool BigInt::fits_int64() const {
+    if (mag.size() > 2) return false;
+    uint64_t u = 0;
+    if (mag.size() > 0) u = mag[0];
+    if (mag.size() > 1) u |= uint64_t(mag[1]) << 32;
+    return u <= uint64_t(INT64_MAX) + (neg ? 1 : 0);
+}
+
+/* Low 64 bits of the integer, in two's complement */
+int64_t BigInt::to_int64() const {
+    uint64_t u = 0;
+    if (mag.size() > 0) u = mag[0];
+    if (mag.size() > 1) u |= uint64_t(mag[1]) << 32;
+    return int64_t(neg ? 0 - u : u);
+}
+
+double BigInt::to_double() const {
+    double d = 0.0;
+    for (size_t i = mag.size(); i-- > 0;) d = d * 4294967296.0 + mag[i];
+    return neg ? -d : d;
+}
+
+std::string BigInt::to_string() const {
+    if (mag.empty()) return "0";
+    std::vector<uint32_t> chunks;
+    for (Limbs m = mag; !m.empty();)
+        chunks.push_back(divmod_small(m, DECIMAL_BASE));
+
+    std::string s = neg ? "-" : "";
+    s += std::to_string(chunks.back());
+    for (size_t i = chunks.size() - 1; i-- > 0;) {
+        std::string digits = std::to_string(chunks[i]);
+        s += std::string(DECIMAL_DIGITS - digits.size(), '0') + digits;
+    }
+    return s;
+}
+
+/*============================================================================
+ *  Arithmetic
+ *===========================================================================*/
+BigInt BigInt::add(const BigInt &a, const BigInt &b) {
+    if (a.neg == b.neg) return BigInt(a.neg, add_mag(a.mag, b.mag));
+    if (compare_mag(a.mag, b.mag) >= 0)
+        return BigInt(a.neg, sub_mag(a.mag, b.mag));
+    return BigInt(b.neg, sub_mag(b.mag, a.mag));
+}
+
+BigInt BigInt::sub(const BigInt &a, const BigInt &b) {
+    return add(a, negate(b));
+}
+
+BigInt BigInt::mul(const BigInt &a, const BigInt &b) {
+    return BigInt(a.neg != b.neg, mul_mag(a.mag, b.mag));
+}
+
+/**
+ * Divide two integers, truncating toward zero. The remainder has the sign
+ * of the dividend.
+ * @param a Dividend
+ * @param b Divisor, not zero
+ * @param q Reference to quotient
+ * @param r Reference to remainder
+ * @returns void
+ */
+void BigInt::divmod(const BigInt &a, const BigInt &b, BigInt &q,
+                    BigInt &r) {
+    Limbs qm, rm;
+    divmod_mag(a.mag, b.mag, qm, rm);
+    q = BigInt(a.neg != b.neg, std::move(qm));
+    r = BigInt(a.neg, std::move(rm));
+}
+
+BigInt BigInt::negate(const BigInt &a) {
+    return BigInt(!a.neg, a.mag);
+}
+
+/**
+ * Compare two integers
+ * @param a Integer
+ * @param b Integer
+ * @returns Negative, zero or positive if `a` is less than, equal to or
+ * greater than `b`
+ */
+int BigInt::compare(const BigInt &a, const BigInt &b) {
+    if (a.neg != b.neg) return a.neg ? -1 : 1;
+    int c = compare_mag(a.mag, b.mag);
+    return a.neg ? -c : c;
+}
@@ -0,0 +1,55 @@
+/*============================================================================
+ *  nanoscheme
+ *  Copyright (c) 2019-2020 - Trung Truong
+ *
+ *  File name: bigint.h
+ *  Description: Header file for `BigInt` class, the arbitrary-precision
+ *  integers that integer arithmetic promotes to on overflow
+ *
+ *==========================================================================*/
+#include <cstdint>
+#include <string>
+#include <vector>
+#ifndef BIGINT_H_
+#define BIGINT_H_
+
+/*============================================================================
+ *  BigInt class
+ *===========================================================================*/
+/**
+ * Sign and magnitude. The magnitude is stored as base 2^32 limbs, least
+ * significant first and without leading zero limbs, so zero has none.
+ * Division truncates toward zero, like the built-in integer division.
+ */
+class BigInt {
+private:
+    bool neg;
+    std::vector<uint32_t> mag;
+
+    BigInt(bool n, std::vector<uint32_t> m);
+
+public:
+    /* Constructors */
+    BigInt();
+    BigInt(int64_t i);
+    static bool parse(const std::string &s, BigInt &out);
+
+    /* Getters */
+    bool is_negative() const;
+    bool is_zero() const;
+    bool fits_int64() const;
+    int64_t to_int64() const;
+    double to_double() const;
+    std::string to_string() const;
+
+    /* Arithmetic */
+    static BigInt add(const BigInt &a, const BigInt &b);
+    static BigInt sub(const BigInt &a, const BigInt &b);
+    static BigInt mul(const BigInt &a, const BigInt &b);
+    static void divmod(const BigInt &a, const BigInt &b, BigInt &q,
+                       BigInt &r);
+    static BigInt negate(const BigInt &a);
+    static int compare(const BigInt &a, const BigInt &b);
+};
+
+#endif
@@ -0,0 +1,227 @@
+/*============================================================================
+ *  nanoscheme
+ *  Copyright (c) 2019-2020 - Trung Truong
+ *
+ *  File name: compiler.cpp
+ *  Description: Implementation of `Compiler` class
+ *
+ *  A lambda body is compiled right after it is built, before the lambda can
+ *  be evaluated. Calls in a body are already reduced to recursive call nodes
+ *  by the parser, and variables to lexical addresses, so the compiler only
+ *  has to linearize the tree. Anything without a dedicated instruction is
+ *  left to the tree-walker through `EVAL`.
+ *
+ *==========================================================================*/
+#include <algorithm>
+#include "compiler.h"
+
+/* Constructors */
+Compiler::Compiler() : ops({}), consts({}), depth(0), max_stack(0) {}
+
+/*============================================================================
+ *  Emitters
+ *===========================================================================*/
+/**
+ * Emit an opcode and track the depth of the operand stack
+ * @param op Opcode
+ * @param delta Change of stack depth after the instruction ran
+ * @returns void
+ */
+void Compiler::emit(OpCode op, int delta) {
+    ops.push_back(static_cast<int32_t>(op));
+    depth += delta;
+    max_stack = std::max(max_stack, depth);
+}
+
+void Compiler::emit_operand(int32_t operand) {
+    ops.push_back(operand);
+}
+
+int32_t Compiler::add_const(Value v) {
+    consts.push_back(v);
+    return static_cast<int32_t>(consts.size() - 1);
+}
+
+/*============================================================================
+ *  Compilers
+ *===========================================================================*/
+/**
+ * Compile an expression so that running it pushes exactly one value
+ * @param e Pointer to expression
+ * @param tail Whether the value of the expression is returned by the body
+ * @returns void
+ */
+void Compiler::compile_expr(Expr *e, bool tail) {
+    switch (e->type) {
+        case ExpType::INT: case ExpType::BIGINT: case ExpType::FLOAT:
+        case ExpType::LIT: case ExpType::STRING: case ExpType::LIST:
+        case ExpType::VECTOR: case ExpType::HASH:
+            emit(OpCode::CONST, 1);
+            emit_operand(add_const(e));
+            break;
+        case ExpType::LOCAL: {
+            size_t d = std::get<1>(e->local);
+            size_t s = std::get<2>(e->local);
+            if (d == 0) {
+                emit(OpCode::LOCAL0, 1);
+                emit_operand(static_cast<int32_t>(s));
+            }
+            else {
+                emit(OpCode::LOCAL, 1);
+                emit_operand(add_const(e));
+            }
+            break;
+        }
+        case ExpType::SYMBOL:
+            emit(OpCode::GLOBAL, 1);
+            emit_operand(add_const(e));
+            break;
+        case ExpType::PRIM:
+            compile_prim(e, tail);
+            break;
+        case ExpType::PROC:
+            // Recursive call node, see `Expr::eval_proc`. Other procedures
+            // are values folded in by the parser.
+            if (std::get<1>(e->proc)->type == ExpType::SYMBOL) {
+                compile_call(e, tail);
+            }
+            else {
+                emit(OpCode::CONST, 1);
+                emit_operand(add_const(e));
+            }
+            break;
+        default:
+            emit(OpCode::EVAL, 1);
+            emit_operand(add_const(e));
+            break;
+    }
+}
+
+/**
+ * Compile primitive expression. Primitives whose number of arguments is
+ * invalid are tree-walked, so they throw the usual error when evaluated.
+ * @param e Pointer to primitive expression
+ * @param tail Whether the value of the expression is returned by the body
+ * @returns void
+ */
+void Compiler::compile_prim(Expr *e, bool tail) {
+    PrimType prim_type = std::get<0>(e->prim);
+    ExprArray &args = std::get<1>(e->prim);
+    int argc = static_cast<int>(args.size());
+
+    switch (prim_type) {
+        case PrimType::IF: {
+            if (argc != 3) break;
+            compile_expr(args[0], false);
+            emit(OpCode::JUMP_UNLESS, -1);
+            size_t to_else = ops.size();
+            emit_operand(0);
+
+            compile_expr(args[1], tail);
+            emit(OpCode::JUMP, 0);
+            size_t to_end = ops.size();
+            emit_operand(0);
+
+            // Both branches push one value, only one of them runs
+            depth--;
+            ops[to_else] = static_cast<int32_t>(ops.size());
+            compile_expr(args[2], tail);
+            ops[to_end] = static_cast<int32_t>(ops.size());
+            return;
+        }
+        case PrimType::ADD: case PrimType::MUL: {
+            for (Expr *arg : args) compile_expr(arg, false);
+            emit(prim_type == PrimType::ADD ? OpCode::ADD : OpCode::MUL,
+                 1 - argc);
+            emit_operand(argc);
+            return;
+        }
+        case PrimType::SUB: case PrimType::DIV: case PrimType::MOD:
+        case PrimType::GT:  case PrimType::LT:  case PrimType::GE:
+        case PrimType::LE:  case PrimType::EQ_NUM:
+        case PrimType::CONS: case PrimType::MAP: case PrimType::FILTER: {
+            if (argc != 2) break;
+            compile_expr(args[0], false);
+            compile_expr(args[1], false);
+
+            OpCode op;
+            switch (prim_type) {
+                case PrimType::SUB:     op = OpCode::SUB;       break;
+                case PrimType::DIV:     op = OpCode::DIV;       break;
+                case PrimType::MOD:     op = OpCode::MOD;       break;
+                case PrimType::GT:      op = OpCode::GT;        break;
+                case PrimType::LT:      op = OpCode::LT;        break;
+                case PrimType::GE:      op = OpCode::GE;        break;
+                case PrimType::LE:      op = OpCode::LE;        break;
+                case PrimType::EQ_NUM:  op = OpCode::EQ_NUM;    break;
+                case PrimType::CONS:    op = OpCode::CONS;      break;
+                case PrimType::MAP:     op = OpCode::MAP;       break;
+                default:                op = OpCode::FILTER;    break;
+            }
+            emit(op, -1);
+            return;
+        }
+        case PrimType::CAR: case PrimType::CDR: case PrimType::IS_NULL: {
+            if (argc != 1) break;
+            compile_expr(args[0], false);
+            if (prim_type == PrimType::CAR)         emit(OpCode::CAR, 0);
+            else if (prim_type == PrimType::CDR)    emit(OpCode::CDR, 0);
+            else                                    emit(OpCode::IS_NULL, 0);
+            return;
+        }
+        case PrimType::LAMBDA: {
+            emit(OpCode::CLOSURE, 1);
+            emit_operand(add_const(e));
+            return;
+        }
+        default: break;
+    }
+
+    emit(OpCode::EVAL, 1);
+    emit_operand(add_const(e));
+}
+
+/**
+ * Compile recursive call node. Arguments are evaluated on the operand stack
+ * in the caller's frame, the callee is looked up by name when called.
+ * @param e Pointer to procedure expression with a symbol as body
+ * @param tail Whether the result of the call is returned by the body
+ * @returns void
+ */
+void Compiler::compile_call(Expr *e, bool tail) {
+    std::vector<Expr*> &call_args = *std::get<0>(e->proc)->list.vec;
+    int argc = static_cast<int>(call_args.size());
+
+    for (Expr *arg : call_args) compile_expr(arg, false);
+    emit(tail ? OpCode::TAIL_CALL : OpCode::CALL, 1 - argc);
+    emit_operand(add_const(e));
+    emit_operand(argc);
+}
+
+/**
+ * Compile the body of a lambda
+ * @param body Pointer to lambda body
+ * @param arena Arena of the compilation unit
+ * @returns Pointer to bytecode expression, or the body itself if it needs
+ * a larger operand stack than the VM provides
+ */
+Expr *Compiler::compile_lambda(Expr *body, Arena *arena) {
+    Compiler compiler;
+    compiler.compile_expr(body, true);
+    compiler.emit(OpCode::RETURN, -1);
+    if (compiler.max_stack > VM_STACK_SIZE) return body;
+
+    size_t consts_size = compiler.consts.size() * sizeof(Value);
+    size_t ops_size = compiler.ops.size() * sizeof(int32_t);
+    void *mem = arena->allocate(GCKind::CODE,
+                                sizeof(Code) + consts_size + ops_size);
+
+    Code *code = new (mem) Code();
+    code->consts = reinterpret_cast<Value*>(code + 1);
+    code->num_consts = compiler.consts.size();
+    code->ops = reinterpret_cast<int32_t*>(code->consts + code->num_consts);
+    code->max_stack = compiler.max_stack;
+    std::copy(compiler.consts.begin(), compiler.consts.end(), code->consts);
+    std::copy(compiler.ops.begin(), compiler.ops.end(), code->ops);
+    return arena_new<Expr>(arena, code);
+}
@@ -0,0 +1,45 @@
+/*============================================================================
+ *  nanoscheme
+ *  Copyright (c) 2019-2020 - Trung Truong
+ *
+ *  File name: compiler.h
+ *  Description: Header file for `Compiler` class, which compiles lambda
+ *  bodies to bytecode for the `VM`
+ *
+ *==========================================================================*/
+#include <vector>
+
+#include "arena.h"
+#include "expr.h"
+#include "vm.h"
+#ifndef COMPILER_H_
+#define COMPILER_H_
+
+/*============================================================================
+ *  Compiler class
+ *===========================================================================*/
+class Compiler {
+private:
+    std::vector<int32_t> ops;
+    std::vector<Value> consts;
+    size_t depth;
+    size_t max_stack;
+
+    /* Constructors */
+    Compiler();
+
+    /* Emitters */
+    void emit(OpCode op, int delta);
+    void emit_operand(int32_t operand);
+    int32_t add_const(Value v);
+
+    /* Specific type compilers */
+    void compile_expr(Expr *e, bool tail);
+    void compile_prim(Expr *e, bool tail);
+    void compile_call(Expr *e, bool tail);
+
+public:
+    static Expr *compile_lambda(Expr *body, Arena *arena);
+};
+
+#endif
@@ -0,0 +1,168 @@
+/*============================================================================
+ *  nanoscheme
+ *  Copyright (c) 2019-2020 - Trung Truong
+ *
+ *  File name: counters.cpp
+ *  Description: Implementation of `Counters` class
+ *
+ *  Counts made by a thread before it registered are kept, they are only
+ *  read from then on. Reading the counters of a running thread is not synchronized with its
+ *  increments, so a total taken while other threads evaluate is only
+ *  approximate; totals taken between jobs are exact.
+ *
+ *==========================================================================*/
+#include <algorithm>
+#include <mutex>
+#include <vector>
+#include "counters.h"
+#include "parser.h"
+
+static const char *exp_type_names[NUM_EXP_TYPES] = {
+    "lit", "int", "bigint", "float", "string", "list", "symbol", "local",
+    "proc", "prim", "code", "memo", "vector",
+    "hash"
+};
+
+/* Counters of the running threads, and the sum of those of past threads */
+struct Registry {
+    std::mutex lock;
+    std::vector<const EvalStats*> live;
+    EvalStats retired;
+};
+
+/**
+ * Get the registry of counters. It is never destroyed, threads may exit
+ * after static destructors ran.
+ * @returns Registry
+ */
+static Registry &registry() {
+    static Registry *r = new Registry();
+    return *r;
+}
+
+thread_local EvalStats Counters::local;
+
+/* Registration of the counters of a thread, for as long as it runs */
+struct Registration {
+    Registration() {
+        Registry &r = registry();
+        std::lock_guard<std::mutex> guard(r.lock);
+        r.live.push_back(&Counters::get());
+    }
+    ~Registration() {
+        Registry &r = registry();
+        std::lock_guard<std::mutex> guard(r.lock);
+        r.retired.add(Counters::get());
+        const EvalStats *stats = &Counters::get();
+        r.live.erase(std::find(r.live.begin(), r.live.end(), stats));
+    }
+};
+
+/**
+ * Register the counters of the calling thread, once
+ * @returns void
+ */
+void Counters::attach() {
+    thread_local Registration registration;
+    (void) registration;
+}
+
+void EvalStats::add(const EvalStats &other) {
+    for (size_t i = 0; i < NUM_EXP_TYPES; i++) evals[i] += other.evals[i];
+    for (size_t i = 0; i < NUM_PRIM_TYPES; i++) prims[i] += other.prims[i];
+    lookups += other.lookups;
+    lookup_envs += other.lookup_envs;
+    exprs += other.exprs;
+    envs += other.envs;
+    list_bytes += other.list_bytes;
+}
+
+/**
+ * Sum the counters of every thread
+ * @returns Counters of the program so far
+ */
+EvalStats Counters::get_stats() {
+    attach();
+    Registry &r = registry();
+    std::lock_guard<std::mutex> guard(r.lock);
+    EvalStats total = r.retired;
+    for (const EvalStats *stats : r.live) total.add(*stats);
+    return total;
+}
+
+/*============================================================================
+ *  Views
+ *===========================================================================*/
+/**
+ * Make a `(name count)` list
+ * @param name Name of the counter
+ * @param n Count
+ * @returns List
+ */
+static Value make_counter(const std::string &name, size_t n) {
+    ListBuilder l;
+    l.push(Value(gc_new<Expr>(name)));
+    l.push(Value(int64_t(n)));
+    return l.finish(nullptr);
+}
+
+/**
+ * Make the list returned by 'runtime-stats':
+ * `(("evals" ("lit" n) ..) ("prims" ("+" n) ..) ("lookups" n)
+ *   ("lookup-envs" n) ("exprs" n) ("envs" n) ("list-bytes" n))`.
+ * Every type is listed, counted or not.
+ * @param stats Counters
+ * @returns List
+ */
+Value Counters::make_list(const EvalStats &stats) {
+    ListBuilder evals, prims, l;
+    evals.push(Value(gc_new<Expr>(std::string("evals"))));
+    for (size_t i = 0; i < NUM_EXP_TYPES; i++)
+        evals.push(make_counter(exp_type_names[i], stats.evals[i]));
+    prims.push(Value(gc_new<Expr>(std::string("prims"))));
+    for (size_t i = 0; i < NUM_PRIM_TYPES; i++)
+        prims.push(make_counter(prim_name(PrimType(i)), stats.prims[i]));
+
+    l.push(evals.finish(nullptr));
+    l.push(prims.finish(nullptr));
+    l.push(make_counter("lookups", stats.lookups));
+    l.push(make_counter("lookup-envs", stats.lookup_envs));
+    l.push(make_counter("exprs", stats.exprs));
+    l.push(make_counter("envs", stats.envs));
+    l.push(make_counter("list-bytes", stats.list_bytes));
+    return l.finish(nullptr);
+}
+
+/**
+ * Print the counters, as `--stats` does on exit. Types that were never
+ * counted are left out.
+ * @param out Stream
+ * @param stats Counters
+ * @returns void
+ */
+void Counters::print(std::ostream &out, const EvalStats &stats) {
+    size_t num_evals = 0, num_prims = 0;
+    for (size_t n : stats.evals) num_evals += n;
+    for (size_t n : stats.prims) num_prims += n;
+
+    out << "Eval dispatches:     " << num_evals << "\n";
+    for (size_t i = 0; i < NUM_EXP_TYPES; i++) {
+        if (stats.evals[i] == 0) continue;
+        std::string name = exp_type_names[i];
+        out << "  " << name << std::string(19 - name.size(), ' ')
+            << stats.evals[i] << "\n";
+    }
+    out << "Eval primitives:     " << num_prims << "\n";
+    for (size_t i = 0; i < NUM_PRIM_TYPES; i++) {
+        if (stats.prims[i] == 0) continue;
+        std::string name = prim_name(PrimType(i));
+        out << "  " << name
+            << std::string(name.size() < 19 ? 19 - name.size() : 1, ' ')
+            << stats.prims[i] << "\n";
+    }
+    out << "Env lookups:         " << stats.lookups << ", "
+        << stats.lookup_envs << " envs searched\n"
+        << "Allocated exprs:     " << stats.exprs << "\n"
+        << "Allocated envs:      " << stats.envs << "\n"
+        << "List vector bytes:   " << stats.list_bytes << "\n";
+}
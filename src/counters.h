@@ -0,0 +1,67 @@
+/*============================================================================
+ *  nanoscheme
+ *  Copyright (c) 2019-2020 - Trung Truong
+ *
+ *  File name: counters.h
+ *  Description: Header file for `Counters` class, the statistics of the
+ *  evaluator
+ *
+ *==========================================================================*/
+#include <cstddef>
+#include <ostream>
+
+#include "expr.h"
+#include "gc.h"
+#ifndef COUNTERS_H_
+#define COUNTERS_H_
+
+static const size_t NUM_EXP_TYPES = size_t(ExpType::HASH) + 1;
+static const size_t NUM_PRIM_TYPES = size_t(PrimType::RUNTIME_STATS) + 1;
+
+/* Work done by the evaluator, see `--stats` and 'runtime-stats' */
+struct EvalStats {
+    size_t evals[NUM_EXP_TYPES];    // Expressions dispatched by `eval`
+    size_t prims[NUM_PRIM_TYPES];   // Primitives evaluated, 'if' included
+    size_t lookups;                 // Calls of `Env::find_var`
+    size_t lookup_envs;             // Envs searched by those calls
+    size_t exprs;                   // `Expr`s allocated, heap and arenas
+    size_t envs;                    // `Env`s allocated
+    size_t list_bytes;              // Element storage of list vectors
+
+    void add(const EvalStats &other);
+};
+
+/*============================================================================
+ *  Counters class
+ *===========================================================================*/
+/**
+ * Every thread counts into its own `EvalStats` with plain increments, so
+ * the counters are always on and cost no more than an add. They are plain
+ * data, so counting needs no check that they were set up. A thread that
+ * evaluates registers its counters with `attach`, as `Heap::attach_thread`
+ * does, and they are added to the retired total when it exits. Counters
+ * are only summed when read.
+ */
+class Counters {
+private:
+    static thread_local EvalStats local;
+
+public:
+    /* Counters of the calling thread */
+    static EvalStats &get() { return local; }
+    static void attach();
+
+    static void count_object(GCKind kind) {
+        local.exprs += kind == GCKind::EXPR;
+        local.envs += kind == GCKind::ENV;
+    }
+
+    /* Sum of the counters of every thread, past and running */
+    static EvalStats get_stats();
+
+    /* Views of the counters */
+    static Value make_list(const EvalStats &stats);
+    static void print(std::ostream &out, const EvalStats &stats);
+};
+
+#endif
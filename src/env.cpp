@@ -6,14 +6,17 @@
  *  Description: Implementation of `Env` class
  * 
  *==========================================================================*/
+#include "counters.h"
 #include "env.h"
 
  /* Constructors */
-Env::Env(std::unordered_map<std::string, Expr*> &f)
+Env::Env(Frame &f)
     :frame(f), tail(nullptr) {}
-Env::Env(std::unordered_map<std::string, Expr*> &f, Env *tl)
+Env::Env(Frame &f, Env *tl)
     :frame(f), tail(tl) {}
 Env::Env(Env *tl) { frame = {}; tail = tl; }
+Env::Env(Env *tl, size_t num_slots)
+    :frame({}), slots(num_slots), tail(tl) {}
 
 /* Destructor */
 Env::~Env() {}
@@ -23,11 +26,24 @@ Env *Env::get_tl() {
     return tail; 
 }
 
-void Env::add_key_value_pair(std::string &k, Expr *v) {
+/**
+ * Find the innermost frame holding named bindings, skipping the frames of
+ * calls and of captured variables. A named frame that is still empty is
+ * skipped as well, as nothing could be found in it.
+ * @returns This frame, or the first frame it is chained to, that has named
+ * bindings, or the last frame of the chain
+ */
+Env *Env::get_named() {
+    Env *env = this;
+    while (env->frame.empty() && env->tail != nullptr) env = env->tail;
+    return env;
+}
+
+void Env::add_key_value_pair(const Symbol *k, Expr *v) {
     frame[k] = v;
 }
 
-bool Env::is_in_env(std::string name) {
+bool Env::is_in_env(const Symbol *name) {
     const auto itr = frame.find(name);
     if (itr != frame.end()) return true;
     else if (itr == frame.end() && tail != nullptr) {
@@ -36,11 +52,32 @@ bool Env::is_in_env(std::string name) {
     else return false;
 }
 
-Expr* Env::find_var(std::string name) {
-    const auto itr = frame.find(name);
-    if (itr != frame.end()) return itr->second;
-    else if (itr == frame.end() && tail != nullptr) {
-        return this->tail->find_var(name);
+Expr* Env::find_var(const Symbol *name) {
+    EvalStats &stats = Counters::get();
+    stats.lookups++;
+    for (Env *env = this; env != nullptr; env = env->tail) {
+        stats.lookup_envs++;
+        const auto itr = env->frame.find(name);
+        if (itr != env->frame.end()) return itr->second;
     }
-    else return nullptr;
+    return nullptr;
+}
+
+/* Lexically addressed variables */
+void Env::set_slot(size_t slot, Value v) {
+    slots[slot] = v;
+}
+
+/**
+ * Find a variable by its lexical address, without any name lookup
+ * @param depth Number of frames to walk up from this frame
+ * @param slot Index of the variable in that frame
+ * @returns Bound value, or an unbound value if the frame found does not
+ * have such a slot
+ */
+Value Env::find_slot(size_t depth, size_t slot) {
+    Env *env = this;
+    for (; depth > 0 && env != nullptr; depth--) env = env->tail;
+    if (env == nullptr || slot >= env->slots.size()) return Value();
+    return env->slots[slot];
 }
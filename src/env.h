@@ -8,32 +8,61 @@
  *==========================================================================*/
 #include <string>
 #include <unordered_map>
+#include <vector>
+
+#include "symbol.h"
+#include "value.h"
 #ifndef ENV_H_
 #define ENV_H_
 
-/* Forward-declartion of `Expr` class */
-class Expr;
+/* Named bindings of a frame, keyed by interned symbol */
+typedef std::unordered_map<const Symbol*, Expr*> Frame;
 
 /*============================================================================
  *  Environment class
  *===========================================================================*/
+/**
+ * An environment frame is either named or slotted. The global frame maps
+ * names to values. Frames created by procedure calls hold their arguments
+ * in an array, indexed by the slot the parser resolved each parameter to,
+ * and the variables a procedure captured are held the same way by a frame
+ * of its own, see `Expr::make_closure`. The frame of a call is chained to
+ * the captures of its procedure, if any, and those to a named frame, so
+ * a chain never holds more than two slotted frames.
+ *
+ * Lookups never modify a frame, and 'define' and 'set!' only write the
+ * innermost one, which belongs to the call evaluating them. The global
+ * frame is only written by top-level forms, so procedures can be evaluated
+ * by several threads at once, see `pmap`.
+ */
 class Env {
+    friend class Heap;
+    friend class VM;
+    friend class Memo;
+
 private:
-    std::unordered_map<std::string, Expr*> frame;
+    Frame frame;
+    std::vector<Value> slots;
     Env *tail;
 
 public:
     /* Constructors */
-    Env(std::unordered_map<std::string, Expr*> &f);
-    Env(std::unordered_map<std::string, Expr*> &f, Env *tl);
+    Env(Frame &f);
+    Env(Frame &f, Env *tl);
     Env(Env *tl);
+    Env(Env *tl, size_t num_slots);
     ~Env();
 
     /* Env state modifiers  */
     Env *get_tl();
-    void add_key_value_pair(std::string &k, Expr *v);
-    bool is_in_env(std::string name);
-    Expr *find_var(std::string name);
+    Env *get_named();
+    void add_key_value_pair(const Symbol *k, Expr *v);
+    bool is_in_env(const Symbol *name);
+    Expr *find_var(const Symbol *name);
+
+    /* Lexically addressed variables */
+    void set_slot(size_t slot, Value v);
+    Value find_slot(size_t depth, size_t slot);
 };
 
 #endif
@@ -6,37 +6,101 @@
  *  Description: Implementation of `Expr` class
  * 
  *==========================================================================*/
+#include <algorithm>
+#include "counters.h"
 #include "expr.h"
+#include "hashtable.h"
+#include "memo.h"
+#include "number.h"
+#include "numvec.h"
+#include "parser.h"
+#include "pool.h"
+#include "profiler.h"
+#include "vm.h"
+#include "writer.h"
 
 /*============================================================================
  *  Constructors
  *===========================================================================*/
 Expr::Expr(int64_t i)            : type(ExpType::INT),    ival(i) {}
+Expr::Expr(BigInt b)             : type(ExpType::BIGINT), bval(b) {}
 Expr::Expr(double f)             : type(ExpType::FLOAT),  fval(f) {}
 Expr::Expr(std::string s)        : type(ExpType::STRING), sval(s) {}
+Expr::Expr(StrView s)            : type(ExpType::STRING), sval(s) {}
 Expr::Expr(LitType l)            : type(ExpType::LIT),    lit(l)  {}
-Expr::Expr(std::vector<Expr*> *l): type(ExpType::LIST),   list(l) {}  
+Expr::Expr(std::vector<Expr*> *l)
+    : type(ExpType::LIST), list{ l, 0, Value(), nullptr } {
+    Counters::get().list_bytes += l->capacity() * sizeof(Expr*);
+}
+Expr::Expr(std::vector<Expr*> *l, size_t start)
+    : type(ExpType::LIST), list{ l, start, Value(), nullptr } {}
+Expr::Expr(Value car, Expr *cdr)
+    : type(ExpType::LIST), list{ nullptr, 0, car, cdr } {}
 
-Expr::Expr(std::string sym_name, Expr *sym_val)
+Expr::Expr(const Symbol *sym_name, Expr *sym_val)
     : type(ExpType::SYMBOL), sym(std::make_tuple(sym_name, sym_val)) {}
-Expr::Expr(PrimType t, std::vector<Expr*> *args) 
+Expr::Expr(const Symbol *sym_name, size_t depth, size_t slot)
+    : type(ExpType::LOCAL), local(std::make_tuple(sym_name, depth, slot)) {}
+Expr::Expr(PrimType t, ExprArray args) 
     : type(ExpType::PRIM), prim(std::make_tuple(t, args)) {}
 Expr::Expr(Expr *params, Expr *body, Env *env)
     : type(ExpType::PROC), proc(std::make_tuple(params, body, env)) {}
-Expr::~Expr() {}
+Expr::Expr(Code *c)              : type(ExpType::CODE),   code(c) {}
+Expr::Expr(Memo *m)              : type(ExpType::MEMO),   memo(m) {}
+Expr::Expr(std::shared_ptr<NumVector> v)
+    : type(ExpType::VECTOR), nvec(std::move(v)) {}
+Expr::Expr(std::shared_ptr<HashTable> t)
+    : type(ExpType::HASH), table(std::move(t)) {}
+
+/* Destructor */
+Expr::~Expr() {
+    typedef std::shared_ptr<NumVector> nvec_t;
+    typedef std::shared_ptr<HashTable> table_t;
+    switch (type) {
+        case ExpType::STRING:   { sval.~StrView();  break; }
+        case ExpType::BIGINT:   { bval.~BigInt();   break; }
+        case ExpType::MEMO:     { delete memo;      break; }
+        case ExpType::VECTOR:   { nvec.~nvec_t();   break; }
+        case ExpType::HASH:     { table.~table_t(); break; }
+        default:                                    break;
+    }
+}
 
 /* Copy constructor */
-Expr::Expr(const Expr &e) {
-    type = e.type;
+Expr::Expr(const Expr &e) : type(e.type) {
     switch (e.type) {
         case ExpType::INT:      { ival = e.ival; break; }
+        case ExpType::BIGINT:   { new (&bval) BigInt(e.bval);        break; }
         case ExpType::FLOAT:    { fval = e.fval; break; }
-        case ExpType::STRING:   { sval = e.sval; break; }
+        case ExpType::STRING:   {
+            // Copies share the characters, see `StrView`
+            new (&sval) StrView(e.sval);
+            break;
+        }
         case ExpType::LIT:      { lit  = e.lit;  break; }
-        case ExpType::LIST:     { list = e.list; break; }
-        case ExpType::SYMBOL:   { sym  = e.sym;  break; }
-        case ExpType::PRIM:     { prim = e.prim; break; }
-        case ExpType::PROC:     { proc = e.proc; break; }
+        case ExpType::LIST:     { new (&list) ExprList(e.list); break; }
+        case ExpType::SYMBOL:   { new (&sym) decltype(sym)(e.sym);   break; }
+        case ExpType::LOCAL:    {
+            new (&local) decltype(local)(e.local);
+            break;
+        }
+        case ExpType::PRIM:     { new (&prim) decltype(prim)(e.prim); break; }
+        case ExpType::PROC:     { new (&proc) decltype(proc)(e.proc); break; }
+        case ExpType::CODE:     { code = e.code; break; }
+        case ExpType::MEMO:     {
+            // A copy starts with a cache of its own
+            memo = new Memo(e.memo->get_body());
+            break;
+        }
+        case ExpType::VECTOR:   {
+            // Copies share the elements, see `NumVector`
+            new (&nvec) std::shared_ptr<NumVector>(e.nvec);
+            break;
+        }
+        case ExpType::HASH:     {
+            new (&table) std::shared_ptr<HashTable>(e.table);
+            break;
+        }
         default:                                 break;
     }
 }
@@ -51,42 +115,386 @@ PrimType Expr::get_prim_type(void) {
     if (type != ExpType::PRIM) throw "Instance is not primitive type";
     else return std::get<0>(prim);
 }
+const BigInt &Expr::get_bigint(void) {
+    if (type != ExpType::BIGINT) throw "Instance is not big integer type";
+    else return bval;
+}
+const StrView &Expr::get_string(void) {
+    if (type != ExpType::STRING) throw "Instance is not string type";
+    else return sval;
+}
+NumVector &Expr::get_vector(void) {
+    if (type != ExpType::VECTOR) throw "Instance is not vector type";
+    else return *nvec;
+}
+HashTable &Expr::get_table(void) {
+    if (type != ExpType::HASH) throw "Instance is not hash table type";
+    else return *table;
+}
+const Symbol *Expr::get_symbol(void) {
+    if (type == ExpType::SYMBOL) return std::get<0>(sym);
+    if (type == ExpType::LOCAL)  return std::get<0>(local);
+    throw "Instance is not symbol type";
+}
 
 /*============================================================================
  *  Evaluators
  *===========================================================================*/
+static inline Value make_bool(bool b) {
+    return Value(b ? LitType::TRUE : LitType::FALSE);
+}
+
 /**
- * Evaluate symbol expressions
+ * Evaluate a numeric comparison
+ * @param op Comparison
+ * @param name Name of the primitive, for errors
+ * @param args Arguments of the primitive
  * @param bindings pointer to vector containing argument bindings
  * @param e pointer to env
- * @returns evaluated expression 
+ * @returns #t or #f
+ */
+static inline Value eval_compare(CmpOp op, const char *name,
+                                 ExprArray &args,
+                                 std::vector<Value> *bindings, Env *e) {
+    if (args.size() != 2)
+        throw "Invalid num args for '" + std::string(name) + "'";
+    Value e1 = args[0]->eval(bindings, e);
+    Value e2 = args[1]->eval(bindings, e);
+    return make_bool(num_compare(op, e1, e2, name));
+}
+
+/**
+ * Get the vector of an argument
+ * @param v Evaluated argument
+ * @param name Name of the primitive, for errors
+ * @returns Vector
+ */
+static NumVector &to_vector(Value v, const char *name) {
+    if (v.type() != ExpType::VECTOR)
+        throw "Invalid args type for '" + std::string(name) + "'";
+    return v.obj()->get_vector();
+}
+
+/**
+ * Get an index into a vector
+ * @param v Evaluated argument
+ * @param vec Vector
+ * @param name Name of the primitive, for errors
+ * @returns Index, in range
+ */
+static size_t to_index(Value v, const NumVector &vec, const char *name) {
+    if (v.type() != ExpType::INT)
+        throw "Invalid args type for '" + std::string(name) + "'";
+    if (v.ival() < 0 || size_t(v.ival()) >= vec.size())
+        throw "Index " + std::to_string(v.ival()) + " out of range for '" +
+              std::string(name) + "'";
+    return size_t(v.ival());
+}
+
+/**
+ * Evaluate the primitives of numeric vectors, see `NumVector`
+ * @param type Primitive type
+ * @param args Arguments of the primitive
+ * @param bindings pointer to vector containing argument bindings
+ * @param e pointer to env
+ * @returns evaluated expression
+ */
+static Value eval_vector(PrimType type, ExprArray &args,
+                         std::vector<Value> *bindings, Env *e) {
+    auto check_args = [&](size_t lo, size_t hi) {
+        if (args.size() < lo || args.size() > hi)
+            throw "Invalid num args for '" + prim_name(type) + "'";
+    };
+    auto arg = [&](size_t i) { return args[i]->eval(bindings, e); };
+
+    switch (type) {
+        /* make-f64vector, make-i64vector */
+        case PrimType::MAKE_F64VEC: case PrimType::MAKE_I64VEC: {
+            check_args(1, 2);
+            Value n = arg(0);
+            if (n.type() != ExpType::INT || n.ival() < 0)
+                throw "Invalid args type for '" + prim_name(type) + "'";
+            auto vec = std::make_shared<NumVector>(
+                type == PrimType::MAKE_F64VEC ? ElemType::F64 : ElemType::I64,
+                size_t(n.ival()));
+            if (args.size() == 2) vec->fill(arg(1));
+            return Value(gc_new<Expr>(std::move(vec)));
+        }
+        /* list->f64vector, list->i64vector */
+        case PrimType::LIST_TO_F64VEC: case PrimType::LIST_TO_I64VEC: {
+            check_args(1, 1);
+            Value l = arg(0);
+            if (l.type() != ExpType::LIST)
+                throw "Invalid args type for '" + prim_name(type) + "'";
+            size_t n = 0;
+            for (ListCursor c(l.obj()); !c.done(); c.next()) n++;
+            auto vec = std::make_shared<NumVector>(
+                type == PrimType::LIST_TO_F64VEC ? ElemType::F64
+                                                 : ElemType::I64, n);
+            size_t i = 0;
+            for (ListCursor c(l.obj()); !c.done(); c.next()) {
+                Value elem = c.get();
+                if (elem.is_obj()) elem = elem.obj()->eval(bindings, e);
+                vec->set(i++, elem);
+            }
+            return Value(gc_new<Expr>(std::move(vec)));
+        }
+        /* vector->list */
+        case PrimType::VEC_TO_LIST: {
+            check_args(1, 1);
+            NumVector &vec = to_vector(arg(0), "vector->list");
+            ListBuilder l;
+            for (size_t i = 0; i < vec.size(); i++) l.push(vec.get(i));
+            return l.finish(nullptr);
+        }
+        /* vector? */
+        case PrimType::IS_VEC: {
+            check_args(1, 1);
+            return make_bool(arg(0).type() == ExpType::VECTOR);
+        }
+        /* vector-length */
+        case PrimType::VEC_LEN: {
+            check_args(1, 1);
+            return Value(int64_t(to_vector(arg(0), "vector-length").size()));
+        }
+        /* vector-ref */
+        case PrimType::VEC_REF: {
+            check_args(2, 2);
+            Value v = arg(0);
+            NumVector &vec = to_vector(v, "vector-ref");
+            return vec.get(to_index(arg(1), vec, "vector-ref"));
+        }
+        /* vector-set!, returns the vector so that calls can be chained */
+        case PrimType::VEC_SET: {
+            check_args(3, 3);
+            Value v = arg(0);
+            NumVector &vec = to_vector(v, "vector-set!");
+            vec.set(to_index(arg(1), vec, "vector-set!"), arg(2));
+            return v;
+        }
+        /* vector-sum, vector-min, vector-max */
+        case PrimType::VEC_SUM: {
+            check_args(1, 1);
+            return to_vector(arg(0), "vector-sum").sum();
+        }
+        case PrimType::VEC_MIN: {
+            check_args(1, 1);
+            return to_vector(arg(0), "vector-min").min();
+        }
+        case PrimType::VEC_MAX: {
+            check_args(1, 1);
+            return to_vector(arg(0), "vector-max").max();
+        }
+        /* vector-dot */
+        case PrimType::VEC_DOT: {
+            check_args(2, 2);
+            Value v = arg(0), w = arg(1);
+            NumVector &x = to_vector(v, "vector-dot");
+            return x.dot(to_vector(w, "vector-dot"));
+        }
+        /* vector-map, the operation is named and not evaluated */
+        case PrimType::VEC_MAP: {
+            check_args(2, 3);
+            VecOp op;
+            if (args[0]->get_expr_type() != ExpType::SYMBOL ||
+                !NumVector::parse_op(args[0]->get_symbol()->name, op))
+                throw "Invalid operation for 'vector-map'";
+            bool binary = op <= VecOp::MAX;
+            if (args.size() == 2 && op == VecOp::SUB) {
+                op = VecOp::NEG;
+                binary = false;
+            }
+            if (binary != (args.size() == 3))
+                throw "Invalid num args for 'vector-map'";
+
+            Value v = arg(1), y = binary ? arg(2) : Value();
+            NumVector &x = to_vector(v, "vector-map");
+            std::shared_ptr<NumVector> result;
+            if (!binary) result = x.map(op);
+            else {
+                if (y.type() == ExpType::VECTOR)
+                    result = x.map(op, y.obj()->get_vector());
+                else result = x.map(op, y);
+            }
+            return Value(gc_new<Expr>(std::move(result)));
+        }
+        default: throw "Invalid primitive";
+    }
+}
+
+/**
+ * Get the string an argument evaluated to
+ * @param v Evaluated argument
+ * @param name Name of the primitive, for errors
+ * @returns String
+ */
+static const StrView &to_string(Value v, const char *name) {
+    if (v.type() != ExpType::STRING)
+        throw "Invalid args type for '" + std::string(name) + "'";
+    return v.obj()->get_string();
+}
+
+/**
+ * Evaluate the primitives of strings, see `StrView`
+ * @param type Primitive type
+ * @param args Arguments of the primitive
+ * @param bindings pointer to vector containing argument bindings
+ * @param e pointer to env
+ * @returns evaluated expression
+ */
+static Value eval_string(PrimType type, ExprArray &args,
+                         std::vector<Value> *bindings, Env *e) {
+    auto check_args = [&](size_t lo, size_t hi) {
+        if (args.size() < lo || args.size() > hi)
+            throw "Invalid num args for '" + prim_name(type) + "'";
+    };
+    auto arg = [&](size_t i) { return args[i]->eval(bindings, e); };
+
+    switch (type) {
+        /* string-append, appends in place to the first string when it
+           can, see `StrView` */
+        case PrimType::STR_APPEND: {
+            StrView s;
+            for (size_t i = 0; i < args.size(); i++)
+                s = s.append(to_string(arg(i), "string-append"));
+            return Value(gc_new<Expr>(std::move(s)));
+        }
+        /* string-length */
+        case PrimType::STR_LEN: {
+            check_args(1, 1);
+            return Value(int64_t(to_string(arg(0), "string-length").size()));
+        }
+        /* substring, sharing the characters of the string */
+        case PrimType::SUBSTRING: {
+            check_args(2, 3);
+            Value v = arg(0);
+            const StrView &s = to_string(v, "substring");
+            Value from = arg(1);
+            Value to = args.size() == 3 ? arg(2) : Value(int64_t(s.size()));
+            if (from.type() != ExpType::INT || to.type() != ExpType::INT)
+                throw "Invalid args type for 'substring'";
+            if (from.ival() < 0 || from.ival() > to.ival() ||
+                size_t(to.ival()) > s.size())
+                throw "Index out of range for 'substring'";
+            return Value(gc_new<Expr>(s.substr(size_t(from.ival()),
+                                               size_t(to.ival()))));
+        }
+        /* string->number, #f if the string is not a number */
+        case PrimType::STR_TO_NUM: {
+            check_args(1, 1);
+            Value n;
+            if (num_parse(to_string(arg(0), "string->number").str(), n))
+                return n;
+            return Value(LitType::FALSE);
+        }
+        /* number->string, written as the REPL prints it */
+        case PrimType::NUM_TO_STR: {
+            check_args(1, 1);
+            Value n = arg(0);
+            if (!is_number(n)) throw "Invalid args type for 'number->string'";
+            Writer w;
+            w.write_value(n);
+            return Value(gc_new<Expr>(StrView(w.str())));
+        }
+        /* string-split, on single spaces unless a separator is given.
+           Parts share the characters of the string. */
+        case PrimType::STR_SPLIT: {
+            check_args(1, 2);
+            Value v = arg(0);
+            const StrView &s = to_string(v, "string-split");
+            StrView sep(" ", 1);
+            if (args.size() == 2) sep = to_string(arg(1), "string-split");
+            if (sep.size() == 0) throw "Empty separator for 'string-split'";
+
+            ListBuilder parts;
+            const char *chars = s.data();
+            size_t from = 0;
+            for (size_t i = 0; i + sep.size() <= s.size(); i++) {
+                if (std::memcmp(chars + i, sep.data(), sep.size()) != 0)
+                    continue;
+                parts.push(Value(gc_new<Expr>(s.substr(from, i))));
+                from = i + sep.size();
+                i = from - 1;
+            }
+            parts.push(Value(gc_new<Expr>(s.substr(from, s.size()))));
+            return parts.finish(nullptr);
+        }
+        default: throw "Invalid primitive";
+    }
+}
+
+/**
+ * Evaluate symbol expressions
+ * @param e pointer to env
+ * @returns expression bound to the symbol, to be evaluated in tail position
  */
-Expr Expr::eval_sym(std::vector<Expr*> *bindings, Env *e) {
+Expr *Expr::eval_sym(Env *e) {
     if (type != ExpType::SYMBOL) throw "Eval failed: Not symbol type!";
 
     Expr *found_val = e->find_var(std::get<0>(sym));
     if (found_val != nullptr)
-        return found_val->eval(bindings, e);
+        return found_val;
+    else     
+        throw "Unknown identifier: '" + std::get<0>(sym)->name + "'";
+}
+
+/**
+ * Evaluate lexically addressed variables. The parser resolved the variable
+ * to a parameter of an enclosing lambda, so its value is found by walking
+ * `depth` frames up and indexing the frame, without any name lookup.
+ * @param e pointer to env
+ * @returns value bound to the variable. If it is an expression, it is
+ * evaluated in tail position.
+ */
+Value Expr::eval_local(Env *e) {
+    if (type != ExpType::LOCAL) throw "Eval failed: Not local type!";
+
+    Value found_val = e->find_slot(std::get<1>(local), std::get<2>(local));
+    if (!found_val.is_unbound())
+        return found_val;
     else     
-        throw "Unknown identifier: '" + std::get<0>(sym) + "'";
+        throw "Unknown identifier: '" + std::get<0>(local)->name + "'";
 }
 
 /**
- * Evaluate procedure expressions
+ * Evaluate if statements
  * @param bindings pointer to vector containing argument bindings
  * @param e pointer to env
- * @returns evaluated expression 
+ * @returns branch chosen by the condition, to be evaluated in tail position
  */
-Expr Expr::eval_proc(std::vector<Expr*> *bindings, Env *e) {
+Expr *Expr::eval_if(std::vector<Value> *bindings, Env *e) {
+    ExprArray &args = std::get<1>(prim);
+    if (args.size() != 3) throw "Invalid num args for 'if'";
+    Counters::get().prims[size_t(PrimType::IF)]++;
+
+    Value cond = args[0]->eval(bindings, e);
+    return cond.is_true() ? args[1] : args[2];
+}
+
+/**
+ * Evaluate procedure expressions. Arguments are bound in a new frame, the
+ * body is left to the caller so that a call in tail position does not grow
+ * the native stack. The caller counts the frame as an allocation of the
+ * callee once it entered it, see `Profiler::uncount_alloc`.
+ * @param bindings pointer to vector containing argument bindings, set to
+ * the bindings of the body
+ * @param e pointer to env, set to the frame of the call
+ * @param tail_bindings vector owned by the caller that holds the bindings
+ * of the body when they are not the caller's own
+ * @returns procedure body, to be evaluated in tail position
+ */
+Expr *Expr::eval_proc(std::vector<Value> *&bindings, Env *&e,
+                      std::vector<Value> &tail_bindings) {
     if (type != ExpType::PROC) throw "Eval failed: Not procedure type!";
     
     Expr *params = std::get<0>(proc);
     Expr *body   = std::get<1>(proc);
     Env  *env    = std::get<2>(proc);
 
-    if (bindings == nullptr || bindings->size() != params->list->size()) 
+    if (bindings == nullptr || bindings->size() != params->list.vec->size()) 
         throw "Non-matching number of args for procedure call";
-    Env *new_env = new Env(env);
+    Env *new_env = gc_new<Env>(env, params->list.vec->size());
+    if (Profiler::enabled) Profiler::uncount_alloc();
 
     /** 
      * For recursive function, function body is first initialized as 
@@ -106,43 +514,145 @@ Expr Expr::eval_proc(std::vector<Expr*> *bindings, Env *e) {
      * environment to ensure the recursive function terminates.
      */
     if (body->get_expr_type() == ExpType::SYMBOL) {
-        // symbol -> lambda -> procedure
-        Expr caller = body->eval(bindings, e);
-        if (caller.get_expr_type() != ExpType::PROC)
-            throw "Eval failed: Not procedure type!";
+        // symbol -> lambda -> procedure. A lambda bound by 'define' is
+        // used as it is, the procedure would only be thrown away.
+        Expr *_params, *_body;
+        Expr *found_val = e->find_var(std::get<0>(body->sym));
+        if (found_val != nullptr && found_val->type == ExpType::PRIM &&
+            std::get<0>(found_val->prim) == PrimType::LAMBDA &&
+            std::get<1>(found_val->prim).size() == 2 &&
+            std::get<1>(found_val->prim)[0]->type == ExpType::LIST) {
+            _params = std::get<1>(found_val->prim)[0];
+            _body   = std::get<1>(found_val->prim)[1];
+        }
+        else {
+            Value caller = body->eval(bindings, e);
+            if (caller.type() != ExpType::PROC)
+                throw "Eval failed: Not procedure type!";
+            _params = std::get<0>(caller.obj()->proc);
+            _body   = std::get<1>(caller.obj()->proc);
+        }
         
-        Expr *_params = std::get<0>(caller.proc);
-        Expr *_body   = std::get<1>(caller.proc);
-        std::vector<Expr*> eval_params_list = {};
+        std::vector<Value> eval_params_list = {};
+        if (_params->list.vec->size() != params->list.vec->size())
+            throw "Non-matching number of args for procedure call";
         
-        for (size_t i = 0; i < params->list->size(); i++) {
-            Expr *_param = _params->list->at(i);
+        for (size_t i = 0; i < params->list.vec->size(); i++) {
+            Expr *_param = _params->list.vec->at(i);
             if (_param->type != ExpType::STRING)
                 throw "Non-string typed argument";
             
-            Expr *eval_param 
-                = new Expr(params->list->at(i)->eval(bindings, e));
-
-            new_env->add_key_value_pair(_param->sval, eval_param);
+            Value eval_param = params->list.vec->at(i)->eval(bindings, e);
+            new_env->set_slot(i, eval_param);
             eval_params_list.push_back(eval_param);
         }
-        return _body->eval(&eval_params_list, new_env);
+        // `bindings` may point to `tail_bindings`, so it is only replaced
+        // once all arguments are evaluated
+        tail_bindings.swap(eval_params_list);
+        bindings = &tail_bindings;
+        e = new_env;
+        return _body;
     }
 
     /**
      * Non-recursive procedure call case
-     * To evaluate non-recursive procedure call, evaluate params and add
-     * a param to binding pair to the new environment frame. Evaluate 
+     * To evaluate non-recursive procedure call, evaluate params and store
+     * each one in its slot of the new environment frame. Evaluate 
      * function body in such new environment to obtain the procedure call
      * result.
      */
     for (size_t i = 0; i < bindings->size(); i++) {
-        Expr *param = params->list->at(i);
+        Expr *param = params->list.vec->at(i);
         if (param->type != ExpType::STRING) throw "Non-string typed argument";
-        Expr *value = new Expr(bindings->at(i)->eval(bindings, env));
-        new_env->add_key_value_pair(param->sval, value);
+        Value value = bindings->at(i);
+        if (value.is_obj()) value = value.obj()->eval(bindings, env);
+        new_env->set_slot(i, value);
+    }
+    e = new_env;
+    return body;
+}
+
+/* Elements a parallel list operation takes at once, per thread of the
+   pool, and chunks it splits them into */
+static const size_t WAVE_PER_THREAD = 1024;
+static const size_t CHUNKS_PER_THREAD = 8;
+
+/**
+ * Apply a procedure to every element of a list on the thread pool. The
+ * list is taken in waves, and each wave is split into chunks that become
+ * runs of cons cells, linked in list order once the wave is done. The
+ * collector may only run between waves. Procedures can be called from any
+ * thread, see `Env`.
+ * @param fun Procedure
+ * @param iter List
+ * @param e pointer to env
+ * @param filter Keep the elements the procedure returns true for, instead
+ * of the results
+ * @returns New list
+ */
+static Value eval_parallel(Value fun, Value iter, Env *e, bool filter) {
+    Pool &pool = Pool::current();
+    size_t wave_size = pool.size() * WAVE_PER_THREAD;
+    ListBuilder result;
+    std::vector<Value> elems = {};
+
+    for (ListCursor c(iter.obj()); !c.done();) {
+        // The elements and runs are kept in plain vectors, which the
+        // collector does not see
+        Heap::current().safepoint();
+        GCPause pause;
+        elems.clear();
+        for (; !c.done() && elems.size() < wave_size; c.next())
+            elems.push_back(c.get());
+
+        size_t num_chunks = std::min(elems.size(),
+                                     pool.size() * CHUNKS_PER_THREAD);
+        std::vector<ListBuilder> runs(num_chunks);
+        pool.run(num_chunks, [&](size_t chunk) {
+            size_t lo = chunk * elems.size() / num_chunks;
+            size_t hi = (chunk + 1) * elems.size() / num_chunks;
+            for (size_t i = lo; i < hi; i++) {
+                std::vector<Value> args { elems[i] };
+                Value applied_elem = fun.obj()->eval(&args, e);
+                if (!filter) runs[chunk].push(applied_elem);
+                else if (applied_elem.type() != ExpType::LIT)
+                    throw "Decider function does not return lit type";
+                else if (applied_elem.lit() == LitType::TRUE)
+                    runs[chunk].push(elems[i]);
+            }
+        });
+        for (ListBuilder &run : runs) result.append(run);
+    }
+    return result.finish(nullptr);
+}
+
+/**
+ * Make the procedure of a lambda expression. The variables of enclosing
+ * lambdas its body refers to, listed by the third argument of the lambda,
+ * are copied into a frame of their own, so the procedure keeps none of the
+ * frames it was made in alive and reaches a captured variable in one step.
+ * A lambda that captures nothing is chained straight to the named frame.
+ * @param e pointer to env the lambda is evaluated in
+ * @returns procedure
+ */
+Value Expr::make_closure(Env *e) {
+    ExprArray &args = std::get<1>(prim);
+    if (args.size() != 2 && args.size() != 3)
+        throw "Invalid num args for 'lambda'";
+    if (args[0]->type != ExpType::LIST) throw "Non-list typed args";
+
+    Env *tail = e->get_named();
+    if (args.size() == 3) {
+        const std::vector<Expr*> &captures = *args[2]->list.vec;
+        Env *captured = gc_new<Env>(tail, captures.size());
+        for (size_t i = 0; i < captures.size(); i++) {
+            Expr *var = captures[i];
+            captured->set_slot(i, e->find_slot(std::get<1>(var->local),
+                                               std::get<2>(var->local)));
+        }
+        tail = captured;
     }
-    return body->eval(bindings, new_env);
+    return Value(gc_new<Expr>(args[0], args[1], tail));
 }
 
 /**
@@ -151,470 +661,352 @@ Expr Expr::eval_proc(std::vector<Expr*> *bindings, Env *e) {
  * @param e pointer to env
  * @returns evaluated expression 
  */
-Expr Expr::eval_prim(std::vector<Expr*> *bindings, Env *e) {
+Value Expr::eval_prim(std::vector<Value> *bindings, Env *e) {
     if (type != ExpType::PRIM) throw "Eval failed: Not primitive type!"; 
     PrimType prim_type = std::get<0>(prim);
-    std::vector<Expr*> args = *std::get<1>(prim);
+    ExprArray &args = std::get<1>(prim);
+    Counters::get().prims[size_t(prim_type)]++;
 
     switch (prim_type) {
         /*======================= Var assign =============================*/
         case PrimType::DEFINE: {
             if (args.size() != 2) throw "Invalid num args for 'define'";
-            Expr name = args[0]->eval(bindings, e);
 
-            // Bind variable name to an expression in environment
-            if (name.type == ExpType::STRING) {
-                e->add_key_value_pair(name.sval, args[1]);
-                return Expr(LitType::NIL);
+            // Bind variable name to an expression in environment. The name
+            // is a symbol that is not evaluated.
+            if (args[0]->type == ExpType::SYMBOL) {
+                if (Profiler::enabled)
+                    Profiler::name(std::get<0>(args[0]->sym), args[1]);
+                e->add_key_value_pair(std::get<0>(args[0]->sym), args[1]);
+                return Value(LitType::NIL);
             }
-            else throw "Non-string type variable name for 'define'";
+            else throw "Non-symbol type variable name for 'define'";
         }
         case PrimType::SET: {
             if (args.size() != 2) throw "Invalid num args for 'set'";
-            Expr name = args[0]->eval(bindings, e);
             
-            if (name.type == ExpType::STRING) {
-                if (!e->is_in_env(name.sval)) 
-                    throw "Unbounded variable '" + name.sval + "'";
+            if (args[0]->type == ExpType::SYMBOL) {
+                const Symbol *name = std::get<0>(args[0]->sym);
+                if (!e->is_in_env(name)) 
+                    throw "Unbounded variable '" + name->name + "'";
                 
                 // Re-bind variable name to a new expression in env
-                e->add_key_value_pair(name.sval, args[1]);
-                return Expr(LitType::NIL);
+                if (Profiler::enabled) Profiler::name(name, args[1]);
+                e->add_key_value_pair(name, args[1]);
+                return Value(LitType::NIL);
             }
-            else throw "Non-string type variable name for 'set!'";
+            else throw "Non-symbol type variable name for 'set!'";
         }
         /*======================= Lambda exp =============================*/
-        case PrimType::LAMBDA: {
-            if (args.size() != 2) throw "Invalid num args for 'lambda'";
-            if (args[0]->type != ExpType::LIST) throw "Non-list typed args";
-            return Expr(args[0], args[1], e);
-        }
-        /*======================= Control flow ===========================*/
-        /* If statement */
-        case PrimType::IF: {
-            if (args.size() != 3) throw "Invalid num args for 'if'";
-            Expr cond = args[0]->eval(bindings, e);
-            if (cond.type == ExpType::LIT && cond.lit == LitType::TRUE) 
-                return args[1]->eval(bindings, e);     
-            if (cond.type == ExpType::INT && cond.ival > 0)
-                return args[1]->eval(bindings, e);
-            if (cond.type == ExpType::FLOAT && cond.fval > 0.0)
-                return args[1]->eval(bindings, e);
-            return args[2]->eval(bindings, e);
-        }
+        case PrimType::LAMBDA:
+            return make_closure(e);
         /*======================= Arith operations =======================*/
-        /* Integer addition */
-        case PrimType::ADD: {
-            double s = 0.0;
-            for (const auto &arg : args) {
-                Expr exp = arg->eval(bindings, e);
-                if (exp.type == ExpType::INT)          s += exp.ival;
-                else if (exp.type == ExpType::FLOAT)   s += exp.fval;
-                else throw "Invalid args type for '+'";
-            }
-            if (std::floor(s) == s) return Expr(int64_t(s));
-            else return Expr(s);
-        }
-        /* Integer subtraction */
+        /* Addition */
+        case PrimType::ADD:
+            return num_sum(args.size(), [&](size_t i) {
+                return args[i]->eval(bindings, e);
+            });
+        /* Subtraction */
         case PrimType::SUB: {
             if (args.size() != 2) throw "Invalid num args for '-'";
-            Expr e1 = args[0]->eval(bindings, e);
-            Expr e2 = args[1]->eval(bindings, e);
-
-            if (e1.type == ExpType::INT && e2.type == ExpType::INT)
-                return Expr(int64_t(e1.ival - e2.ival)); 
-            else if (e1.type == ExpType::FLOAT && e2.type == ExpType::INT)
-                return Expr(e1.fval - e2.ival);
-            else if (e1.type == ExpType::INT && e2.type == ExpType::FLOAT)
-                return Expr(e1.ival - e2.fval);
-            else if (e1.type == ExpType::FLOAT && e2.type == ExpType::FLOAT)
-                return Expr(e1.fval - e2.fval);
-            else throw "Invalid args type for '-'";
-        }
-        /* Integer multiplication */
-        case PrimType::MUL: {
-            double p = 1.0;
-            for (const auto &arg : args) {
-                Expr exp = arg->eval(bindings, e);
-                if (exp.type == ExpType::INT)          p *= exp.ival;
-                else if (exp.type == ExpType::FLOAT)   p *= exp.fval;
-                else throw "Invalid args type for '*'";
-            }
-            if (std::floor(p) == p) return Expr(int64_t(p));
-            else return Expr(p);
+            Value e1 = args[0]->eval(bindings, e);
+            Value e2 = args[1]->eval(bindings, e);
+            return num_sub(e1, e2);
         }
-        /* Integer division */
+        /* Multiplication */
+        case PrimType::MUL:
+            return num_product(args.size(), [&](size_t i) {
+                return args[i]->eval(bindings, e);
+            });
+        /* Division */
         case PrimType::DIV: {
             if (args.size() != 2) throw "Invalid num args for '/'";
-            Expr e1 = args[0]->eval(bindings, e);
-            Expr e2 = args[1]->eval(bindings, e);
-
-            if ((e2.type == ExpType::INT && e2.ival == 0) ||
-                (e2.type == ExpType::FLOAT && e2.fval == 0)) 
-                throw "Division by zero";
-
-            if (e1.type == ExpType::INT && e2.type == ExpType::INT)
-                return Expr(int64_t(e1.ival / e2.ival)); 
-            else if (e1.type == ExpType::FLOAT && e2.type == ExpType::INT)
-                return Expr(e1.fval / e2.ival);
-            else if (e1.type == ExpType::INT && e2.type == ExpType::FLOAT)
-                return Expr(e1.ival / e2.fval);
-            else if (e1.type == ExpType::FLOAT && e2.type == ExpType::FLOAT)
-                return Expr(e1.fval / e2.fval);
-            else throw "Invalid args type for '/'";
+            Value e1 = args[0]->eval(bindings, e);
+            Value e2 = args[1]->eval(bindings, e);
+            return num_div(e1, e2);
         }
         /* Integer modulo */
         case PrimType::MOD: {
             if (args.size() != 2) throw "Invalid num args for 'modulo'";
-            Expr e1 = args[0]->eval(bindings, e);
-            Expr e2 = args[1]->eval(bindings, e);
-
-            if ((e2.type == ExpType::INT && e2.ival == 0) ||
-                (e2.type == ExpType::FLOAT && e2.fval == 0)) 
-                throw "Division by zero";
-            
-            if (e1.type == ExpType::INT && e2.type == ExpType::INT)
-                return Expr(e1.ival % e2.ival);
-            else throw "Invalid args type for 'modulo'";
+            Value e1 = args[0]->eval(bindings, e);
+            Value e2 = args[1]->eval(bindings, e);
+            return num_mod(e1, e2);
         }
         /*======================= Math operations =========================*/
         case PrimType::SIN: {
             if (args.size() != 1) throw "Invalid num args for 'sin'";
-            Expr e1 = args[0]->eval(bindings, e);
-            if (e1.type == ExpType::INT) 
-                return Expr(sin(e1.ival));
-            else if (e1.type == ExpType::FLOAT)
-                return Expr(sin(e1.fval));
-            else throw "Invalid args type for 'sin'";
+            Value e1 = args[0]->eval(bindings, e);
+            return Value(sin(num_to_double(e1, "sin")));
         }
         case PrimType::COS: {
             if (args.size() != 1) throw "Invalid num args for 'cos'";
-            Expr e1 = args[0]->eval(bindings, e);
-            if (e1.type == ExpType::INT) 
-                return Expr(cos(e1.ival));
-            else if (e1.type == ExpType::FLOAT)
-                return Expr(cos(e1.fval));
-            else throw "Invalid args type for 'cos'";
+            Value e1 = args[0]->eval(bindings, e);
+            return Value(cos(num_to_double(e1, "cos")));
         }
         case PrimType::TAN: {
             if (args.size() != 1) throw "Invalid num args for 'tan'";
-            Expr e1 = args[0]->eval(bindings, e);
-            if (e1.type == ExpType::INT) 
-                return Expr(tan(e1.ival));
-            else if (e1.type == ExpType::FLOAT)
-                return Expr(tan(e1.fval));
-            else throw "Invalid args type for 'tan'";
+            Value e1 = args[0]->eval(bindings, e);
+            return Value(tan(num_to_double(e1, "tan")));
         }
         case PrimType::SQRT: {
             if (args.size() != 1) throw "Invalid num args for 'sqrt'";
-            Expr e1 = args[0]->eval(bindings, e);
-            if (e1.type == ExpType::INT) 
-                return Expr(sqrt(e1.ival));
-            else if (e1.type == ExpType::FLOAT)
-                return Expr(sqrt(e1.fval));
-            else throw "Invalid args type for 'sqrt'";
+            Value e1 = args[0]->eval(bindings, e);
+            return Value(sqrt(num_to_double(e1, "sqrt")));
         }
         case PrimType::LOG: {
             if (args.size() != 1) throw "Invalid num args for 'log'";
-            Expr e1 = args[0]->eval(bindings, e);
-            if (e1.type == ExpType::INT) 
-                return Expr(log(e1.ival));
-            else if (e1.type == ExpType::FLOAT)
-                return Expr(log(e1.fval));
-            else throw "Invalid args type for 'log'";
+            Value e1 = args[0]->eval(bindings, e);
+            return Value(log(num_to_double(e1, "log")));
         }
         case PrimType::ABS: {
             if (args.size() != 1) throw "Invalid num args for 'abs'";
-            Expr e1 = args[0]->eval(bindings, e);
-            if (e1.type == ExpType::INT) 
-                return Expr(abs(e1.ival));
-            else if (e1.type == ExpType::FLOAT)
-                return Expr(abs(e1.fval));
-            else throw "Invalid args type for 'abs'";
+            return num_abs(args[0]->eval(bindings, e));
         }
         /*======================= Comparators =============================*/
         /* equal? */
         case PrimType::EQ: {
             if (args.size() != 2) throw "Invalid num args for 'equal?'";
-            Expr e1 = args[0]->eval(bindings, e);
-            Expr e2 = args[1]->eval(bindings, e);
-
-            if (e1.type == ExpType::INT && e2.type == ExpType::INT)
-                if (e1.ival == e2.ival) return Expr(LitType::TRUE);
-                else return Expr(LitType::FALSE);
-            else if (e1.type == ExpType::FLOAT && e2.type == ExpType::INT)
-                if (e1.fval == e2.ival) return Expr(LitType::TRUE);
-                else return Expr(LitType::FALSE);
-            else if (e1.type == ExpType::INT && e2.type == ExpType::FLOAT)
-                if (e1.ival == e2.fval) return Expr(LitType::TRUE);
-                else return Expr(LitType::FALSE);
-            else if (e1.type == ExpType::FLOAT && e2.type == ExpType::FLOAT)
-                if (e1.fval == e2.fval) return Expr(LitType::TRUE);
-                else return Expr(LitType::FALSE);
-            else if (e1.type == ExpType::STRING && e2.type == ExpType::STRING)
-                if (e1.sval == e2.sval) return Expr(LitType::TRUE);
-                else return Expr(LitType::FALSE);
-            else if (e1.type == ExpType::LIT && e2.type == ExpType::LIT)
-                if (e1.sval == e2.sval) return Expr(LitType::TRUE);
-                else return Expr(LitType::FALSE);
+            Value e1 = args[0]->eval(bindings, e);
+            Value e2 = args[1]->eval(bindings, e);
+            ExpType t1 = e1.type(), t2 = e2.type();
+
+            if (is_number(e1) && is_number(e2))
+                return make_bool(num_compare(CmpOp::EQ, e1, e2, "equal?"));
+            else if (t1 == ExpType::STRING && t2 == ExpType::STRING)
+                return make_bool(e1.obj()->sval == e2.obj()->sval);
+            else if (t1 == ExpType::SYMBOL && t2 == ExpType::SYMBOL)
+                return make_bool(std::get<0>(e1.obj()->sym) ==
+                                 std::get<0>(e2.obj()->sym));
+            else if (t1 == ExpType::LIT && t2 == ExpType::LIT)
+                return make_bool(e1.lit() == e2.lit());
             else throw "Invalid args type for 'equal?'";
         }
-        /* Equal (number) */
-        case PrimType::EQ_NUM: {
-            if (args.size() != 2) throw "Invalid num args for '='";
-            Expr e1 = args[0]->eval(bindings, e);
-            Expr e2 = args[1]->eval(bindings, e);
-
-            if (e1.type == ExpType::INT && e2.type == ExpType::INT)
-                if (e1.ival == e2.ival) return Expr(LitType::TRUE);
-                else return Expr(LitType::FALSE);
-            else if (e1.type == ExpType::FLOAT && e2.type == ExpType::INT)
-                if (e1.fval == e2.ival) return Expr(LitType::TRUE);
-                else return Expr(LitType::FALSE);
-            else if (e1.type == ExpType::INT && e2.type == ExpType::FLOAT)
-                if (e1.ival == e2.fval) return Expr(LitType::TRUE);
-                else return Expr(LitType::FALSE);
-            else if (e1.type == ExpType::FLOAT && e2.type == ExpType::FLOAT)
-                if (e1.fval == e2.fval) return Expr(LitType::TRUE);
-                else return Expr(LitType::FALSE);
-            else throw "Invalid args type for '='";
-        }
-        /* Greater than */
-        case PrimType::GT: {
-            if (args.size() != 2) throw "Invalid num args for '>'";
-            Expr e1 = args[0]->eval(bindings, e);
-            Expr e2 = args[1]->eval(bindings, e);
-
-            if (e1.type == ExpType::INT && e2.type == ExpType::INT)
-                if (e1.ival > e2.ival) return Expr(LitType::TRUE);
-                else return Expr(LitType::FALSE);
-            else if (e1.type == ExpType::FLOAT && e2.type == ExpType::INT)
-                if (e1.fval > e2.ival) return Expr(LitType::TRUE);
-                else return Expr(LitType::FALSE);
-            else if (e1.type == ExpType::INT && e2.type == ExpType::FLOAT)
-                if (e1.ival > e2.fval) return Expr(LitType::TRUE);
-                else return Expr(LitType::FALSE);
-            else if (e1.type == ExpType::FLOAT && e2.type == ExpType::FLOAT)
-                if (e1.fval > e2.fval) return Expr(LitType::TRUE);
-                else return Expr(LitType::FALSE);
-            else throw "Invalid args type for '>'";
-        }
-        /* Less than */
-        case PrimType::LT: {
-            if (args.size() != 2) throw "Invalid num args for '<'";
-            Expr e1 = args[0]->eval(bindings, e);
-            Expr e2 = args[1]->eval(bindings, e);
-
-            if (e1.type == ExpType::INT && e2.type == ExpType::INT)
-                if (e1.ival < e2.ival) return Expr(LitType::TRUE);
-                else return Expr(LitType::FALSE);
-            else if (e1.type == ExpType::FLOAT && e2.type == ExpType::INT)
-                if (e1.fval < e2.ival) return Expr(LitType::TRUE);
-                else return Expr(LitType::FALSE);
-            else if (e1.type == ExpType::INT && e2.type == ExpType::FLOAT)
-                if (e1.ival < e2.fval) return Expr(LitType::TRUE);
-                else return Expr(LitType::FALSE);
-            else if (e1.type == ExpType::FLOAT && e2.type == ExpType::FLOAT)
-                if (e1.fval < e2.fval) return Expr(LitType::TRUE);
-                else return Expr(LitType::FALSE);
-            else throw "Invalid args type for '<'";
-        }
-        /* Greater or equal than */
-        case PrimType::GE: {
-            if (args.size() != 2) throw "Invalid num args for '>='";
-            Expr e1 = args[0]->eval(bindings, e);
-            Expr e2 = args[1]->eval(bindings, e);
-
-            if (e1.type == ExpType::INT && e2.type == ExpType::INT)
-                if (e1.ival >= e2.ival) return Expr(LitType::TRUE);
-                else return Expr(LitType::FALSE);
-            else if (e1.type == ExpType::FLOAT && e2.type == ExpType::INT)
-                if (e1.fval >= e2.ival) return Expr(LitType::TRUE);
-                else return Expr(LitType::FALSE);
-            else if (e1.type == ExpType::INT && e2.type == ExpType::FLOAT)
-                if (e1.ival >= e2.fval) return Expr(LitType::TRUE);
-                else return Expr(LitType::FALSE);
-            else if (e1.type == ExpType::FLOAT && e2.type == ExpType::FLOAT)
-                if (e1.fval >= e2.fval) return Expr(LitType::TRUE);
-                else return Expr(LitType::FALSE);
-            else throw "Invalid args type for '>='";
-        }
-        /* Less or equal than */
-        case PrimType::LE: {
-            if (args.size() != 2) throw "Invalid num args for '<='";
-            Expr e1 = args[0]->eval(bindings, e);
-            Expr e2 = args[1]->eval(bindings, e);
-
-            if (e1.type == ExpType::INT && e2.type == ExpType::INT)
-                if (e1.ival <= e2.ival) return Expr(LitType::TRUE);
-                else return Expr(LitType::FALSE);
-            else if (e1.type == ExpType::FLOAT && e2.type == ExpType::INT)
-                if (e1.fval <= e2.ival) return Expr(LitType::TRUE);
-                else return Expr(LitType::FALSE);
-            else if (e1.type == ExpType::INT && e2.type == ExpType::FLOAT)
-                if (e1.ival <= e2.fval) return Expr(LitType::TRUE);
-                else return Expr(LitType::FALSE);
-            else if (e1.type == ExpType::FLOAT && e2.type == ExpType::FLOAT)
-                if (e1.fval <= e2.fval) return Expr(LitType::TRUE);
-                else return Expr(LitType::FALSE);
-            else throw "Invalid args type for '<='";
-        }
+        /* =, >, <, >=, <= */
+        case PrimType::EQ_NUM:
+            return eval_compare(CmpOp::EQ, "=", args, bindings, e);
+        case PrimType::GT:
+            return eval_compare(CmpOp::GT, ">", args, bindings, e);
+        case PrimType::LT:
+            return eval_compare(CmpOp::LT, "<", args, bindings, e);
+        case PrimType::GE:
+            return eval_compare(CmpOp::GE, ">=", args, bindings, e);
+        case PrimType::LE:
+            return eval_compare(CmpOp::LE, "<=", args, bindings, e);
         /*======================= Type checking ===========================*/
         /* number? */
         case PrimType::IS_NUM: {
             if (args.size() != 1) throw "Invalid num args for 'number?'";
-            Expr e1 = args[0]->eval(bindings, e);
-            if (e1.type == ExpType::INT || e1.type == ExpType::FLOAT)
-                return Expr(LitType::TRUE);
-            else return Expr(LitType::FALSE);
+            return make_bool(is_number(args[0]->eval(bindings, e)));
         }
         /* symbol? */
         case PrimType::IS_SYM: {
             if (args.size() != 1) throw "Invalid num args for 'symbol?'";
-            Expr e1 = args[0]->eval(bindings, e);
-            if (e1.type == ExpType::SYMBOL)
-                return Expr(LitType::TRUE);
-            else return Expr(LitType::FALSE);
+            Value e1 = args[0]->eval(bindings, e);
+            return make_bool(e1.type() == ExpType::SYMBOL);
         }
         /* list? */
         case PrimType::IS_LIST: {
             if (args.size() != 1) throw "Invalid num args for 'list?'";
-            Expr e1 = args[0]->eval(bindings, e);
-            if (e1.type == ExpType::LIST)
-                return Expr(LitType::TRUE);
-            else return Expr(LitType::FALSE);
+            Value e1 = args[0]->eval(bindings, e);
+            return make_bool(e1.type() == ExpType::LIST);
         }
         /* procedure? */
         case PrimType::IS_PROC: {
             if (args.size() != 1) throw "Invalid num args for 'procedure?'";
-            Expr e1 = args[0]->eval(bindings, e);
-            if (e1.type == ExpType::PROC)
-                return Expr(LitType::TRUE);
-            else return Expr(LitType::FALSE);
+            Value e1 = args[0]->eval(bindings, e);
+            return make_bool(e1.type() == ExpType::PROC);
         }
         /* boolean? */
         case PrimType::IS_BOOL: {
             if (args.size() != 1) throw "Invalid num args for 'boolean?'";
-            Expr e1 = args[0]->eval(bindings, e);
-            if (e1.type == ExpType::LIT)
-                return Expr(LitType::TRUE);
-            else return Expr(LitType::FALSE);
+            Value e1 = args[0]->eval(bindings, e);
+            return make_bool(e1.type() == ExpType::LIT);
         }
         /* string? */
         case PrimType::IS_STR: {
             if (args.size() != 1) throw "Invalid num args for 'string?'";
-            Expr e1 = args[0]->eval(bindings, e);
-            if (e1.type == ExpType::STRING)
-                return Expr(LitType::TRUE);
-            else return Expr(LitType::FALSE);
+            Value e1 = args[0]->eval(bindings, e);
+            return make_bool(e1.type() == ExpType::STRING);
         }
         /*======================= List operations =========================*/
         /* car */
         case PrimType::CAR: {
             if (args.size() != 1) throw "Invalid num args for 'car'";
-            Expr e1 = args[0]->eval(bindings, e);
-            if (e1.type == ExpType::LIST) {
-                std::vector<Expr*> l = *e1.list;
-                if (l.size() == 0) return Expr(LitType::NIL);
-                else return Expr(l[0]->eval(bindings, e)); 
+            Value e1 = args[0]->eval(bindings, e);
+            if (e1.type() == ExpType::LIST) {
+                if (e1.obj()->list_empty()) return Value(LitType::NIL);
+                Value head = ListCursor(e1.obj()).get();
+                if (!head.is_obj()) return head;
+                else return head.obj()->eval(bindings, e); 
             }
             else throw "Argument for 'car' is not list type"; ;
         }
         /* cdr */
         case PrimType::CDR: {
             if (args.size() != 1) throw "Invalid num args for 'cdr'";
-            Expr e1 = args[0]->eval(bindings, e);
-            if (e1.type == ExpType::LIST) {
-                std::vector<Expr*> l = *e1.list;
-                if (l.size() < 2) return Expr(LitType::NIL);
-                else {
-                    std::vector<Expr*> *res(new std::vector<Expr*>());
-                    for (size_t i = 1; i < l.size(); i++)
-                        res->push_back(l[i]);
-                    return Expr(res);
-                }
-            }
+            Value e1 = args[0]->eval(bindings, e);
+            if (e1.type() == ExpType::LIST) return e1.obj()->list_cdr();
             else throw "Argument for 'cdr' is not list type"; ;
         }
         /* cons */
         case PrimType::CONS: {
             if (args.size() != 2) throw "Invalid num args for 'cons'";
-            Expr e1 = args[0]->eval(bindings, e);
-            Expr e2 = args[1]->eval(bindings, e);
-            if (e1.type != ExpType::LIST && e2.type == ExpType::LIST) {
-                std::vector<Expr*> *l(new std::vector<Expr*>(*e2.list));
-                Expr *new_val = new Expr(e1);
-                l->insert(l->begin(), new_val);
-                return Expr(l);
+            Value e1 = args[0]->eval(bindings, e);
+            Value e2 = args[1]->eval(bindings, e);
+            if (e1.type() != ExpType::LIST && e2.type() == ExpType::LIST) {
+                Expr *rest = e2.obj()->list_empty() ? nullptr : e2.obj();
+                return Value(gc_new<Expr>(e1, rest));
             }
             else throw "Invalid arguments type for 'cons'"; ;
         }
         /* append */
         case PrimType::APPEND: {
             if (args.size() != 2) throw "Invalid num args for 'append'";
-            Expr e1 = args[0]->eval(bindings, e);
-            Expr e2 = args[1]->eval(bindings, e);
-            if (e1.type == ExpType::LIST && e2.type == ExpType::LIST) {
-                std::vector<Expr*> *l(new std::vector<Expr*>(*e1.list));
-                for (auto &elem : *e2.list) {
-                    Expr *new_val(new Expr(*elem));
-                    l->push_back(new_val);
-                }
-                return Expr(l);
+            Value e1 = args[0]->eval(bindings, e);
+            Value e2 = args[1]->eval(bindings, e);
+            if (e1.type() == ExpType::LIST && e2.type() == ExpType::LIST) {
+                // Only the first list is copied, the second one is shared
+                ListBuilder l;
+                for (ListCursor c(e1.obj()); !c.done(); c.next())
+                    l.push(c.get());
+                return l.finish(e2.obj());
             }
             else throw "Invalid arguments type for 'append'"; ;
         }
         /* map */
         case PrimType::MAP: {
             if (args.size() != 2) throw "Invalid num args for 'map'";
-            Expr fun = args[0]->eval(bindings, e);
-            Expr iter = args[1]->eval(bindings, e);
-            if (fun.type == ExpType::PROC && iter.type == ExpType::LIST) {
-                std::vector<Expr*> *l(new std::vector<Expr*>());
-                for (auto &elem : *iter.list) {
-                    std::vector<Expr*> args = {};
-                    Expr *arg_binding(new Expr(*elem));
-                    args.push_back(arg_binding);
-                    
-                    Expr *applied_elem(new Expr(fun.eval(&args, e)));
-                    l->push_back(applied_elem);
+            Value fun = args[0]->eval(bindings, e);
+            Value iter = args[1]->eval(bindings, e);
+            if (fun.type() == ExpType::PROC && iter.type() == ExpType::LIST) {
+                ListBuilder l;
+                for (ListCursor c(iter.obj()); !c.done(); c.next()) {
+                    std::vector<Value> args { c.get() };
+                    l.push(fun.obj()->eval(&args, e));
                 }
-                return Expr(l);
+                return l.finish(nullptr);
             }
             else throw "Invalid arguments type for 'map'"; ;
         }
         /* filter */
         case PrimType::FILTER: {
             if (args.size() != 2) throw "Invalid num args for 'filter'";
-            Expr fun = args[0]->eval(bindings, e);
-            Expr iter = args[1]->eval(bindings, e);
-            if (fun.type == ExpType::PROC && iter.type == ExpType::LIST) {
-                std::vector<Expr*> *l(new std::vector<Expr*>());
-                for (auto &elem : *iter.list) {
-                    std::vector<Expr*> args { elem };
-                    Expr applied_elem = Expr(fun.eval(&args, e));
-                    if (applied_elem.get_expr_type() == ExpType::LIT) {
-                        if (applied_elem.lit == LitType::TRUE)
-                            l->push_back(new Expr(*elem));
+            Value fun = args[0]->eval(bindings, e);
+            Value iter = args[1]->eval(bindings, e);
+            if (fun.type() == ExpType::PROC && iter.type() == ExpType::LIST) {
+                ListBuilder l;
+                for (ListCursor c(iter.obj()); !c.done(); c.next()) {
+                    std::vector<Value> args { c.get() };
+                    Value applied_elem = fun.obj()->eval(&args, e);
+                    if (applied_elem.type() == ExpType::LIT) {
+                        if (applied_elem.lit() == LitType::TRUE)
+                            l.push(c.get());
                     }
                     else { throw "Decider function does not return lit type"; }
                 }
-                return Expr(l);
+                return l.finish(nullptr);
             }
             else throw "Invalid arguments type for 'filter'"; ;
         }
+        /* pmap */
+        case PrimType::PMAP: {
+            if (args.size() != 2) throw "Invalid num args for 'pmap'";
+            Value fun = args[0]->eval(bindings, e);
+            Value iter = args[1]->eval(bindings, e);
+            if (fun.type() == ExpType::PROC && iter.type() == ExpType::LIST)
+                return eval_parallel(fun, iter, e, false);
+            else throw "Invalid arguments type for 'pmap'";
+        }
+        /* pfilter */
+        case PrimType::PFILTER: {
+            if (args.size() != 2) throw "Invalid num args for 'pfilter'";
+            Value fun = args[0]->eval(bindings, e);
+            Value iter = args[1]->eval(bindings, e);
+            if (fun.type() == ExpType::PROC && iter.type() == ExpType::LIST)
+                return eval_parallel(fun, iter, e, true);
+            else throw "Invalid arguments type for 'pfilter'";
+        }
         /* null? */
         case PrimType::IS_NULL: {
             if (args.size() != 1) throw "Invalid num args for 'null?'";
-            Expr e1 = args[0]->eval(bindings, e);
-            if (e1.type == ExpType::LIST) {
-                std::vector<Expr*> l = *e1.list;
-                if (l.size() == 0) return Expr(LitType::TRUE);
-                else return Expr(LitType::FALSE);
-            }
+            Value e1 = args[0]->eval(bindings, e);
+            if (e1.type() == ExpType::LIST)
+                return make_bool(e1.obj()->list_empty());
             else throw "Invalid argument type for 'null?'"; ;
         }
 
+        /*======================= Numeric vectors =========================*/
+        case PrimType::MAKE_F64VEC:     case PrimType::MAKE_I64VEC:
+        case PrimType::LIST_TO_F64VEC:  case PrimType::LIST_TO_I64VEC:
+        case PrimType::VEC_TO_LIST:     case PrimType::IS_VEC:
+        case PrimType::VEC_LEN:         case PrimType::VEC_REF:
+        case PrimType::VEC_SET:         case PrimType::VEC_SUM:
+        case PrimType::VEC_DOT:         case PrimType::VEC_MIN:
+        case PrimType::VEC_MAX:         case PrimType::VEC_MAP:
+            return eval_vector(prim_type, args, bindings, e);
+
+        /*======================= Hash tables =============================*/
+        case PrimType::MAKE_HASH: {
+            if (args.size() != 0)
+                throw "Invalid num args for 'make-hash-table'";
+            return Value(gc_new<Expr>(std::make_shared<HashTable>()));
+        }
+        /* hash-ref, with an optional default for missing keys */
+        case PrimType::HASH_REF: {
+            if (args.size() != 2 && args.size() != 3)
+                throw "Invalid num args for 'hash-ref'";
+            Value h = args[0]->eval(bindings, e);
+            Value key = args[1]->eval(bindings, e);
+            if (h.type() != ExpType::HASH)
+                throw "Invalid args type for 'hash-ref'";
+            Value found;
+            if (h.obj()->get_table().get(key, found)) return found;
+            if (args.size() == 3) return args[2]->eval(bindings, e);
+            throw "Key not found for 'hash-ref'";
+        }
+        /* hash-set!, returns the table so that calls can be chained */
+        case PrimType::HASH_SET: {
+            if (args.size() != 3) throw "Invalid num args for 'hash-set!'";
+            Value h = args[0]->eval(bindings, e);
+            Value key = args[1]->eval(bindings, e);
+            Value val = args[2]->eval(bindings, e);
+            if (h.type() != ExpType::HASH)
+                throw "Invalid args type for 'hash-set!'";
+            h.obj()->get_table().set(key, val);
+            return h;
+        }
+        /* hash-remove!, returns the table */
+        case PrimType::HASH_REMOVE: {
+            if (args.size() != 2)
+                throw "Invalid num args for 'hash-remove!'";
+            Value h = args[0]->eval(bindings, e);
+            Value key = args[1]->eval(bindings, e);
+            if (h.type() != ExpType::HASH)
+                throw "Invalid args type for 'hash-remove!'";
+            h.obj()->get_table().remove(key);
+            return h;
+        }
+        case PrimType::HASH_COUNT: {
+            if (args.size() != 1) throw "Invalid num args for 'hash-count'";
+            Value h = args[0]->eval(bindings, e);
+            if (h.type() != ExpType::HASH)
+                throw "Invalid args type for 'hash-count'";
+            return Value(int64_t(h.obj()->get_table().size()));
+        }
+
+        /*=========================== Strings ============================*/
+        case PrimType::STR_APPEND:      case PrimType::STR_LEN:
+        case PrimType::SUBSTRING:       case PrimType::STR_TO_NUM:
+        case PrimType::NUM_TO_STR:      case PrimType::STR_SPLIT:
+            return eval_string(prim_type, args, bindings, e);
+
+        /*======================= Introspection ==========================*/
+        case PrimType::RUNTIME_STATS: {
+            if (args.size() != 0)
+                throw "Invalid num args for 'runtime-stats'";
+            return Counters::make_list(Counters::get_stats());
+        }
+
         /*======================= Invalid primative =======================*/
         default: throw "Invalid primitive";
     }
@@ -622,72 +1014,133 @@ Expr Expr::eval_prim(std::vector<Expr*> *bindings, Env *e) {
 
 /**
  * Evaluate generic expression. Delegate evaluation to data-type specific 
- * eval function.
+ * eval function. Variables, `if` branches and procedure bodies are in tail
+ * position, so they are evaluated by looping instead of recursing, and a
+ * tail recursive procedure runs in constant native stack.
  * @param bindings pointer to vector containing argument bindings
  * @param e pointer to env
  * @returns evaluated expression 
  */
-Expr Expr::eval(std::vector<Expr*> *bindings, Env *e) {
-    switch (type) {
-        case ExpType::INT:      return *this;
-        case ExpType::FLOAT:    return *this;
-        case ExpType::STRING:   return *this;
-        case ExpType::LIST:     return *this;
-        case ExpType::LIT:      return *this;
-        case ExpType::PRIM:     return eval_prim(bindings, e);
-        case ExpType::SYMBOL:   return eval_sym(bindings, e);
-        case ExpType::PROC:     return eval_proc(bindings, e);
-        default:                throw "Eval failed: Unknown token type";
+Value Expr::eval(std::vector<Value> *bindings, Env *e) {
+    Expr *cur = this;
+    std::vector<Value> tail_bindings = {};
+    ProfScope scope;
+
+    for (;;) {
+        Counters::get().evals[size_t(cur->type)]++;
+        switch (cur->type) {
+            case ExpType::INT:      return Value(cur);
+            case ExpType::BIGINT:   return Value(cur);
+            case ExpType::FLOAT:    return Value(cur);
+            case ExpType::STRING:   return Value(cur);
+            case ExpType::LIST:     return Value(cur);
+            case ExpType::LIT:      return Value(cur);
+            case ExpType::VECTOR:   return Value(cur);
+            case ExpType::HASH:     return Value(cur);
+            case ExpType::PRIM: {
+                if (std::get<0>(cur->prim) != PrimType::IF) {
+                    if (Profiler::enabled) {
+                        ProfScope prim_scope;
+                        prim_scope.enter(
+                            Profiler::prim_id(std::get<0>(cur->prim)));
+                        return cur->eval_prim(bindings, e);
+                    }
+                    return cur->eval_prim(bindings, e);
+                }
+                cur = cur->eval_if(bindings, e);
+                break;
+            }
+            case ExpType::SYMBOL:   cur = cur->eval_sym(e);     break;
+            case ExpType::LOCAL: {
+                Value found_val = cur->eval_local(e);
+                if (!found_val.is_obj()) return found_val;
+                cur = found_val.obj();
+                break;
+            }
+            case ExpType::PROC: {
+                cur = cur->eval_proc(bindings, e, tail_bindings);
+                if (Profiler::enabled) {
+                    // The frame of the call belongs to the callee
+                    scope.enter(Profiler::proc_id(cur));
+                    Profiler::count_alloc();
+                }
+                break;
+            }
+            case ExpType::CODE:     return VM::run(cur->code, e);
+            case ExpType::MEMO:     return cur->memo->call(bindings, e);
+            default:                throw "Eval failed: Unknown token type";
+        }
     }
 }
 
+/*============================================================================
+ *  Lists
+ *===========================================================================*/
+bool Expr::list_empty() const {
+    return list.vec != nullptr && list.start >= list.vec->size();
+}
+
+/**
+ * Get the rest of a list. Cons cells already hold it, a literal list gets
+ * a new view of its vector. Lists of fewer than two elements have no rest.
+ * @returns Rest of the list, or nil
+ */
+Value Expr::list_cdr() {
+    if (list.vec == nullptr) {
+        if (list.cdr == nullptr) return Value(LitType::NIL);
+        return Value(list.cdr);
+    }
+    if (list.start + 2 > list.vec->size()) return Value(LitType::NIL);
+    return Value(gc_new<Expr>(list.vec, list.start + 1));
+}
+
+/**
+ * Append an element to the list being built
+ * @param v Element
+ * @returns void
+ */
+void ListBuilder::push(Value v) {
+    Expr *cell = gc_new<Expr>(v, nullptr);
+    if (head == nullptr) head = cell;
+    else last->list.cdr = cell;
+    last = cell;
+}
+
+/**
+ * Move the cells of another list being built to the end of this one
+ * @param other List being built, left empty
+ * @returns void
+ */
+void ListBuilder::append(ListBuilder &other) {
+    if (other.head == nullptr) return;
+    if (head == nullptr) head = other.head;
+    else last->list.cdr = other.head;
+    last = other.last;
+    other.head = other.last = nullptr;
+}
+
+/**
+ * Finish the list being built
+ * @param rest List shared as the tail of the new list, or nullptr
+ * @returns The new list
+ */
+Value ListBuilder::finish(Expr *rest) {
+    if (rest != nullptr && rest->list_empty()) rest = nullptr;
+    if (head == nullptr) {
+        if (rest != nullptr) return Value(rest);
+        return Value(gc_new<Expr>(gc_new<std::vector<Expr*>>()));
+    }
+    last->list.cdr = rest;
+    return Value(head);
+}
+
 /*============================================================================
  *  IOs
  *===========================================================================*/
 /**
- * Print expression to stdout
+ * Print expression to the writer of the calling thread, see `Writer::out`
  * @returns void
  */
 void Expr::print_to_console(void) {
-    switch (type) {
-        case ExpType::INT:     { std::cout << ival;               break; }
-        case ExpType::FLOAT:   { std::cout << fval;               break; }
-        case ExpType::STRING:  { std::cout << sval;               break; }
-        case ExpType::PROC:    { std::cout << "<procedure>";      break; }
-        case ExpType::SYMBOL:  { 
-            if (std::get<1>(sym))
-                std::get<1>(sym)->print_to_console();
-            else 
-                std::cerr << "Unknown symbol '" << std::get<0>(sym) << "'";
-            break;
-        }
-        case ExpType::PRIM: {
-            switch (std::get<0>(prim)) {
-                case PrimType::LAMBDA:  std::cout << "<closure>"; break;
-                case PrimType::DEFINE:  break;
-                case PrimType::SET:     break;
-                default:                std::cout << "<primitive>"; break;
-            }
-            break;
-        }
-        case ExpType::LIT: {
-            switch (lit) {
-                case LitType::TRUE:     std::cout<< "#t"; break;
-                case LitType::FALSE:    std::cout<< "#f"; break;
-                case LitType::NIL:      std::cout<< "()"; break;
-                default: break;
-            }
-            break;
-        }
-        case ExpType::LIST: {
-            std::cout << "(";
-            size_t i = 0;
-            for (; i < list->size() - 1; i++) {
-                list->at(i)->print_to_console(); std::cout << " ";
-            }
-            list->at(i)->print_to_console();     std::cout << ")";
-            break;
-        }
-        default: break;
-    }
+    Writer::out().write_value(Value(this));
 }
@@ -8,13 +8,19 @@
  *==========================================================================*/
 #include <iostream>
 #include <fstream>
+#include <memory>
 #include <string>
 #include <vector>
 #include <tuple>
 #include <inttypes.h>
 #include <math.h>
 
+#include "bigint.h"
 #include "env.h"
+#include "gc.h"
+#include "strview.h"
+#include "symbol.h"
+#include "value.h"
 #ifndef EXPR_H_
 #define EXPR_H_
 
@@ -23,7 +29,6 @@
  *===========================================================================*/
 #define NO_BINDING nullptr
 
-enum class ExpType { LIT, INT, FLOAT, STRING, LIST, SYMBOL, PROC, PRIM };
 enum class PrimType { 
     IF, DEFINE, SET,                                // Control flow, var assign
     ADD, SUB, MUL, DIV, MOD, GT, LT, GE, LE, EQ,    // Arithmetic operations
@@ -31,40 +36,111 @@ enum class PrimType {
     IS_NUM, IS_SYM, IS_PROC, IS_LIST, IS_STR,       // Type check
     IS_BOOL,
     LAMBDA,                                         // Lambda expression
-    CAR, CDR, CONS, IS_NULL, MAP, FILTER, APPEND    // List operations
+    CAR, CDR, CONS, IS_NULL, MAP, FILTER, APPEND,   // List operations
+    PMAP, PFILTER,                                  // Parallel list ops
+    DEFINE_MEMO,                                    // Memoization
+    MAKE_F64VEC, MAKE_I64VEC, LIST_TO_F64VEC,       // Numeric vectors
+    LIST_TO_I64VEC, VEC_TO_LIST, IS_VEC, VEC_LEN,
+    VEC_REF, VEC_SET, VEC_SUM, VEC_DOT, VEC_MIN, VEC_MAX, VEC_MAP,
+    MAKE_HASH, HASH_REF, HASH_SET, HASH_REMOVE,     // Hash tables
+    HASH_COUNT,
+    STR_APPEND, STR_LEN, SUBSTRING, STR_TO_NUM,     // Strings
+    NUM_TO_STR, STR_SPLIT,
+    RUNTIME_STATS                                   // Introspection
+};
+
+/* Forward-declaration of `Memo`, see memo.h */
+class Memo;
+/* Forward-declaration of `NumVector`, see numvec.h */
+class NumVector;
+/* Forward-declaration of `HashTable`, see hashtable.h */
+class HashTable;
+
+/* Fixed-size array of expressions, used for the arguments of primitives */
+struct ExprArray {
+    Expr **data;
+    size_t len;
+
+    size_t size() const                 { return len; }
+    Expr *&operator[](size_t i) const   { return data[i]; }
+    Expr **begin() const                { return data; }
+    Expr **end() const                  { return data + len; }
+};
+
+/**
+ * Immutable list. A list written as a literal is a suffix of the vector the
+ * parser built for it, starting at `start`, so its cdr only moves the start.
+ * Lists built at runtime are chains of cons cells: `vec` is nullptr, `car`
+ * holds the first element and `cdr` the rest of the list, or nullptr at
+ * its end. Cells share their tails, and the empty list is always a vector.
+ */
+struct ExprList {
+    std::vector<Expr*> *vec;
+    size_t start;
+    Value car;
+    Expr *cdr;
 };
-enum class LitType { TRUE, FALSE, NIL };
 
 /*============================================================================
  *  Expression class
  *===========================================================================*/
 class Expr {
+    friend class Heap;
+    friend class Compiler;
+    friend class VM;
+    friend class Value;
+    friend class ListCursor;
+    friend class ListBuilder;
+    friend class Optimizer;
+    friend class Memo;
+    friend class Profiler;
+    friend class Writer;
+
 private:
     ExpType type;
     union {
-        int64_t ival; double fval; std::string sval = ""; LitType lit;
-        std::vector<Expr*> *list;
-        std::tuple<std::string, Expr*> sym;
-        std::tuple<PrimType, std::vector<Expr*> *> prim;
+        int64_t ival; double fval; StrView sval; LitType lit;
+        BigInt bval;
+        ExprList list;
+        std::tuple<const Symbol*, Expr*> sym;
+        std::tuple<const Symbol*, size_t, size_t> local;
+        std::tuple<PrimType, ExprArray> prim;
         std::tuple<Expr*, Expr*, Env*> proc;
+        Code *code;
+        Memo *memo;
+        std::shared_ptr<NumVector> nvec;
+        std::shared_ptr<HashTable> table;
     };
 
-    /* Specific type evaluators */
-    Expr eval_sym(std::vector<Expr*> *bindings, Env *e);
-    Expr eval_proc(std::vector<Expr*> *bindings, Env *e);
-    Expr eval_prim(std::vector<Expr*> *bindings, Env *e);
+    /* Specific type evaluators. Those ending in a tail position return the
+       expression to continue with, which `eval` runs in the same frame */
+    Expr *eval_sym(Env *e);
+    Value eval_local(Env *e);
+    Expr *eval_if(std::vector<Value> *bindings, Env *e);
+    Expr *eval_proc(std::vector<Value> *&bindings, Env *&e,
+                    std::vector<Value> &tail_bindings);
+    Value eval_prim(std::vector<Value> *bindings, Env *e);
 
 public:
     /* Constructors */
     Expr(int64_t i);
+    Expr(BigInt b);
     Expr(double f);
     Expr(std::string s);
+    Expr(StrView s);
     Expr(LitType l);
     Expr(std::vector<Expr*> *l);
+    Expr(std::vector<Expr*> *l, size_t start);
+    Expr(Value car, Expr *cdr);
 
-    Expr(std::string sym_name, Expr *sym_val); 
-    Expr(PrimType t, std::vector<Expr*> *args);
+    Expr(const Symbol *sym_name, Expr *sym_val);
+    Expr(const Symbol *sym_name, size_t depth, size_t slot);
+    Expr(PrimType t, ExprArray args);
     Expr(Expr *params, Expr *body, Env *env);
+    Expr(Code *c);
+    Expr(Memo *m);
+    Expr(std::shared_ptr<NumVector> v);
+    Expr(std::shared_ptr<HashTable> t);
     ~Expr();
 
     /* Copy constructor */
@@ -73,12 +149,112 @@ public:
     /* Getters */
     ExpType get_expr_type(void);
     PrimType get_prim_type(void);
+    const Symbol *get_symbol(void);
+    const BigInt &get_bigint(void);
+    const StrView &get_string(void);
+    NumVector &get_vector(void);
+    HashTable &get_table(void);
 
     /* Generic evaluator dispatcher */
-    Expr eval(std::vector<Expr*> *bindings, Env *e);
+    Value eval(std::vector<Value> *bindings, Env *e);
+
+    /* Procedure of a lambda, see `make_closure` */
+    Value make_closure(Env *e);
+
+    /* Lists, see `ExprList` */
+    bool list_empty() const;
+    Value list_cdr();
 
     /* IO */
     void print_to_console(void);
 };
 
+/*============================================================================
+ *  List helpers
+ *===========================================================================*/
+/* Walks the elements of a list front to back without allocating */
+class ListCursor {
+private:
+    Expr *node;
+    size_t pos;
+
+public:
+    ListCursor(Expr *l) : node(l), pos(l->list.start) {}
+
+    bool done() const {
+        return node == nullptr || (node->list.vec != nullptr &&
+                                   pos >= node->list.vec->size());
+    }
+    Value get() const {
+        if (node->list.vec != nullptr) return Value((*node->list.vec)[pos]);
+        return node->list.car;
+    }
+    void next() {
+        if (node->list.vec != nullptr) { pos++; return; }
+        node = node->list.cdr;
+        if (node != nullptr) pos = node->list.start;
+    }
+};
+
+/* Builds a fresh list of cons cells front to back */
+class ListBuilder {
+private:
+    Expr *head;
+    Expr *last;
+
+public:
+    ListBuilder() : head(nullptr), last(nullptr) {}
+    void push(Value v);
+    void append(ListBuilder &other);
+    Value finish(Expr *rest);
+};
+
+/*============================================================================
+ *  Value getters
+ *===========================================================================*/
+Value::Value(Expr *e) {
+    switch (e->type) {
+        case ExpType::INT:      *this = Value(e->ival);     break;
+        case ExpType::FLOAT:    *this = Value(e->fval);     break;
+        case ExpType::LIT:      *this = Value(e->lit);      break;
+        default:    bits = reinterpret_cast<uintptr_t>(e);  break;
+    }
+}
+
+ExpType Value::type() const {
+    if (is_int())   return ExpType::INT;
+    if (is_float()) return ExpType::FLOAT;
+    if (is_lit())   return ExpType::LIT;
+    return obj()->type;
+}
+
+int64_t Value::ival() const {
+    if (is_int()) return int64_t(bits << 16) >> 16;
+    return obj()->ival;
+}
+
+double Value::fval() const {
+    if (!is_float()) return obj()->fval;
+    double f;
+    uint64_t raw = bits - FLOAT_OFFSET;
+    std::memcpy(&f, &raw, sizeof(f));
+    return f;
+}
+
+LitType Value::lit() const {
+    if (is_lit()) return LitType(bits >> 4);
+    return obj()->lit;
+}
+
+/* Truthiness of the condition of 'if' */
+bool Value::is_true() const {
+    switch (type()) {
+        case ExpType::LIT:      return lit() == LitType::TRUE;
+        case ExpType::INT:      return ival() > 0;
+        case ExpType::BIGINT:   return !obj()->bval.is_negative();
+        case ExpType::FLOAT:    return fval() > 0.0;
+        default:                return false;
+    }
+}
+
 #endif
@@ -0,0 +1,506 @@
+/*============================================================================
+ *  nanoscheme
+ *  Copyright (c) 2019-2020 - Trung Truong
+ *
+ *  File name: gc.cpp
+ *  Description: Implementation of `Heap` class
+ *
+ *  Objects reachable from the registered root environments are traced
+ *  precisely. The native stack is the evaluation stack of the interpreter,
+ *  so it is scanned conservatively: every word that points into a live
+ *  object keeps that object alive. This lets the evaluator keep passing
+ *  `Expr` by value and `Expr*`/`Env*` around in locals without registering
+ *  each one as a root. Threads of a `Pool` allocate into lists of their
+ *  own while collection is paused, see `Heap::attach_thread`.
+ *
+ *==========================================================================*/
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include "arena.h"
+#include "counters.h"
+#include "gc.h"
+#include "expr.h"
+#include "hashtable.h"
+#include "memo.h"
+#include "profiler.h"
+#include "vm.h"
+
+/* Collect once this many bytes were allocated since the last collection */
+static const size_t GC_MIN_THRESHOLD = 4 * 1024 * 1024;
+
+static inline GCHeader *header_of(void *obj) {
+    return reinterpret_cast<GCHeader*>(
+        static_cast<char*>(obj) - GC_HEADER_SIZE);
+}
+
+/* Allocations of the running thread, if it is a worker, see `Pool` */
+static thread_local GCLocal *worker_objects = nullptr;
+
+static inline char *object_of(GCHeader *header) {
+    return reinterpret_cast<char*>(header) + GC_HEADER_SIZE;
+}
+
+/* Constructors */
+Heap::Heap()
+    : objects({}), gray({}), roots({}), arenas({}), arena_ranges({}),
+      bytes(0), released_bytes(0), threshold(GC_MIN_THRESHOLD),
+      stack_base(nullptr), paused(0),
+      stats() {}
+
+/* Destructor */
+Heap::~Heap() {}
+
+/**
+ * Heap used by the running interpreter
+ * @returns Reference to the heap
+ */
+Heap &Heap::current() {
+    static Heap heap;
+    return heap;
+}
+
+/*============================================================================
+ *  Roots
+ *===========================================================================*/
+/**
+ * Set the outermost frame of the stack that is scanned for roots. No
+ * collection happens before the stack base is known.
+ * @param base Address in the frame of the outermost interpreter function
+ * @returns void
+ */
+void Heap::set_stack_base(void *base) {
+    stack_base = base;
+}
+
+/* Roots and arenas may be added by threads of a `Server` */
+void Heap::add_root(Env *env) {
+    std::lock_guard<std::mutex> guard(merge_lock);
+    roots.push_back(env);
+}
+
+void Heap::remove_root(Env *env) {
+    std::lock_guard<std::mutex> guard(merge_lock);
+    auto itr = std::find(roots.begin(), roots.end(), env);
+    if (itr != roots.end()) roots.erase(itr);
+}
+
+/**
+ * Overwrite the part of the native stack right below the caller's frame.
+ * Frames of calls that already returned are left there, and a deep call
+ * made next would keep their pointers visible to the stack scan for as
+ * long as it runs. Call this before such calls.
+ * @returns void
+ */
+__attribute__((noinline)) void Heap::clear_stack() {
+    char area[2048];
+    memset(area, 0, sizeof(area));
+    __asm__ __volatile__("" : : "r"(area) : "memory");
+}
+
+/*============================================================================
+ *  Threads
+ *===========================================================================*/
+/**
+ * Pause collection. The stacks of other threads are not scanned, so no
+ * collection may run while they hold references. Pauses nest.
+ * @returns void
+ */
+void Heap::pause() {
+    paused++;
+}
+
+void Heap::resume() {
+    paused--;
+}
+
+/**
+ * Make the calling thread allocate into its own list of objects, which
+ * needs no locking. Collection must be paused until the thread detached.
+ * Other threads only evaluate while attached, so this is also where their
+ * evaluator counters are registered.
+ * @param l Pointer to the list of objects of the thread
+ * @returns void
+ */
+void Heap::attach_thread(GCLocal *l) {
+    Counters::attach();
+    worker_objects = l;
+}
+
+/**
+ * Check if the calling thread allocates into its own list of objects
+ * @returns True between `attach_thread` and `detach_thread`
+ */
+bool Heap::is_attached() {
+    return worker_objects != nullptr;
+}
+
+/**
+ * Hand the objects allocated by the calling thread over to the heap
+ * @returns void
+ */
+void Heap::detach_thread() {
+    std::lock_guard<std::mutex> guard(merge_lock);
+    objects.insert(objects.end(), worker_objects->objects.begin(),
+                   worker_objects->objects.end());
+    bytes += worker_objects->bytes;
+    stats.allocated_objects += worker_objects->objects.size();
+    stats.allocated_bytes += worker_objects->bytes;
+    stats.peak_bytes = std::max(stats.peak_bytes, bytes);
+    worker_objects = nullptr;
+}
+
+/*============================================================================
+ *  Allocation
+ *===========================================================================*/
+/**
+ * Allocate memory for a collected object. Collects first if enough memory
+ * was allocated since the last collection, see `safepoint`.
+ * @param kind Kind of object that will be constructed in the memory
+ * @param size Size of the object
+ * @returns Pointer to uninitialized memory for the object
+ */
+void *Heap::allocate(GCKind kind, size_t size) {
+    safepoint();
+    Counters::count_object(kind);
+    if (Profiler::enabled) Profiler::count_alloc();
+
+    GCHeader *header = static_cast<GCHeader*>(
+        ::operator new(GC_HEADER_SIZE + size));
+    header->kind = kind;
+    header->marked = false;
+    header->size = static_cast<uint32_t>(size);
+    header->arena = nullptr;
+    if (worker_objects != nullptr) {
+        worker_objects->objects.push_back(header);
+        worker_objects->bytes += GC_HEADER_SIZE + size;
+        return object_of(header);
+    }
+    objects.push_back(header);
+
+    bytes += GC_HEADER_SIZE + size;
+    stats.allocated_objects++;
+    stats.allocated_bytes += GC_HEADER_SIZE + size;
+    stats.peak_bytes = std::max(stats.peak_bytes, bytes);
+    return object_of(header);
+}
+
+/**
+ * Collect if enough memory was allocated since the last collection, unless
+ * collection is paused or the calling thread is a worker
+ * @returns void
+ */
+void Heap::safepoint() {
+    if (worker_objects == nullptr && paused == 0 &&
+        bytes + released_bytes >= threshold && stack_base != nullptr)
+        collect();
+}
+
+/**
+ * Check if the next safepoint of the main thread would collect, from any
+ * thread
+ * @returns True if enough memory was allocated or released since the last
+ * collection
+ */
+bool Heap::collection_due() {
+    std::lock_guard<std::mutex> guard(merge_lock);
+    return bytes + released_bytes >= threshold && stack_base != nullptr;
+}
+
+/**
+ * Create an arena for the AST of a new compilation unit. The arena stays
+ * alive at least until `Arena::release` is called on it.
+ * @returns Pointer to the new arena
+ */
+Arena *Heap::new_arena() {
+    Arena *arena = new Arena();
+    std::lock_guard<std::mutex> guard(merge_lock);
+    arenas.push_back(arena);
+    return arena;
+}
+
+/**
+ * Unpin an arena, see `Arena::release`. Its memory is only reclaimed by a
+ * collection, so it counts toward triggering the next one, and a program
+ * made of many compilation units does not pile up released arenas.
+ * @param arena Arena to release
+ * @returns void
+ */
+void Heap::release_arena(Arena *arena) {
+    std::lock_guard<std::mutex> guard(merge_lock);
+    arena->pinned = false;
+    released_bytes += arena->bytes;
+}
+
+/**
+ * Count memory held by objects outside the heap, such as the elements of
+ * numeric vectors, toward triggering the next collection
+ * @param size Bytes allocated
+ * @returns void
+ */
+void Heap::add_external(size_t size) {
+    std::lock_guard<std::mutex> guard(merge_lock);
+    released_bytes += size;
+}
+
+/*============================================================================
+ *  Mark phase
+ *===========================================================================*/
+void Heap::mark(void *obj) {
+    if (obj == nullptr) return;
+    GCHeader *header = header_of(obj);
+    if (header->arena != nullptr) return mark_arena(header->arena);
+    if (header->marked) return;
+    header->marked = true;
+    gray.push_back(header);
+}
+
+/**
+ * Mark an arena and queue all of its nodes for tracing. Arenas live and
+ * die as a whole, so one reference keeps every node in it alive.
+ * @param arena Arena to mark
+ * @returns void
+ */
+void Heap::mark_arena(Arena *arena) {
+    if (arena->marked) return;
+    arena->marked = true;
+    arena->for_each([this](GCHeader *header) { gray.push_back(header); });
+}
+
+/**
+ * Mark every object directly referenced by a collected object
+ * @param header Header of the object to trace
+ * @returns void
+ */
+void Heap::trace(GCHeader *header) {
+    switch (header->kind) {
+        case GCKind::EXPR: {
+            Expr *e = reinterpret_cast<Expr*>(object_of(header));
+            switch (e->type) {
+                case ExpType::LIST: {
+                    if (e->list.vec != nullptr) mark(e->list.vec);
+                    else if (e->list.car.is_obj()) mark(e->list.car.obj());
+                    mark(e->list.cdr);
+                    break;
+                }
+                case ExpType::SYMBOL: mark(std::get<1>(e->sym));    break;
+                case ExpType::PRIM: {
+                    ExprArray &args = std::get<1>(e->prim);
+                    mark(args.data);
+                    for (Expr *arg : args) mark(arg);
+                    break;
+                }
+                case ExpType::PROC: {
+                    mark(std::get<0>(e->proc));
+                    mark(std::get<1>(e->proc));
+                    mark(std::get<2>(e->proc));
+                    break;
+                }
+                case ExpType::CODE:   mark(e->code);                break;
+                case ExpType::HASH: {
+                    e->table->for_each([this](Value key, Value value) {
+                        if (key.is_obj()) mark(key.obj());
+                        if (value.is_obj()) mark(value.obj());
+                    });
+                    break;
+                }
+                case ExpType::MEMO: {
+                    mark(e->memo->body);
+                    for (Memo::Entry &entry : e->memo->entries) {
+                        for (const Value &arg : entry.args)
+                            if (arg.is_obj()) mark(arg.obj());
+                        if (entry.result.is_obj()) mark(entry.result.obj());
+                    }
+                    break;
+                }
+                default: break;
+            }
+            break;
+        }
+        case GCKind::ENV: {
+            Env *env = reinterpret_cast<Env*>(object_of(header));
+            for (auto &binding : env->frame) mark(binding.second);
+            for (const Value &slot : env->slots)
+                if (slot.is_obj()) mark(slot.obj());
+            mark(env->tail);
+            break;
+        }
+        case GCKind::LIST: {
+            auto *list = reinterpret_cast<std::vector<Expr*>*>(
+                object_of(header));
+            for (Expr *elem : *list) mark(elem);
+            break;
+        }
+        case GCKind::ARRAY: {
+            Expr **array = reinterpret_cast<Expr**>(object_of(header));
+            for (size_t i = 0; i < header->size / sizeof(Expr*); i++)
+                mark(array[i]);
+            break;
+        }
+        case GCKind::CODE: {
+            Code *code = reinterpret_cast<Code*>(object_of(header));
+            for (size_t i = 0; i < code->num_consts; i++)
+                if (code->consts[i].is_obj()) mark(code->consts[i].obj());
+            break;
+        }
+    }
+}
+
+/**
+ * Conservatively mark every object that a word in `[lo, hi)` points into.
+ * `objects` must be sorted by address.
+ * @param lo Lowest address of the range
+ * @param hi Highest address of the range
+ * @returns void
+ */
+void Heap::scan_range(char *lo, char *hi) {
+    char *first = objects.empty() ? nullptr : object_of(objects.front());
+    char *last  = objects.empty() ? nullptr 
+                : object_of(objects.back()) + objects.back()->size;
+
+    lo = reinterpret_cast<char*>(
+        (reinterpret_cast<uintptr_t>(lo) + sizeof(void*) - 1)
+        & ~(sizeof(void*) - 1));
+    for (char *p = lo; p + sizeof(void*) <= hi; p += sizeof(void*)) {
+        char *word = *reinterpret_cast<char**>(p);
+
+        // Find the last object that starts at or before the word
+        if (word >= first && word < last) {
+            GCHeader *key = reinterpret_cast<GCHeader*>(word);
+            auto itr = std::upper_bound(objects.begin(), objects.end(), key);
+            GCHeader *header = *(itr - 1);
+            char *start = object_of(header);
+            if (word >= start && word < start + header->size) {
+                mark(start);
+                continue;
+            }
+        }
+
+        // Any word into an arena chunk keeps the whole arena alive
+        ArenaRange range_key = { word, word, nullptr };
+        auto range = std::upper_bound(arena_ranges.begin(), 
+            arena_ranges.end(), range_key,
+            [](const ArenaRange &a, const ArenaRange &b) {
+                return a.lo < b.lo;
+            });
+        if (range != arena_ranges.begin() && word < (range - 1)->hi)
+            mark_arena((range - 1)->arena);
+    }
+}
+
+/**
+ * Scan the native stack for pointers into the heap. The caller must have
+ * spilled the callee-saved registers into its own frame.
+ * @returns void
+ */
+__attribute__((noinline)) void Heap::scan_stack() {
+    char *lo = static_cast<char*>(__builtin_frame_address(0));
+    char *hi = static_cast<char*>(stack_base);
+    scan_range(lo, hi);
+}
+
+/*============================================================================
+ *  Sweep phase
+ *===========================================================================*/
+void Heap::destroy(GCHeader *header) {
+    void *obj = object_of(header);
+    switch (header->kind) {
+        case GCKind::EXPR: static_cast<Expr*>(obj)->~Expr(); break;
+        case GCKind::ENV:  static_cast<Env*>(obj)->~Env();   break;
+        case GCKind::LIST: {
+            static_cast<std::vector<Expr*>*>(obj)->~vector();
+            break;
+        }
+        case GCKind::ARRAY: break;
+        case GCKind::CODE:  break;
+    }
+    ::operator delete(header);
+}
+
+/**
+ * Free every unmarked object and clear the marks of the survivors
+ * @returns void
+ */
+void Heap::sweep() {
+    size_t live_arenas = 0;
+    for (Arena *arena : arenas) {
+        if (arena->marked || arena->pinned) {
+            arena->marked = false;
+            arenas[live_arenas++] = arena;
+        }
+        else delete arena;
+    }
+    arenas.resize(live_arenas);
+
+    size_t live = 0;
+    bytes = 0;
+    for (GCHeader *header : objects) {
+        if (header->marked) {
+            header->marked = false;
+            bytes += GC_HEADER_SIZE + header->size;
+            objects[live++] = header;
+        }
+        else {
+            destroy(header);
+            stats.freed_objects++;
+        }
+    }
+    objects.resize(live);
+}
+
+/*============================================================================
+ *  Collection
+ *===========================================================================*/
+/**
+ * Run a full mark-sweep collection
+ * @returns void
+ */
+void Heap::collect() {
+    if (stack_base == nullptr) return;
+    auto start = std::chrono::steady_clock::now();
+    ProfScope scope;
+    if (Profiler::enabled) scope.enter(Profiler::GC_ID);
+
+    // Spill callee-saved registers so that pointers held only in registers
+    // are seen by the stack scan
+    __builtin_unwind_init();
+
+    std::sort(objects.begin(), objects.end());
+    arena_ranges.clear();
+    for (Arena *arena : arenas)
+        for (Arena::Chunk &chunk : arena->chunks)
+            arena_ranges.push_back({ chunk.data, chunk.data + chunk.used,
+                                     arena });
+    std::sort(arena_ranges.begin(), arena_ranges.end(),
+        [](const ArenaRange &a, const ArenaRange &b) { return a.lo < b.lo; });
+
+    for (Env *root : roots) mark(root);
+    scan_stack();
+    while (!gray.empty()) {
+        GCHeader *header = gray.back();
+        gray.pop_back();
+        trace(header);
+    }
+    sweep();
+    released_bytes = 0;
+    threshold = std::max(GC_MIN_THRESHOLD, 2 * bytes);
+
+    double pause = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+    stats.collections++;
+    stats.last_pause_ms = pause;
+    stats.max_pause_ms = std::max(stats.max_pause_ms, pause);
+    stats.total_pause_ms += pause;
+}
+
+/*============================================================================
+ *  Getters
+ *===========================================================================*/
+const GCStats &Heap::get_stats() {
+    stats.live_objects = objects.size();
+    stats.live_bytes = bytes;
+    stats.live_arenas = arenas.size();
+    stats.arena_bytes = 0;
+    for (Arena *arena : arenas) stats.arena_bytes += arena->bytes;
+    return stats;
+}
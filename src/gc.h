@@ -0,0 +1,164 @@
+/*============================================================================
+ *  nanoscheme
+ *  Copyright (c) 2019-2020 - Trung Truong
+ *
+ *  File name: gc.h
+ *  Description: Header file for `Heap` class, a mark-sweep garbage
+ *  collector for `Expr`, `Env` and list objects
+ *
+ *==========================================================================*/
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+#ifndef GC_H_
+#define GC_H_
+
+/* Forward-declartion of collected classes */
+class Expr;
+class Env;
+class Arena;
+struct Code;
+
+/*============================================================================
+ *  Object header
+ *===========================================================================*/
+enum class GCKind : uint8_t { EXPR, ENV, LIST, ARRAY, CODE };
+
+/**
+ * Every collected object is preceded by a 16 byte header, so the object
+ * that follows it keeps malloc alignment. `arena` is set for nodes that
+ * live in an `Arena` rather than directly on the heap.
+ */
+struct GCHeader {
+    GCKind kind;
+    bool marked;
+    uint32_t size;
+    Arena *arena;
+};
+static const size_t GC_HEADER_SIZE = 16;
+
+struct GCStats {
+    size_t collections;
+    size_t allocated_objects;
+    size_t allocated_bytes;
+    size_t freed_objects;
+    size_t live_objects;
+    size_t live_bytes;
+    size_t live_arenas;
+    size_t arena_bytes;
+    size_t peak_bytes;
+    double last_pause_ms;
+    double max_pause_ms;
+    double total_pause_ms;
+};
+
+/* Objects allocated by a thread of a `Pool` while it runs a job */
+struct GCLocal {
+    std::vector<GCHeader*> objects;
+    size_t bytes;
+
+    GCLocal() : objects({}), bytes(0) {}
+};
+
+/*============================================================================
+ *  Heap class
+ *===========================================================================*/
+class Heap {
+private:
+    struct ArenaRange { char *lo; char *hi; Arena *arena; };
+
+    std::vector<GCHeader*> objects;
+    std::vector<GCHeader*> gray;
+    std::vector<Env*> roots;
+    std::vector<Arena*> arenas;
+    std::vector<ArenaRange> arena_ranges;
+    size_t bytes;
+    size_t released_bytes;
+    size_t threshold;
+    void *stack_base;
+    std::atomic<size_t> paused;
+    std::mutex merge_lock;
+    GCStats stats;
+
+    /* Mark phase */
+    void mark(void *obj);
+    void mark_arena(Arena *arena);
+    void trace(GCHeader *header);
+    void scan_stack();
+    void scan_range(char *lo, char *hi);
+
+    /* Sweep phase */
+    void sweep();
+    void destroy(GCHeader *header);
+
+public:
+    /* Constructors */
+    Heap();
+    ~Heap();
+    static Heap &current();
+
+    /* Roots */
+    void set_stack_base(void *base);
+    void add_root(Env *env);
+    void remove_root(Env *env);
+    static void clear_stack();
+
+    /* Threads. Collection is paused while other threads allocate. */
+    void pause();
+    void resume();
+    void attach_thread(GCLocal *local);
+    void detach_thread();
+    static bool is_attached();
+
+    /* Allocation and collection */
+    void *allocate(GCKind kind, size_t size);
+    void safepoint();
+    bool collection_due();
+    Arena *new_arena();
+    void release_arena(Arena *arena);
+    void add_external(size_t size);
+    void collect();
+
+    /* Getters */
+    const GCStats &get_stats();
+};
+
+/* Pauses collection for as long as it is in scope */
+class GCPause {
+public:
+    GCPause()   { Heap::current().pause(); }
+    ~GCPause()  { Heap::current().resume(); }
+};
+
+/*============================================================================
+ *  Allocation helpers
+ *===========================================================================*/
+template <typename T> struct GCKindOf;
+template <> struct GCKindOf<Expr> {
+    static const GCKind kind = GCKind::EXPR;
+};
+template <> struct GCKindOf<Env> {
+    static const GCKind kind = GCKind::ENV;
+};
+template <> struct GCKindOf<std::vector<Expr*>> {
+    static const GCKind kind = GCKind::LIST;
+};
+
+/**
+ * Allocate and construct a collected object on the current heap. The
+ * arguments are evaluated before the heap is touched, so a collection
+ * triggered by this allocation never sees a half-built object.
+ * @param args Constructor arguments
+ * @returns Pointer to the new object
+ */
+template <typename T, typename... Args>
+T *gc_new(Args&&... args) {
+    void *mem = Heap::current().allocate(GCKindOf<T>::kind, sizeof(T));
+    return new (mem) T(std::forward<Args>(args)...);
+}
+
+#endif
@@ -0,0 +1,173 @@
+/*============================================================================
+ *  nanoscheme
+ *  Copyright (c) 2019-2020 - Trung Truong
+ *
+ *  File name: hashtable.cpp
+ *  Description: Implementation of `HashTable` class
+ *
+ *  Tables grow by doubling once they are 7/8 full, which Robin Hood
+ *  probing keeps fast. Hashes of immediate integers are mixed directly,
+ *  anything else is hashed by `Memo::hash_value` and mixed, since slots
+ *  are picked by the low bits of the hash and hashes of integers and
+ *  symbols are not spread across them.
+ *
+ *==========================================================================*/
+#include <cstdlib>
+#include <utility>
+#include "gc.h"
+#include "hashtable.h"
+#include "memo.h"
+
+static const size_t MIN_CAPACITY = 8;
+
+/**
+ * Spread the bits of a hash, the finalizer of MurmurHash3
+ * @param h Hash
+ * @returns Mixed hash
+ */
+static inline uint64_t mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+uint32_t HashTable::hash_key(Value key) {
+    if (key.is_int()) return uint32_t(mix(uint64_t(key.ival())));
+    return uint32_t(mix(Memo::hash_value(key)));
+}
+
+static inline bool same_key(Value a, Value b) {
+    if (a.is_int() && b.is_int()) return a.ival() == b.ival();
+    return Memo::equal_values(a, b);
+}
+
+/* Constructors */
+HashTable::HashTable() : slots(nullptr), capacity(0), count(0) {}
+
+HashTable::~HashTable() {
+    free(slots);
+}
+
+/*============================================================================
+ *  Probing
+ *===========================================================================*/
+/**
+ * Find the slot of a key
+ * @param key Key
+ * @param hash Hash of the key
+ * @returns Pointer to the slot, or nullptr if the key is not in the table
+ */
+HashTable::Slot *HashTable::find(Value key, uint32_t hash) const {
+    if (count == 0) return nullptr;
+    size_t mask = capacity - 1;
+    size_t i = hash & mask;
+    for (uint32_t dist = 1; ; dist++, i = (i + 1) & mask) {
+        Slot &s = slots[i];
+        if (s.dist < dist) return nullptr;
+        if (s.hash == hash && same_key(s.key, key)) return &s;
+    }
+}
+
+/**
+ * Place an entry whose key is not in the table yet. Entries closer to
+ * their home slot than the one being placed give up their slot to it and
+ * are placed further on.
+ * @param entry Entry, with its distance set to 1
+ * @returns void
+ */
+void HashTable::place(Slot entry) {
+    size_t mask = capacity - 1;
+    size_t i = entry.hash & mask;
+    for (;; entry.dist++, i = (i + 1) & mask) {
+        Slot &s = slots[i];
+        if (s.dist == 0) {
+            s = entry;
+            return;
+        }
+        if (s.dist < entry.dist) std::swap(s, entry);
+    }
+}
+
+/**
+ * Double the number of slots and place every entry again
+ * @returns void
+ */
+void HashTable::grow() {
+    size_t old_capacity = capacity;
+    Slot *old_slots = slots;
+    size_t new_capacity = capacity == 0 ? MIN_CAPACITY : 2 * capacity;
+
+    // Empty slots are all zero bits: unbound key and value, distance 0
+    Slot *new_slots = static_cast<Slot*>(calloc(new_capacity, sizeof(Slot)));
+    if (new_slots == nullptr) throw "Can't grow hash table";
+    slots = new_slots;
+    capacity = new_capacity;
+    Heap::current().add_external(new_capacity * sizeof(Slot));
+
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old_slots[i].dist == 0) continue;
+        Slot entry = old_slots[i];
+        entry.dist = 1;
+        place(entry);
+    }
+    free(old_slots);
+}
+
+/*============================================================================
+ *  Entries
+ *===========================================================================*/
+/**
+ * Look a key up
+ * @param key Key
+ * @param value Value bound to the key
+ * @returns False if the key is not in the table
+ */
+bool HashTable::get(Value key, Value &value) const {
+    Slot *s = find(key, hash_key(key));
+    if (s == nullptr) return false;
+    value = s->value;
+    return true;
+}
+
+/**
+ * Bind a key to a value, replacing the value it was bound to
+ * @param key Key
+ * @param value Value
+ * @returns void
+ */
+void HashTable::set(Value key, Value value) {
+    uint32_t hash = hash_key(key);
+    Slot *s = find(key, hash);
+    if (s != nullptr) {
+        s->value = value;
+        return;
+    }
+    if ((count + 1) * 8 > capacity * 7) grow();
+    place(Slot { key, value, hash, 1 });
+    count++;
+}
+
+/**
+ * Remove a key. The entries after it that are not in their home slot are
+ * shifted back by one.
+ * @param key Key
+ * @returns False if the key was not in the table
+ */
+bool HashTable::remove(Value key) {
+    Slot *s = find(key, hash_key(key));
+    if (s == nullptr) return false;
+
+    size_t mask = capacity - 1;
+    size_t i = s - slots;
+    for (size_t j = (i + 1) & mask; slots[j].dist > 1; j = (j + 1) & mask) {
+        slots[i] = slots[j];
+        slots[i].dist--;
+        i = j;
+    }
+    slots[i] = Slot { Value(), Value(), 0, 0 };
+    count--;
+    return true;
+}
@@ -0,0 +1,77 @@
+/*============================================================================
+ *  nanoscheme
+ *  Copyright (c) 2019-2020 - Trung Truong
+ *
+ *  File name: hashtable.h
+ *  Description: Header file for `HashTable` class, the mutable hash tables
+ *  of Scheme programs
+ *
+ *==========================================================================*/
+#include <cstddef>
+#include <cstdint>
+
+#include "value.h"
+#ifndef HASHTABLE_H_
+#define HASHTABLE_H_
+
+/*============================================================================
+ *  HashTable class
+ *===========================================================================*/
+/**
+ * Open-addressing hash table with Robin Hood probing. Entries live in one
+ * flat array of slots, each holding the key, the value, the hash of the
+ * key and the distance of the slot from the one the hash points to. An
+ * insert takes the slot of any entry closer to its own, so a lookup stops
+ * as soon as it meets an entry closer than it has probed, and a removal
+ * shifts the entries after it back instead of leaving a tombstone.
+ *
+ * Keys are compared by contents, like the arguments of 'define-memo':
+ * numbers of different types are different keys. Values are traced by the
+ * collector through the `HASH` expression holding the table. Tables are
+ * not synchronized, so parallel procedures must not update them.
+ */
+class HashTable {
+private:
+    struct Slot {
+        Value key;
+        Value value;
+        uint32_t hash;
+        uint32_t dist;                  // 1 + probe distance, 0 if empty
+    };
+
+    Slot *slots;
+    size_t capacity;                    // Power of two, or 0
+    size_t count;
+
+    void grow();
+    void place(Slot entry);
+    Slot *find(Value key, uint32_t hash) const;
+
+public:
+    /* Constructors */
+    HashTable();
+    ~HashTable();
+    HashTable(const HashTable &) = delete;
+    HashTable &operator=(const HashTable &) = delete;
+
+    /* Entries */
+    size_t size() const { return count; }
+    bool get(Value key, Value &value) const;
+    void set(Value key, Value value);
+    bool remove(Value key);
+
+    /**
+     * Call a function on every entry, in no particular order
+     * @param f Function taking a key and a value
+     * @returns void
+     */
+    template <typename F>
+    void for_each(F f) const {
+        for (size_t i = 0; i < capacity; i++)
+            if (slots[i].dist != 0) f(slots[i].key, slots[i].value);
+    }
+
+    static uint32_t hash_key(Value key);
+};
+
+#endif
@@ -0,0 +1,456 @@
+/*============================================================================
+ *  nanoscheme
+ *  Copyright (c) 2019-2020 - Trung Truong
+ *
+ *  File name: lexer.cpp
+ *  Description: Implementation of `TokenStream` class
+ *
+ *==========================================================================*/
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "lexer.h"
+
+/* Constructors */
+TokenStream::TokenStream(std::string source)
+    : src(std::move(source)), lexed({}), tokens(nullptr), num_tokens(0),
+      mapping(nullptr), mapping_size(0), cursor(0) {
+    tokenize();
+}
+
+/**
+ * Take the tokens from a cache file if it was written for this exact
+ * source, else lex the source and write the cache file for the next run.
+ * A cache file that can not be read or written is ignored.
+ * @param source Source
+ * @param cache_path Path of the cache file, or empty for no cache
+ */
+TokenStream::TokenStream(std::string source, const std::string &cache_path)
+    : src(std::move(source)), lexed({}), tokens(nullptr), num_tokens(0),
+      mapping(nullptr), mapping_size(0), cursor(0) {
+    if (!cache_path.empty() && load_cache(cache_path)) return;
+    tokenize();
+    if (!cache_path.empty()) save_cache(cache_path);
+}
+
+/* Destructor */
+TokenStream::~TokenStream() {
+    if (mapping != nullptr) munmap(mapping, mapping_size);
+}
+
+/*============================================================================
+ *  Lexer
+ *===========================================================================*/
+/**
+ * Find the line number of a source offset. Only used for error reporting.
+ * @param pos Offset in source string
+ * @returns 1-based line number
+ */
+size_t TokenStream::line_of(size_t pos) {
+    size_t line = 1;
+    for (size_t i = 0; i < pos && i < src.size(); i++)
+        if (src[i] == '\n') line++;
+    return line;
+}
+
+/**
+ * Walk the source exactly once and split it into tokens. Brackets are
+ * matched with a stack so each `LPAREN`/`QUOTE` token knows where its form
+ * ends. Exception is thrown if the source has unmatching brackets or quotes.
+ * @returns void
+ */
+void TokenStream::tokenize() {
+    std::vector<size_t> bracket_stack {};
+    size_t idx = 0;
+
+    while (idx < src.size()) {
+        char c = src[idx];
+
+        if (isspace(static_cast<unsigned char>(c))) {
+            idx++;
+        }
+        else if (c == ';') {
+            while (idx < src.size() && src[idx] != '\n') idx++;
+        }
+        else if (c == '(') {
+            bracket_stack.push_back(lexed.size());
+            lexed.push_back({ TokType::LPAREN, idx, 1, 0 });
+            idx++;
+        }
+        else if (c == ')') {
+            if (bracket_stack.empty())
+                throw "Unmatching ')' at line " + std::to_string(line_of(idx));
+
+            size_t open = bracket_stack.back();
+            bracket_stack.pop_back();
+            lexed.push_back({ TokType::RPAREN, idx, 1, lexed.size() + 1 });
+            lexed[open].end = lexed.size();
+            if (open > 0 && lexed[open - 1].type == TokType::QUOTE)
+                lexed[open - 1].end = lexed.size();
+            idx++;
+        }
+        else if (c == '\'' && idx + 1 < src.size() && src[idx + 1] == '(') {
+            lexed.push_back({ TokType::QUOTE, idx, 1, 0 });
+            idx++;
+        }
+        else if (c == '\"') {
+            size_t close = src.find('\"', idx + 1);
+            if (close == std::string::npos) {
+                throw "Unmatching quote at line " +
+                      std::to_string(line_of(idx));
+            }
+
+            size_t len = close - idx + 1;
+            lexed.push_back({ TokType::STRING, idx, len, lexed.size() + 1 });
+            idx += len;
+        }
+        else {
+            size_t start = idx;
+            while (idx < src.size() && src[idx] != '(' && src[idx] != ')' &&
+                   !isspace(static_cast<unsigned char>(src[idx])))
+                idx++;
+            lexed.push_back({ TokType::ATOM, start, idx - start,
+                               lexed.size() + 1 });
+        }
+    }
+    if (!bracket_stack.empty()) {
+        size_t pos = lexed[bracket_stack.back()].pos;
+        throw "Unmatching brackets at line " + std::to_string(line_of(pos));
+    }
+    tokens = lexed.data();
+    num_tokens = lexed.size();
+}
+
+/*============================================================================
+ *  Top-level form iterator
+ *===========================================================================*/
+bool TokenStream::has_next() {
+    return cursor < num_tokens;
+}
+
+/**
+ * Advance to the next top-level form
+ * @returns Token index of the form that starts at the cursor
+ */
+size_t TokenStream::next() {
+    size_t idx = cursor;
+    cursor = tokens[idx].end;
+    return idx;
+}
+
+/*============================================================================
+ *  Token accessors
+ *===========================================================================*/
+const Token &TokenStream::at(size_t idx) {
+    return tokens[idx];
+}
+
+/**
+ * Collect the direct sub-forms of a bracketed form
+ * @param idx Token index of an `LPAREN` or `QUOTE` token
+ * @returns Token indices of every sub-form, in order
+ */
+std::vector<size_t> TokenStream::children(size_t idx) {
+    if (tokens[idx].type == TokType::QUOTE) idx++;
+
+    std::vector<size_t> res {};
+    size_t close = tokens[idx].end - 1;
+    for (size_t i = idx + 1; i < close; i = tokens[i].end)
+        res.push_back(i);
+    return res;
+}
+
+/**
+ * Copy the source text of a form out of the stream
+ * @param idx Token index
+ * @returns Source text of the token, or of the whole form for brackets
+ */
+std::string TokenStream::text(size_t idx) {
+    const Token &tok = tokens[idx];
+    if (tok.type != TokType::LPAREN && tok.type != TokType::QUOTE)
+        return src.substr(tok.pos, tok.len);
+
+    const Token &last = tokens[tok.end - 1];
+    return src.substr(tok.pos, last.pos + last.len - tok.pos);
+}
+
+/*============================================================================
+ *  Token cache
+ *
+ *  A cache file is a header followed by the tokens of the source, as they
+ *  are laid out in memory. It is keyed by a hash of the source, so editing
+ *  the source makes it stale, and by a version derived from the build: the
+ *  layout of `Token`, the number of token types and `NSCM_BUILD_ID`, which
+ *  the Makefile sets to a checksum of the sources of the interpreter. A
+ *  cache is thus only read by the build that wrote it.
+ *===========================================================================*/
+#ifndef NSCM_BUILD_ID
+#define NSCM_BUILD_ID 0
+#endif
+
+static const char CACHE_MAGIC[8] = { 'N', 'S', 'C', 'M', 'T', 'O', 'K', 0 };
+static const size_t NUM_TOK_TYPES = size_t(TokType::ATOM) + 1;
+
+struct CacheHeader {
+    char magic[8];
+    uint64_t version;
+    uint64_t src_hash;
+    uint64_t src_size;
+    uint64_t num_tokens;
+};
+
+/**
+ * Get the version of the cache files of this build
+ * @returns Hash of the token layout and the build id
+ */
+static uint64_t cache_version() {
+    const uint64_t parts[] = {
+        sizeof(Token), offsetof(Token, pos), offsetof(Token, len),
+        offsetof(Token, end), NUM_TOK_TYPES, uint64_t(NSCM_BUILD_ID)
+    };
+    uint64_t h = 14695981039346656037ull;
+    for (uint64_t part : parts) {
+        h ^= part;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+/* 64-bit FNV-1a hash of the source */
+static uint64_t hash_source(const std::string &src) {
+    uint64_t h = 14695981039346656037ull;
+    for (unsigned char c : src) {
+        h ^= c;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+/**
+ * Check that the tokens of a cache file are shaped the way `tokenize`
+ * shapes them, so a corrupt file can not make the parser read out of
+ * bounds: every token lies within the source, atoms, strings and closing
+ * brackets end right after themselves, every `LPAREN` ends after the
+ * `RPAREN` that closes it and forms nest, and every `QUOTE` is followed by
+ * an `LPAREN` that ends where it does
+ * @param toks Tokens
+ * @param n Number of tokens
+ * @param src_size Size of the source
+ * @returns True if the tokens are well-formed
+ */
+static bool valid_tokens(const Token *toks, size_t n, size_t src_size) {
+    std::vector<size_t> open {};       // `end - 1` of the open brackets
+    for (size_t i = 0; i < n; i++) {
+        const Token &tok = toks[i];
+        if (size_t(tok.type) >= NUM_TOK_TYPES) return false;
+        if (tok.pos > src_size || tok.len > src_size - tok.pos) return false;
+        if (tok.end <= i || tok.end > n) return false;
+
+        switch (tok.type) {
+            case TokType::QUOTE:
+                if (i + 1 >= n || toks[i + 1].type != TokType::LPAREN ||
+                    toks[i + 1].end != tok.end)
+                    return false;
+                break;
+            case TokType::LPAREN:
+                if (tok.end < i + 2 ||
+                    toks[tok.end - 1].type != TokType::RPAREN)
+                    return false;
+                if (!open.empty() && tok.end - 1 >= open.back())
+                    return false;
+                open.push_back(tok.end - 1);
+                break;
+            case TokType::RPAREN:
+                if (open.empty() || open.back() != i) return false;
+                open.pop_back();
+                if (tok.end != i + 1) return false;
+                break;
+            default:
+                if (tok.end != i + 1) return false;
+                break;
+        }
+    }
+    return open.empty();
+}
+
+/**
+ * Map a cache file and use its tokens if it was written for the source
+ * @param path Path of the cache file
+ * @returns True if the tokens were taken from the cache file
+ */
+bool TokenStream::load_cache(const std::string &path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(CacheHeader)) {
+        close(fd);
+        return false;
+    }
+    size_t size = size_t(st.st_size);
+    void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return false;
+
+    const CacheHeader *header = static_cast<const CacheHeader*>(data);
+    const Token *toks = reinterpret_cast<const Token*>(header + 1);
+    size_t max_tokens = (size - sizeof(CacheHeader)) / sizeof(Token);
+    if (std::memcmp(header->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+        header->version != cache_version() ||
+        header->num_tokens != max_tokens ||
+        size != sizeof(CacheHeader) + max_tokens * sizeof(Token) ||
+        header->src_size != src.size() ||
+        header->src_hash != hash_source(src) ||
+        !valid_tokens(toks, max_tokens, src.size())) {
+        munmap(data, size);
+        return false;
+    }
+
+    mapping = data;
+    mapping_size = size;
+    tokens = toks;
+    num_tokens = max_tokens;
+    return true;
+}
+
+/**
+ * Write the lexed tokens to a cache file. The file is written under a
+ * temporary name and renamed, so a concurrent run never maps half of it.
+ * @param path Path of the cache file
+ * @returns void
+ */
+void TokenStream::save_cache(const std::string &path) {
+    CacheHeader header;
+    std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = cache_version();
+    header.src_hash = hash_source(src);
+    header.src_size = src.size();
+    header.num_tokens = num_tokens;
+
+    std::string tmp_path = path + ".tmp" + std::to_string(getpid());
+    std::ofstream f(tmp_path, std::ios::binary | std::ios::trunc);
+    if (!f.is_open()) return;
+    f.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    f.write(reinterpret_cast<const char*>(tokens),
+            std::streamsize(num_tokens * sizeof(Token)));
+    f.close();
+    if (!f || std::rename(tmp_path.c_str(), path.c_str()) != 0)
+        std::remove(tmp_path.c_str());
+}
+
+/*============================================================================
+ *  FormReader class
+ *===========================================================================*/
+/* Bytes read from the stream at a time */
+static const size_t READ_CHUNK_SIZE = 64 * 1024;
+
+/* Constructors */
+FormReader::FormReader(std::istream &input)
+    : in(input), buf(), scanned(0), complete(0), state(State::SPACE),
+      open_lines({}), string_line(0), line(1), eof(false) {}
+
+void FormReader::read_chunk() {
+    size_t old_size = buf.size();
+    buf.resize(old_size + READ_CHUNK_SIZE);
+    in.read(&buf[old_size], READ_CHUNK_SIZE);
+    buf.resize(old_size + size_t(in.gcount()));
+    if (!in) eof = true;
+}
+
+/**
+ * Scan the unscanned part of the buffer, keeping track of the end of the
+ * last complete top-level form. Tokens are told apart as in `tokenize`.
+ * @returns void
+ */
+void FormReader::scan() {
+    size_t i = scanned;
+    for (; i < buf.size(); i++) {
+        char c = buf[i];
+        bool space = isspace(static_cast<unsigned char>(c));
+        if (c == '\n') line++;
+
+        if (state == State::COMMENT) {
+            if (c == '\n') state = State::SPACE;
+            continue;
+        }
+        if (state == State::STRING) {
+            if (c != '\"') continue;
+            state = State::SPACE;
+            if (open_lines.empty()) complete = i + 1;
+            continue;
+        }
+        if (state == State::ATOM) {
+            if (c != '(' && c != ')' && !space) continue;
+            state = State::SPACE;
+            if (open_lines.empty()) complete = i;
+        }
+
+        // Start of a token
+        if (space) continue;
+        if (c == ';') {
+            state = State::COMMENT;
+        }
+        else if (c == '(') {
+            open_lines.push_back(line);
+        }
+        else if (c == ')') {
+            if (open_lines.empty())
+                throw "Unmatching ')' at line " + std::to_string(line);
+            open_lines.pop_back();
+            if (open_lines.empty()) complete = i + 1;
+        }
+        else if (c == '\'') {
+            // A quote only quotes a bracket right after it, which may not
+            // have been read yet
+            if (i + 1 == buf.size() && !eof) break;
+            if (i + 1 == buf.size() || buf[i + 1] != '(')
+                state = State::ATOM;
+        }
+        else if (c == '\"') {
+            state = State::STRING;
+            string_line = line;
+        }
+        else {
+            state = State::ATOM;
+        }
+    }
+    scanned = i;
+}
+
+/**
+ * Read up to the end of the next complete top-level forms
+ * @param batch Reference to the source of the forms
+ * @returns False once the stream is exhausted
+ */
+bool FormReader::next(std::string &batch) {
+    while (complete == 0) {
+        if (eof) {
+            if (state == State::STRING)
+                throw "Unmatching quote at line " +
+                      std::to_string(string_line);
+            if (!open_lines.empty())
+                throw "Unmatching brackets at line " +
+                      std::to_string(open_lines.back());
+            if (state == State::ATOM) {
+                state = State::SPACE;
+                complete = buf.size();
+            }
+            if (complete == 0) return false;
+            break;
+        }
+        read_chunk();
+        scan();
+    }
+
+    batch = buf.substr(0, complete);
+    buf.erase(0, complete);
+    scanned -= complete;
+    complete = 0;
+    return true;
+}
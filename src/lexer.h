@@ -0,0 +1,112 @@
+/*============================================================================
+ *  nanoscheme
+ *  Copyright (c) 2019-2020 - Trung Truong
+ *
+ *  File name: lexer.h
+ *  Description: Header file for `TokenStream` class
+ *
+ *==========================================================================*/
+#include <cstddef>
+#include <istream>
+#include <string>
+#include <vector>
+#ifndef LEXER_H_
+#define LEXER_H_
+
+/*============================================================================
+ *  Tokens
+ *===========================================================================*/
+enum class TokType { LPAREN, RPAREN, QUOTE, STRING, ATOM };
+
+/**
+ * A token is a slice `[pos, pos + len)` of the source text, nothing is
+ * copied out of the source while lexing. `end` is the index of the token
+ * right after this form: for `LPAREN` and `QUOTE` it points past the
+ * matching `RPAREN`, so a whole sub-form can be skipped in O(1).
+ */
+struct Token {
+    TokType type;
+    size_t pos;
+    size_t len;
+    size_t end;
+};
+
+/*============================================================================
+ *  TokenStream class
+ *===========================================================================*/
+/**
+ * Tokens are either lexed from the source or mapped from a cache file
+ * written by an earlier run, see `TokenStream(std::string, std::string)`.
+ * Tokens only hold offsets, so mapped ones are used in place.
+ */
+class TokenStream {
+private:
+    std::string src;
+    std::vector<Token> lexed;
+    const Token *tokens;
+    size_t num_tokens;
+    void *mapping;
+    size_t mapping_size;
+    size_t cursor;
+
+    void tokenize();
+    size_t line_of(size_t pos);
+
+    /* Token cache */
+    bool load_cache(const std::string &path);
+    void save_cache(const std::string &path);
+
+public:
+    /* Constructors */
+    TokenStream(std::string source);
+    TokenStream(std::string source, const std::string &cache_path);
+    TokenStream(const TokenStream &) = delete;
+    TokenStream &operator=(const TokenStream &) = delete;
+    ~TokenStream();
+
+    /* Top-level form iterator */
+    bool has_next();
+    size_t next();
+
+    /* Token accessors */
+    const Token &at(size_t idx);
+    std::vector<size_t> children(size_t idx);
+    std::string text(size_t idx);
+};
+
+/*============================================================================
+ *  FormReader class
+ *===========================================================================*/
+/**
+ * Reads a source from a stream in chunks and hands it out in batches of
+ * complete top-level forms, split by the same rules as the lexer, so that
+ * the forms of a batch are evaluated before the rest is read. Only the
+ * form being read is buffered beyond the current batch. Bracket and quote
+ * errors are reported with the line in the whole source.
+ */
+class FormReader {
+private:
+    enum class State { SPACE, ATOM, STRING, COMMENT };
+
+    std::istream &in;
+    std::string buf;
+    size_t scanned;                 // Offset up to which `buf` was scanned
+    size_t complete;                // End of the last complete form
+    State state;
+    std::vector<size_t> open_lines; // Lines of the open brackets
+    size_t string_line;
+    size_t line;
+    bool eof;
+
+    void read_chunk();
+    void scan();
+
+public:
+    /* Constructors */
+    FormReader(std::istream &input);
+
+    /* Batch iterator */
+    bool next(std::string &batch);
+};
+
+#endif
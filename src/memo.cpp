@@ -0,0 +1,190 @@
+/*============================================================================
+ *  nanoscheme
+ *  Copyright (c) 2019-2020 - Trung Truong
+ *
+ *  File name: memo.cpp
+ *  Description: Implementation of `Memo` class
+ *
+ *  The lambda of a 'define-memo' is built like any other, then its body is
+ *  wrapped in a `MEMO` expression holding the cache. Recursive calls look
+ *  the procedure up by name, so they go through the cache as well, and
+ *  naive recursions such as `fib` evaluate each distinct argument once.
+ *  Cached arguments and results are traced by the collector through the
+ *  `MEMO` expression.
+ *
+ *==========================================================================*/
+#include <cstring>
+#include <functional>
+#include "memo.h"
+
+size_t Memo::capacity = 4096;
+std::atomic<size_t> Memo::hits(0);
+std::atomic<size_t> Memo::misses(0);
+std::atomic<size_t> Memo::evictions(0);
+
+/* Constructors */
+Memo::Memo(Expr *b) : body(b), entries(), index(), lock() {}
+
+/*============================================================================
+ *  Structural hashing
+ *===========================================================================*/
+static inline size_t hash_combine(size_t seed, size_t h) {
+    return seed ^ (h + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2));
+}
+
+/**
+ * Hash a value by its contents. Lists, strings and big integers hash their
+ * elements, procedures and anything else their address.
+ * @param v Value
+ * @returns Hash, equal for values that `equal_values` considers equal
+ */
+size_t Memo::hash_value(Value v) {
+    ExpType t = v.type();
+    size_t h = static_cast<size_t>(t);
+    switch (t) {
+        case ExpType::INT:
+            return hash_combine(h, std::hash<int64_t>()(v.ival()));
+        case ExpType::FLOAT: {
+            uint64_t raw;
+            double f = v.fval();
+            std::memcpy(&raw, &f, sizeof(raw));
+            return hash_combine(h, std::hash<uint64_t>()(raw));
+        }
+        case ExpType::LIT:
+            return hash_combine(h, static_cast<size_t>(v.lit()));
+        case ExpType::BIGINT:
+            return hash_combine(h, std::hash<double>()(
+                v.obj()->get_bigint().to_double()));
+        case ExpType::STRING:
+            return hash_combine(h, v.obj()->sval.hash());
+        case ExpType::SYMBOL:
+            return hash_combine(h, std::hash<const Symbol*>()(
+                v.obj()->get_symbol()));
+        case ExpType::LIST:
+            for (ListCursor c(v.obj()); !c.done(); c.next())
+                h = hash_combine(h, hash_value(c.get()));
+            return h;
+        default:
+            return hash_combine(h, std::hash<Expr*>()(v.obj()));
+    }
+}
+
+/**
+ * Compare two values by their contents, see `hash_value`. Numbers of
+ * different types are different arguments, as `1` and `1.0` may give
+ * different results.
+ * @param a Value
+ * @param b Value
+ * @returns True if the values are equal
+ */
+bool Memo::equal_values(Value a, Value b) {
+    ExpType t = a.type();
+    if (t != b.type()) return false;
+    switch (t) {
+        case ExpType::INT:      return a.ival() == b.ival();
+        case ExpType::FLOAT: {
+            double x = a.fval(), y = b.fval();
+            return std::memcmp(&x, &y, sizeof(x)) == 0;
+        }
+        case ExpType::LIT:      return a.lit() == b.lit();
+        case ExpType::BIGINT:
+            return BigInt::compare(a.obj()->get_bigint(),
+                                   b.obj()->get_bigint()) == 0;
+        case ExpType::STRING:
+            return a.obj()->sval == b.obj()->sval;
+        case ExpType::SYMBOL:
+            return a.obj()->get_symbol() == b.obj()->get_symbol();
+        case ExpType::LIST: {
+            ListCursor x(a.obj()), y(b.obj());
+            for (; !x.done() && !y.done(); x.next(), y.next())
+                if (!equal_values(x.get(), y.get())) return false;
+            return x.done() && y.done();
+        }
+        default:                return a.obj() == b.obj();
+    }
+}
+
+/*============================================================================
+ *  Cache
+ *===========================================================================*/
+/**
+ * Find the entry of some arguments. The caller holds the lock.
+ * @param hash Hash of the arguments
+ * @param args Arguments
+ * @returns Iterator to the entry, or to the end of `entries`
+ */
+Memo::EntryRef Memo::find(size_t hash, const std::vector<Value> &args) {
+    auto range = index.equal_range(hash);
+    for (auto itr = range.first; itr != range.second; itr++) {
+        const std::vector<Value> &other = itr->second->args;
+        if (other.size() != args.size()) continue;
+        size_t i = 0;
+        while (i < args.size() && equal_values(args[i], other[i])) i++;
+        if (i == args.size()) return itr->second;
+    }
+    return entries.end();
+}
+
+/**
+ * Cache the result of some arguments, evicting the least recently used
+ * entry if the cache is full
+ * @param hash Hash of the arguments
+ * @param args Arguments
+ * @param result Result of the body
+ * @returns void
+ */
+void Memo::insert(size_t hash, const std::vector<Value> &args,
+                  Value result) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (capacity == 0 || find(hash, args) != entries.end()) return;
+
+    if (entries.size() >= capacity) {
+        auto range = index.equal_range(entries.back().hash);
+        for (auto itr = range.first; itr != range.second; itr++) {
+            if (itr->second == std::prev(entries.end())) {
+                index.erase(itr);
+                break;
+            }
+        }
+        entries.pop_back();
+        evictions++;
+    }
+    entries.push_front({ hash, args, result });
+    index.emplace(hash, entries.begin());
+}
+
+/**
+ * Evaluate the body of a memoized procedure, unless the arguments of the
+ * call were seen before
+ * @param bindings pointer to vector containing argument bindings
+ * @param e pointer to the frame of the call
+ * @returns Result of the call
+ */
+Value Memo::call(std::vector<Value> *bindings, Env *e) {
+    const std::vector<Value> &args = e->slots;
+    size_t hash = 0;
+    for (const Value &arg : args) hash = hash_combine(hash, hash_value(arg));
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        EntryRef entry = find(hash, args);
+        if (entry != entries.end()) {
+            entries.splice(entries.begin(), entries, entry);
+            hits++;
+            return entry->result;
+        }
+    }
+
+    misses++;
+    Value result = body->eval(bindings, e);
+    insert(hash, args, result);
+    return result;
+}
+
+Expr *Memo::get_body() {
+    return body;
+}
+
+MemoStats Memo::get_stats() {
+    return { hits, misses, evictions };
+}
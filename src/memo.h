@@ -0,0 +1,79 @@
+/*============================================================================
+ *  nanoscheme
+ *  Copyright (c) 2019-2020 - Trung Truong
+ *
+ *  File name: memo.h
+ *  Description: Header file for `Memo` class, the result caches of
+ *  procedures defined with 'define-memo'
+ *
+ *==========================================================================*/
+#include <atomic>
+#include <cstddef>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "expr.h"
+#ifndef MEMO_H_
+#define MEMO_H_
+
+/* Lookups of every cache since the start of the program */
+struct MemoStats {
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+};
+
+/*============================================================================
+ *  Memo class
+ *===========================================================================*/
+/**
+ * Body of a memoized procedure. The arguments of a call are the slots of
+ * its frame; they are hashed and compared structurally, so equal lists or
+ * strings share an entry. At most `capacity` results are kept, the least
+ * recently used one is evicted first. The cache is only locked around
+ * lookups and inserts, the body itself runs unlocked, so a recursive call
+ * or another thread of a `Pool` may insert the same arguments first.
+ */
+class Memo {
+    friend class Heap;
+
+private:
+    struct Entry {
+        size_t hash;
+        std::vector<Value> args;
+        Value result;
+    };
+    typedef std::list<Entry>::iterator EntryRef;
+
+    Expr *body;
+    std::list<Entry> entries;           // Most recently used first
+    std::unordered_multimap<size_t, EntryRef> index;
+    std::mutex lock;
+
+    static std::atomic<size_t> hits;
+    static std::atomic<size_t> misses;
+    static std::atomic<size_t> evictions;
+
+    /* Helpers */
+    EntryRef find(size_t hash, const std::vector<Value> &args);
+    void insert(size_t hash, const std::vector<Value> &args, Value result);
+
+public:
+    /* Number of results kept per procedure, see `--memo-size` */
+    static size_t capacity;
+
+    /* Constructors */
+    Memo(Expr *b);
+
+    /* Evaluate the body in the frame of a call, or reuse its result */
+    Value call(std::vector<Value> *bindings, Env *e);
+    Expr *get_body();
+
+    static size_t hash_value(Value v);
+    static bool equal_values(Value a, Value b);
+    static MemoStats get_stats();
+};
+
+#endif
@@ -11,14 +11,35 @@
 #include <csignal>
 #include <cstring>
 #include "env.h"
+#include "arena.h"
+#include "batch.h"
+#include "counters.h"
 #include "expr.h"
+#include "gc.h"
+#include "memo.h"
+#include "optimizer.h"
 #include "parser.h"
+#include "pool.h"
+#include "profiler.h"
+#include "server.h"
+#include "vm.h"
+#include "writer.h"
 
 void terminate(int signum) {
     std::cout << "\nExiting..\n";
     exit(signum);
 }
 
+/**
+ * Print an error to stderr, after the results printed before it
+ * @param msg Error message
+ * @returns void
+ */
+void print_error(const std::string &msg) {
+    Writer::out().flush();
+    std::cerr << "ERR: " << msg << "\n";
+}
+
 /*============================================================================
  *  REPL implementation
  *===========================================================================*/
@@ -28,8 +49,9 @@ void terminate(int signum) {
  * @returns void
  */
 void repl(std::istream &in) {
-    std::unordered_map<std::string, Expr*> std_env_frame {};
-    Env global_env(std_env_frame);
+    Frame std_env_frame {};
+    Env *global_env = gc_new<Env>(std_env_frame);
+    Heap::current().add_root(global_env);
 
     while (true) {
         std::string expr_str;
@@ -38,85 +60,328 @@ void repl(std::istream &in) {
         if (expr_str.size() < 1) break;
         if (expr_str == "exit") break;
 
+        // Each line is its own compilation unit
+        Arena *arena = Heap::current().new_arena();
         try {
-            Expr *expr = build_AST(expr_str, &global_env);
-            if (expr->get_expr_type() == ExpType::PRIM)
-                expr->eval(NO_BINDING, &global_env).print_to_console();
-            else
-                expr->print_to_console();
-            std::cout << "\n";
+            TokenStream ts(expr_str);
+            while (ts.has_next()) {
+                Expr *expr = build_AST(ts, ts.next(), global_env, arena);
+                if (expr->get_expr_type() == ExpType::PRIM)
+                    expr->eval(NO_BINDING, global_env).print_to_console();
+                else
+                    expr->print_to_console();
+                Writer::out().put('\n');
+            }
         }
-        catch (const char* e)         { std::cerr << "ERR: " << e << "\n"; }
-        catch (const std::string &e)  { std::cerr << "ERR: " << e << "\n"; }
-        catch (...)                   { std::cerr << "Unexpected error\n"; }
+        catch (const char* e)         { print_error(e); }
+        catch (const std::string &e)  { print_error(e); }
+        catch (...) {
+            Writer::out().flush();
+            std::cerr << "Unexpected error\n";
+        }
+        Writer::out().flush();
+        arena->release();
+    }
+}
+
+/**
+ * Evaluate every top-level form of a token stream and print its result
+ * @param ts Token stream
+ * @param global_env Pointer to global env
+ * @param arena Arena of the compilation unit
+ * @returns void
+ */
+void eval_forms(TokenStream &ts, Env *global_env, Arena *arena) {
+    while (ts.has_next()) {
+        Expr *expr = build_AST(ts, ts.next(), global_env, arena);
+        if (expr->get_expr_type() == ExpType::PRIM)
+            expr->eval(NO_BINDING, global_env).print_to_console();
+        else
+            expr->print_to_console();
+        Writer::out().put('\n');
     }
 }
 
 /**
- * Evaluate .scm files
+ * Evaluate .scm files. Files are read in batches of forms, each evaluated
+ * before the next one is read, unless their tokens are cached.
  * @param num_files Number of input files
  * @param file_names Input files name. File must have .scm extension.
+ * @param cache Whether the tokens of each file are cached next to it, in a
+ * file of the same name with a `.scmc` extension
+ * @param global_env Pointer to global env
  * @returns void
  */
-void eval_files(int num_files, char* file_names[]) {
-    std::unordered_map<std::string, Expr*> std_env_frame {};
-    Env global_env(std_env_frame);
-
+void eval_files(int num_files, char* file_names[], bool cache,
+                Env *global_env) {
     for (int i = 1; i <= num_files; i++) {
         if (strstr(file_names[i], ".scm") == NULL) {
-            std::cerr << "ERR: File '" + std::string(file_names[i]) + 
-                         "' does not have a `.scm` extension.\n";
+            print_error("File '" + std::string(file_names[i]) +
+                        "' does not have a `.scm` extension.");
             exit(EXIT_FAILURE);
         }
 
         std::ifstream f(file_names[i]);
         if (f.is_open()) {
-            std::string expr((std::istreambuf_iterator<char>(f)),
-                              std::istreambuf_iterator<char>());
+            Arena *arena = nullptr;
             try {
-                std::vector<std::string> vec = parse_expr("(" + expr + ")");
-                for (auto &expr_str : vec) {
-                    Expr *expr = build_AST(expr_str, &global_env);
-                    if (expr->get_expr_type() == ExpType::PRIM)
-                        expr->eval(NO_BINDING, &global_env).print_to_console();
-                    else
-                        expr->print_to_console();
-                    std::cout << "\n";
+                if (cache) {
+                    // The cache is keyed by the whole source, so the file
+                    // is read at once and is a single compilation unit
+                    std::string expr((std::istreambuf_iterator<char>(f)),
+                                      std::istreambuf_iterator<char>());
+                    arena = Heap::current().new_arena();
+                    TokenStream ts(std::move(expr),
+                                   std::string(file_names[i]) + "c");
+                    eval_forms(ts, global_env, arena);
+                }
+                else {
+                    // Each batch is its own compilation unit. The AST of
+                    // a batch is freed once nothing defined in it is live.
+                    FormReader reader(f);
+                    std::string batch;
+                    while (reader.next(batch)) {
+                        if (arena != nullptr) arena->release();
+                        Heap::current().safepoint();
+                        arena = Heap::current().new_arena();
+                        TokenStream ts(std::move(batch));
+                        eval_forms(ts, global_env, arena);
+                        Writer::out().flush();
+                    }
                 }
                 f.close();
             }
-            catch (const char* e)        { std::cerr << "ERR: " << e << "\n"; }
-            catch (const std::string &e) { std::cerr << "ERR: " << e << "\n"; }
-            catch (...)                  { std::cerr << "Unexpected error\n"; }
+            catch (const char* e)        { print_error(e); }
+            catch (const std::string &e) { print_error(e); }
+            catch (...) {
+                Writer::out().flush();
+                std::cerr << "Unexpected error\n";
+            }
+            Writer::out().flush();
+            if (arena != nullptr) arena->release();
         }
         else {
-            std::cerr << "ERR: Can't open '" + std::string(file_names[i]) +
-                         "'\n";
+            print_error("Can't open '" + std::string(file_names[i]) + "'");
             exit(EXIT_FAILURE);
         }
     }
 }
+
+/**
+ * Evaluate .scm files concurrently, each in a global env of its own, and
+ * print their outputs in order, see `Batch`
+ * @param num_files Number of input files
+ * @param file_names Input files name. File must have .scm extension.
+ * @param cache Whether the tokens of each file are cached
+ * @param num_jobs Number of files evaluated at once, 0 for one per core
+ * @returns Number of files that failed
+ */
+size_t eval_files_parallel(int num_files, char* file_names[], bool cache,
+                           size_t num_jobs) {
+    for (int i = 1; i <= num_files; i++) {
+        if (strstr(file_names[i], ".scm") == NULL) {
+            print_error("File '" + std::string(file_names[i]) +
+                        "' does not have a `.scm` extension.");
+            exit(EXIT_FAILURE);
+        }
+    }
+    Batch batch(num_files, file_names, cache);
+    return batch.run(num_jobs);
+}
+
+/**
+ * Evaluate a prelude, then answer requests on a unix socket until the
+ * process is stopped, see `Server`
+ * @param path Path of the socket
+ * @param num_files Number of prelude files
+ * @param file_names Prelude files name
+ * @param cache Whether the tokens of prelude files are cached
+ * @param num_threads Number of threads evaluating requests, 0 for one per
+ * core
+ * @returns void
+ */
+void serve(const char *path, int num_files, char* file_names[], bool cache,
+           size_t num_threads) {
+    Frame std_env_frame {};
+    Env *global_env = gc_new<Env>(std_env_frame);
+    Heap::current().add_root(global_env);
+    eval_files(num_files, file_names, cache, global_env);
+    Writer::out().flush();
+
+    if (num_threads == 0)
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+    try {
+        Server server(path, global_env, num_threads);
+        std::cerr << "Listening on '" << path << "'\n";
+        server.run();
+    }
+    catch (const char* e)         { print_error(e); }
+    catch (const std::string &e)  { print_error(e); }
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * Print garbage collector statistics to stderr
+ * @returns void
+ */
+void print_gc_stats() {
+    const GCStats &stats = Heap::current().get_stats();
+    std::cerr << "GC collections:      " << stats.collections << "\n"
+              << "GC allocated:        " << stats.allocated_objects
+              << " objects, " << stats.allocated_bytes << " bytes\n"
+              << "GC freed:            " << stats.freed_objects
+              << " objects\n"
+              << "GC live heap:        " << stats.live_objects
+              << " objects, " << stats.live_bytes << " bytes\n"
+              << "GC live arenas:      " << stats.live_arenas
+              << " arenas, " << stats.arena_bytes << " bytes\n"
+              << "GC peak heap:        " << stats.peak_bytes << " bytes\n"
+              << "GC pause (ms):       total " << stats.total_pause_ms
+              << ", max " << stats.max_pause_ms
+              << ", last " << stats.last_pause_ms << "\n";
+}
+
+/**
+ * Print constant folding statistics to stderr
+ * @returns void
+ */
+void print_fold_stats() {
+    const OptStats &stats = Optimizer::get_stats();
+    std::cerr << "Fold primitives:     " << stats.folded << "\n"
+              << "Fold branches:       " << stats.pruned << "\n"
+              << "Fold eliminated:     " << stats.eliminated << " nodes\n";
+}
+
+/**
+ * Print memoization statistics to stderr
+ * @returns void
+ */
+void print_memo_stats() {
+    MemoStats stats = Memo::get_stats();
+    std::cerr << "Memo hits:           " << stats.hits << "\n"
+              << "Memo misses:         " << stats.misses << "\n"
+              << "Memo evictions:      " << stats.evictions << "\n";
+}
+
 /*============================================================================
  *  Main driver
  *===========================================================================*/
 int main(int argc, char*argv[]) {
     signal(SIGINT, terminate);
+    // Results are printed through `Writer`, which buffers on its own
+    std::ios::sync_with_stdio(false);
+    Heap::current().set_stack_base(__builtin_frame_address(0));
+
+    bool gc_stats = false;
+    bool fold_stats = false;
+    bool memo_stats = false;
+    bool eval_stats = false;
+    bool profile = false;
+    bool cache = false;
+    int status = EXIT_SUCCESS;
+    const char *serve_path = nullptr;
+    size_t num_threads = 0;
+    bool jobs = false;
+    size_t num_jobs = 0;
+    std::vector<char*> file_names { argv[0] };
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--gc-stats") == 0) gc_stats = true;
+        else if (strcmp(argv[i], "--vm") == 0) VM::enabled = true;
+        else if (strcmp(argv[i], "--no-fold") == 0)
+            Optimizer::enabled = false;
+        else if (strcmp(argv[i], "--fold-stats") == 0) fold_stats = true;
+        else if (strcmp(argv[i], "--memo-size") == 0 && i + 1 < argc)
+            Memo::capacity = strtoul(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--memo-stats") == 0) memo_stats = true;
+        else if (strcmp(argv[i], "--stats") == 0) eval_stats = true;
+        else if (strcmp(argv[i], "--cache") == 0) cache = true;
+        else if (strcmp(argv[i], "--profile") == 0) profile = true;
+        else if (strcmp(argv[i], "--profile-out") == 0 && i + 1 < argc) {
+            profile = true;
+            Profiler::folded_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            num_threads = strtoul(argv[++i], nullptr, 10);
+            Pool::set_num_threads(num_threads);
+        }
+        else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+            jobs = true;
+            num_jobs = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc)
+            serve_path = argv[++i];
+        else file_names.push_back(argv[i]);
+    }
+    int num_files = file_names.size() - 1;
+    if (profile) Profiler::start();
+
+    /* Answer requests on a socket, after evaluating the files */
+    if (serve_path != nullptr)
+        serve(serve_path, num_files, file_names.data(), cache, num_threads);
 
     /* Start repl */
-    if (argc == 1) repl(std::cin);
+    else if (num_files == 0) repl(std::cin);
     
     /* Help menu */
-    else if (argc == 2 && strcmp(argv[1], "--help") == 0) {
+    else if (num_files == 1 && strcmp(file_names[1], "--help") == 0) {
         std::cout << "\n*=================================================="
                   << "\n*  nanoscheme"
                   << "\n*  Copyright (c) 2019-2020 - Trung Truong"
                   << "\n*==================================================\n";
         std::cout << "\n> Run \"./nscm\" to start the read-eval-print loop"
                   << "\n> Run \"./nscm <file.scm> ..\" to eval .scm files"
+                  << "\n> Run \"./nscm --gc-stats ..\" to print garbage "
+                  << "collector statistics on exit"
+                  << "\n> Run \"./nscm --vm ..\" to run procedures on the "
+                  << "bytecode VM"
+                  << "\n> Run \"./nscm --threads <n> ..\" to run 'pmap' and "
+                  << "'pfilter' on n threads"
+                  << "\n> Run \"./nscm --jobs <n> <file.scm> ..\" to eval "
+                  << "files on n threads, each in its own env"
+                  << "\n> Run \"./nscm --no-fold ..\" to keep constant "
+                  << "expressions of procedures unevaluated"
+                  << "\n> Run \"./nscm --fold-stats ..\" to print constant "
+                  << "folding statistics on exit"
+                  << "\n> Run \"./nscm --cache ..\" to cache the tokens of "
+                  << "each file next to it, as <file>.scmc"
+                  << "\n> Run \"./nscm --memo-size <n> ..\" to keep at most n "
+                  << "results per 'define-memo' procedure"
+                  << "\n> Run \"./nscm --memo-stats ..\" to print memoization "
+                  << "statistics on exit"
+                  << "\n> Run \"./nscm --stats ..\" to print evaluator "
+                  << "statistics on exit"
+                  << "\n> Run \"./nscm --profile ..\" to print a profile "
+                  << "of procedures on exit, stacks in nscm.folded"
+                  << "\n> Run \"./nscm --profile-out <file> ..\" to write "
+                  << "the stacks of the profile to file"
+                  << "\n> Run \"./nscm --serve <socket> [prelude.scm ..]\" "
+                  << "to answer requests on a unix socket"
                   << "\n> Type \"exit\" to break eval loop\n\n";
     }
 
+    /* Eval from files, concurrently */
+    else if (jobs) {
+        if (eval_files_parallel(num_files, file_names.data(), cache,
+                                num_jobs) > 0)
+            status = EXIT_FAILURE;
+    }
+
     /* Eval from files */
-    else eval_files(argc - 1, argv);
-    return EXIT_SUCCESS;
+    else {
+        Frame std_env_frame {};
+        Env *global_env = gc_new<Env>(std_env_frame);
+        Heap::current().add_root(global_env);
+        eval_files(num_files, file_names.data(), cache, global_env);
+    }
+    Writer::out().flush();
+
+    if (profile) {
+        Profiler::stop();
+        Profiler::report(std::cerr);
+    }
+    if (gc_stats) print_gc_stats();
+    if (fold_stats) print_fold_stats();
+    if (memo_stats) print_memo_stats();
+    if (eval_stats) Counters::print(std::cerr, Counters::get_stats());
+    return status;
 }
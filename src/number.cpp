@@ -0,0 +1,243 @@
+/*============================================================================
+ *  nanoscheme
+ *  Copyright (c) 2019-2020 - Trung Truong
+ *
+ *  File name: number.cpp
+ *  Description: General path of the arithmetic and comparisons of numbers
+ *
+ *==========================================================================*/
+#include <cerrno>
+#include <cstdlib>
+#include "number.h"
+
+/*============================================================================
+ *  Conversions
+ *===========================================================================*/
+static inline bool is_integer(ExpType t) {
+    return t == ExpType::INT || t == ExpType::BIGINT;
+}
+
+static inline void check_number(Value v, const char *name) {
+    if (!is_number(v))
+        throw "Invalid args type for '" + std::string(name) + "'";
+}
+
+static BigInt to_big(Value v) {
+    if (v.type() == ExpType::INT) return BigInt(v.ival());
+    return v.obj()->get_bigint();
+}
+
+bool is_number(Value v) {
+    ExpType t = v.type();
+    return t == ExpType::INT || t == ExpType::FLOAT || t == ExpType::BIGINT;
+}
+
+/**
+ * Get a number as a double
+ * @param v Number
+ * @param name Name of the primitive, for errors
+ * @returns Closest double
+ */
+double num_to_double(Value v, const char *name) {
+    switch (v.type()) {
+        case ExpType::INT:      return double(v.ival());
+        case ExpType::FLOAT:    return v.fval();
+        case ExpType::BIGINT:   return v.obj()->get_bigint().to_double();
+        default:
+            throw "Invalid args type for '" + std::string(name) + "'";
+    }
+}
+
+/**
+ * Make the result of a sum or product from a double. Integral results are
+ * integers, as long as they fit in 64 bits.
+ * @param d Double
+ * @returns Integer or float
+ */
+Value num_from_double(double d) {
+    if (std::floor(d) == d && d >= -9223372036854775808.0 &&
+        d < 9223372036854775808.0)
+        return Value(int64_t(d));
+    return Value(d);
+}
+
+/**
+ * Make an integer result, demoted to a 64-bit integer if it fits
+ * @param b Integer
+ * @returns Integer value
+ */
+Value num_from_big(BigInt b) {
+    if (b.fits_int64()) return Value(b.to_int64());
+    return Value(gc_new<Expr>(std::move(b)));
+}
+
+/**
+ * Parse a number written the way the parser reads it: an integer, made a
+ * big integer if it does not fit in 64 bits, or a float with a decimal
+ * point or an exponent
+ * @param text Text, without surrounding spaces
+ * @param v Reference to parsed number
+ * @returns False if the whole text is not a number
+ */
+bool num_parse(const std::string &text, Value &v) {
+    BigInt big;
+    if (text.empty()) return false;
+    if (BigInt::parse(text, big)) {
+        v = num_from_big(std::move(big));
+        return true;
+    }
+    if (text.find_first_not_of("0123456789+-.eE") != std::string::npos)
+        return false;
+    char *end = nullptr;
+    errno = 0;
+    double d = strtod(text.c_str(), &end);
+    if (end != text.c_str() + text.size() || errno != 0) return false;
+    v = Value(d);
+    return true;
+}
+
+/*============================================================================
+ *  Arithmetic
+ *===========================================================================*/
+Value num_add_slow(Value a, Value b) {
+    check_number(a, "+");
+    check_number(b, "+");
+    ExpType ta = a.type(), tb = b.type();
+
+    if (ta == ExpType::INT && tb == ExpType::INT) {
+        int64_t r;
+        if (!__builtin_add_overflow(a.ival(), b.ival(), &r)) return Value(r);
+    }
+    if (is_integer(ta) && is_integer(tb))
+        return num_from_big(BigInt::add(to_big(a), to_big(b)));
+    return Value(num_to_double(a, "+") + num_to_double(b, "+"));
+}
+
+Value num_sub_slow(Value a, Value b) {
+    check_number(a, "-");
+    check_number(b, "-");
+    ExpType ta = a.type(), tb = b.type();
+
+    if (ta == ExpType::INT && tb == ExpType::INT) {
+        int64_t r;
+        if (!__builtin_sub_overflow(a.ival(), b.ival(), &r)) return Value(r);
+    }
+    if (is_integer(ta) && is_integer(tb))
+        return num_from_big(BigInt::sub(to_big(a), to_big(b)));
+    return Value(num_to_double(a, "-") - num_to_double(b, "-"));
+}
+
+Value num_mul_slow(Value a, Value b) {
+    check_number(a, "*");
+    check_number(b, "*");
+    ExpType ta = a.type(), tb = b.type();
+
+    if (ta == ExpType::INT && tb == ExpType::INT) {
+        int64_t r;
+        if (!__builtin_mul_overflow(a.ival(), b.ival(), &r)) return Value(r);
+    }
+    if (is_integer(ta) && is_integer(tb))
+        return num_from_big(BigInt::mul(to_big(a), to_big(b)));
+    return Value(num_to_double(a, "*") * num_to_double(b, "*"));
+}
+
+/**
+ * Divide two numbers. Integers are divided truncating toward zero.
+ * @param a Dividend
+ * @param b Divisor
+ * @returns Quotient
+ */
+Value num_div_slow(Value a, Value b) {
+    if (num_to_double(b, "/") == 0) throw "Division by zero";
+    check_number(a, "/");
+    ExpType ta = a.type(), tb = b.type();
+
+    if (ta == ExpType::INT && tb == ExpType::INT &&
+        !(a.ival() == INT64_MIN && b.ival() == -1))
+        return Value(a.ival() / b.ival());
+    if (is_integer(ta) && is_integer(tb)) {
+        BigInt q, r;
+        BigInt::divmod(to_big(a), to_big(b), q, r);
+        return num_from_big(std::move(q));
+    }
+    return Value(num_to_double(a, "/") / num_to_double(b, "/"));
+}
+
+/**
+ * Remainder of the division of two integers, with the sign of the
+ * dividend
+ * @param a Dividend
+ * @param b Divisor
+ * @returns Remainder
+ */
+Value num_mod_slow(Value a, Value b) {
+    if (num_to_double(b, "modulo") == 0) throw "Division by zero";
+    ExpType ta = a.type(), tb = b.type();
+    if (!is_integer(ta) || !is_integer(tb))
+        throw "Invalid args type for 'modulo'";
+
+    if (ta == ExpType::INT && tb == ExpType::INT)
+        return Value(b.ival() == -1 ? 0 : a.ival() % b.ival());
+    BigInt q, r;
+    BigInt::divmod(to_big(a), to_big(b), q, r);
+    return num_from_big(std::move(r));
+}
+
+Value num_abs(Value a) {
+    switch (a.type()) {
+        case ExpType::INT:
+            if (a.ival() == INT64_MIN)
+                return num_from_big(BigInt::negate(BigInt(a.ival())));
+            return Value(a.ival() < 0 ? -a.ival() : a.ival());
+        case ExpType::FLOAT:
+            return Value(std::fabs(a.fval()));
+        case ExpType::BIGINT:
+            if (!a.obj()->get_bigint().is_negative()) return a;
+            return num_from_big(BigInt::negate(a.obj()->get_bigint()));
+        default:
+            throw "Invalid args type for 'abs'";
+    }
+}
+
+/*============================================================================
+ *  Comparisons
+ *===========================================================================*/
+/**
+ * Compare two numbers of any type. Floats are compared in double precision,
+ * integers exactly.
+ * @param op Comparison
+ * @param a Left operand
+ * @param b Right operand
+ * @param name Name of the primitive, for errors
+ * @returns Result of the comparison
+ */
+bool num_compare_slow(CmpOp op, Value a, Value b, const char *name) {
+    check_number(a, name);
+    check_number(b, name);
+    ExpType ta = a.type(), tb = b.type();
+
+    if (ta == ExpType::FLOAT || tb == ExpType::FLOAT) {
+        double x = num_to_double(a, name), y = num_to_double(b, name);
+        switch (op) {
+            case CmpOp::GT: return x > y;
+            case CmpOp::LT: return x < y;
+            case CmpOp::GE: return x >= y;
+            case CmpOp::LE: return x <= y;
+            case CmpOp::EQ: return x == y;
+        }
+    }
+
+    int c;
+    if (ta == ExpType::INT && tb == ExpType::INT)
+        c = (a.ival() > b.ival()) - (a.ival() < b.ival());
+    else
+        c = BigInt::compare(to_big(a), to_big(b));
+    switch (op) {
+        case CmpOp::GT: return c > 0;
+        case CmpOp::LT: return c < 0;
+        case CmpOp::GE: return c >= 0;
+        case CmpOp::LE: return c <= 0;
+        case CmpOp::EQ: return c == 0;
+    }
+    return false;
+}
@@ -0,0 +1,136 @@
+/*============================================================================
+ *  nanoscheme
+ *  Copyright (c) 2019-2020 - Trung Truong
+ *
+ *  File name: number.h
+ *  Description: Arithmetic and comparisons of numbers, shared by the
+ *  tree-walker and the VM
+ *
+ *  Integers are exact. Operations on immediate integers are inlined and
+ *  checked for overflow with the compiler builtins. Anything else, and an
+ *  overflowing result, goes through the out-of-line general path, which
+ *  promotes to `BigInt` and demotes back once a result fits in 64 bits. As
+ *  soon as a float is involved the operation is done in double precision.
+ *
+ *==========================================================================*/
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "bigint.h"
+#include "expr.h"
+#ifndef NUMBER_H_
+#define NUMBER_H_
+
+/* Comparisons, see `num_compare` */
+enum class CmpOp { GT, LT, GE, LE, EQ };
+
+/*============================================================================
+ *  General path
+ *===========================================================================*/
+bool is_number(Value v);
+double num_to_double(Value v, const char *name);
+Value num_from_double(double d);
+Value num_from_big(BigInt b);
+bool num_parse(const std::string &text, Value &v);
+
+Value num_add_slow(Value a, Value b);
+Value num_sub_slow(Value a, Value b);
+Value num_mul_slow(Value a, Value b);
+Value num_div_slow(Value a, Value b);
+Value num_mod_slow(Value a, Value b);
+Value num_abs(Value a);
+bool num_compare_slow(CmpOp op, Value a, Value b, const char *name);
+
+/*============================================================================
+ *  Fast path
+ *===========================================================================*/
+/**
+ * Sum numbers. An all-integer sum is exact; once a float is met the rest
+ * is summed in double precision and an integral result is made an integer.
+ * @param n Number of operands
+ * @param next Function returning the operand of an index, called once per
+ * index in order
+ * @returns Sum
+ */
+template <typename Next>
+inline Value num_sum(size_t n, Next next) {
+    int64_t s = 0;
+    for (size_t i = 0; i < n; i++) {
+        Value v = next(i);
+        int64_t r;
+        if (v.is_int() && !__builtin_add_overflow(s, v.ival(), &r)) {
+            s = r;
+            continue;
+        }
+        Value acc = num_add_slow(Value(s), v);
+        for (i++; i < n; i++) acc = num_add_slow(acc, next(i));
+        return acc.is_float() ? num_from_double(acc.fval()) : acc;
+    }
+    return Value(s);
+}
+
+/**
+ * Multiply numbers, see `num_sum`
+ * @param n Number of operands
+ * @param next Function returning the operand of an index
+ * @returns Product
+ */
+template <typename Next>
+inline Value num_product(size_t n, Next next) {
+    int64_t p = 1;
+    for (size_t i = 0; i < n; i++) {
+        Value v = next(i);
+        int64_t r;
+        if (v.is_int() && !__builtin_mul_overflow(p, v.ival(), &r)) {
+            p = r;
+            continue;
+        }
+        Value acc = num_mul_slow(Value(p), v);
+        for (i++; i < n; i++) acc = num_mul_slow(acc, next(i));
+        return acc.is_float() ? num_from_double(acc.fval()) : acc;
+    }
+    return Value(p);
+}
+
+/* Immediates have 48 bits, so their difference can not overflow */
+inline Value num_sub(Value a, Value b) {
+    if (a.is_int() && b.is_int()) return Value(a.ival() - b.ival());
+    return num_sub_slow(a, b);
+}
+
+inline Value num_div(Value a, Value b) {
+    if (a.is_int() && b.is_int() && b.ival() != 0)
+        return Value(a.ival() / b.ival());
+    return num_div_slow(a, b);
+}
+
+inline Value num_mod(Value a, Value b) {
+    if (a.is_int() && b.is_int() && b.ival() != 0)
+        return Value(a.ival() % b.ival());
+    return num_mod_slow(a, b);
+}
+
+/**
+ * Compare two numbers
+ * @param op Comparison
+ * @param a Left operand
+ * @param b Right operand
+ * @param name Name of the primitive, for errors
+ * @returns Result of the comparison
+ */
+inline bool num_compare(CmpOp op, Value a, Value b, const char *name) {
+    if (a.is_int() && b.is_int()) {
+        int64_t x = a.ival(), y = b.ival();
+        switch (op) {
+            case CmpOp::GT: return x > y;
+            case CmpOp::LT: return x < y;
+            case CmpOp::GE: return x >= y;
+            case CmpOp::LE: return x <= y;
+            case CmpOp::EQ: return x == y;
+        }
+    }
+    return num_compare_slow(op, a, b, name);
+}
+
+#endif
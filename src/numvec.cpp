@@ -0,0 +1,728 @@
+/*============================================================================
+ *  nanoscheme
+ *  Copyright (c) 2019-2020 - Trung Truong
+ *
+ *  File name: numvec.cpp
+ *  Description: Implementation of `NumVector` class
+ *
+ *  Kernels come in a scalar, an SSE2 and an AVX2 version, the AVX2 ones
+ *  compiled for that target alone, and a table of them is picked for the
+ *  CPU at startup. Reductions of doubles keep eight partial results,
+ *  two SSE2 or one AVX2 register per four of them, and every version adds
+ *  element `i` to partial `i % 8`, then combines the partials pairwise in
+ *  the same order, so the three give bit-identical results. No version
+ *  fuses multiplies and adds. Integer sums wrap in the registers and flag
+ *  overflows, which redo the sum exactly with `num_sum`.
+ *
+ *==========================================================================*/
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include "expr.h"
+#include "gc.h"
+#include "number.h"
+#include "numvec.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define NUMVEC_X86 1
+#include <immintrin.h>
+#endif
+
+/* Partial results of reductions */
+static const size_t LANES = 8;
+/* Alignment of the elements, for aligned AVX2 loads */
+static const size_t ALIGNMENT = 32;
+
+/*============================================================================
+ *  Scalar kernels
+ *===========================================================================*/
+/* Element-wise minimum and maximum, as `_mm_min_pd` and `_mm_max_pd` */
+static inline double min_f64(double x, double y) { return x < y ? x : y; }
+static inline double max_f64(double x, double y) { return x > y ? x : y; }
+
+/**
+ * Combine the partial results of a reduction
+ * @param acc Partial results
+ * @param op Operation
+ * @returns Result
+ */
+template <typename Op>
+static inline double combine(double *acc, Op op) {
+    for (size_t width = LANES / 2; width > 0; width /= 2)
+        for (size_t i = 0; i < width; i++)
+            acc[i] = op(acc[i], acc[i + width]);
+    return acc[0];
+}
+
+static double scalar_sum_f64(const double *x, size_t n, double *acc) {
+    for (size_t i = 0; i < n; i++) acc[i % LANES] += x[i];
+    return combine(acc, [](double a, double b) { return a + b; });
+}
+
+static double scalar_dot_f64(const double *x, const double *y, size_t n,
+                             double *acc) {
+    for (size_t i = 0; i < n; i++) acc[i % LANES] += x[i] * y[i];
+    return combine(acc, [](double a, double b) { return a + b; });
+}
+
+static double scalar_min_f64(const double *x, size_t n, double *acc) {
+    for (size_t i = 0; i < n; i++)
+        acc[i % LANES] = min_f64(acc[i % LANES], x[i]);
+    return combine(acc, min_f64);
+}
+
+static double scalar_max_f64(const double *x, size_t n, double *acc) {
+    for (size_t i = 0; i < n; i++)
+        acc[i % LANES] = max_f64(acc[i % LANES], x[i]);
+    return combine(acc, max_f64);
+}
+
+/**
+ * Sum integers, as long as no partial sum overflows
+ * @param x Elements
+ * @param n Number of elements
+ * @param sum Sum
+ * @returns False on overflow
+ */
+static bool scalar_sum_i64(const int64_t *x, size_t n, int64_t &sum) {
+    int64_t s = 0;
+    for (size_t i = 0; i < n; i++)
+        if (__builtin_add_overflow(s, x[i], &s)) return false;
+    sum = s;
+    return true;
+}
+
+static int64_t scalar_min_i64(const int64_t *x, size_t n) {
+    int64_t m = x[0];
+    for (size_t i = 1; i < n; i++) m = x[i] < m ? x[i] : m;
+    return m;
+}
+
+static int64_t scalar_max_i64(const int64_t *x, size_t n) {
+    int64_t m = x[0];
+    for (size_t i = 1; i < n; i++) m = x[i] > m ? x[i] : m;
+    return m;
+}
+
+/**
+ * Apply an operation element-wise. Operands of binary operations are
+ * vectors, or a scalar repeated when `y` is nullptr.
+ * @param op Operation
+ * @param x Elements of the first operand
+ * @param y Elements of the second operand, or nullptr
+ * @param s Scalar second operand
+ * @param out Elements of the result
+ * @param n Number of elements
+ * @returns void
+ */
+static void scalar_map_f64(VecOp op, const double *x, const double *y,
+                           double s, double *out, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        double a = x[i], b = y != nullptr ? y[i] : s;
+        switch (op) {
+            case VecOp::ADD:    out[i] = a + b;             break;
+            case VecOp::SUB:    out[i] = a - b;             break;
+            case VecOp::MUL:    out[i] = a * b;             break;
+            case VecOp::DIV:    out[i] = a / b;             break;
+            case VecOp::MIN:    out[i] = min_f64(a, b);     break;
+            case VecOp::MAX:    out[i] = max_f64(a, b);     break;
+            case VecOp::NEG:    out[i] = -a;                break;
+            case VecOp::ABS:    out[i] = std::fabs(a);      break;
+            case VecOp::SQRT:   out[i] = std::sqrt(a);      break;
+            case VecOp::SIN:    out[i] = std::sin(a);       break;
+            case VecOp::COS:    out[i] = std::cos(a);       break;
+            case VecOp::TAN:    out[i] = std::tan(a);       break;
+            case VecOp::LOG:    out[i] = std::log(a);       break;
+        }
+    }
+}
+
+/*============================================================================
+ *  SSE2 kernels
+ *===========================================================================*/
+#ifdef NUMVEC_X86
+static double sse2_sum_f64(const double *x, size_t n, double *acc) {
+    __m128d a0 = _mm_loadu_pd(acc), a1 = _mm_loadu_pd(acc + 2);
+    __m128d a2 = _mm_loadu_pd(acc + 4), a3 = _mm_loadu_pd(acc + 6);
+    size_t i = 0;
+    for (; i + LANES <= n; i += LANES) {
+        a0 = _mm_add_pd(a0, _mm_load_pd(x + i));
+        a1 = _mm_add_pd(a1, _mm_load_pd(x + i + 2));
+        a2 = _mm_add_pd(a2, _mm_load_pd(x + i + 4));
+        a3 = _mm_add_pd(a3, _mm_load_pd(x + i + 6));
+    }
+    _mm_storeu_pd(acc, a0);
+    _mm_storeu_pd(acc + 2, a1);
+    _mm_storeu_pd(acc + 4, a2);
+    _mm_storeu_pd(acc + 6, a3);
+    return scalar_sum_f64(x + i, n - i, acc);
+}
+
+static double sse2_dot_f64(const double *x, const double *y, size_t n,
+                           double *acc) {
+    __m128d a0 = _mm_loadu_pd(acc), a1 = _mm_loadu_pd(acc + 2);
+    __m128d a2 = _mm_loadu_pd(acc + 4), a3 = _mm_loadu_pd(acc + 6);
+    size_t i = 0;
+    for (; i + LANES <= n; i += LANES) {
+        a0 = _mm_add_pd(a0, _mm_mul_pd(_mm_load_pd(x + i),
+                                       _mm_load_pd(y + i)));
+        a1 = _mm_add_pd(a1, _mm_mul_pd(_mm_load_pd(x + i + 2),
+                                       _mm_load_pd(y + i + 2)));
+        a2 = _mm_add_pd(a2, _mm_mul_pd(_mm_load_pd(x + i + 4),
+                                       _mm_load_pd(y + i + 4)));
+        a3 = _mm_add_pd(a3, _mm_mul_pd(_mm_load_pd(x + i + 6),
+                                       _mm_load_pd(y + i + 6)));
+    }
+    _mm_storeu_pd(acc, a0);
+    _mm_storeu_pd(acc + 2, a1);
+    _mm_storeu_pd(acc + 4, a2);
+    _mm_storeu_pd(acc + 6, a3);
+    return scalar_dot_f64(x + i, y + i, n - i, acc);
+}
+
+/* Minimum and maximum, `_mm_min_pd(a, b)` is `a < b ? a : b` */
+template <bool MIN>
+static double sse2_minmax_f64(const double *x, size_t n, double *acc) {
+    __m128d a0 = _mm_loadu_pd(acc), a1 = _mm_loadu_pd(acc + 2);
+    __m128d a2 = _mm_loadu_pd(acc + 4), a3 = _mm_loadu_pd(acc + 6);
+    size_t i = 0;
+    for (; i + LANES <= n; i += LANES) {
+        __m128d x0 = _mm_load_pd(x + i), x1 = _mm_load_pd(x + i + 2);
+        __m128d x2 = _mm_load_pd(x + i + 4), x3 = _mm_load_pd(x + i + 6);
+        a0 = MIN ? _mm_min_pd(a0, x0) : _mm_max_pd(a0, x0);
+        a1 = MIN ? _mm_min_pd(a1, x1) : _mm_max_pd(a1, x1);
+        a2 = MIN ? _mm_min_pd(a2, x2) : _mm_max_pd(a2, x2);
+        a3 = MIN ? _mm_min_pd(a3, x3) : _mm_max_pd(a3, x3);
+    }
+    _mm_storeu_pd(acc, a0);
+    _mm_storeu_pd(acc + 2, a1);
+    _mm_storeu_pd(acc + 4, a2);
+    _mm_storeu_pd(acc + 6, a3);
+    if (MIN) return scalar_min_f64(x + i, n - i, acc);
+    return scalar_max_f64(x + i, n - i, acc);
+}
+
+/* An overflow of `a + b = s` gives `s` the sign of neither operand */
+static bool sse2_sum_i64(const int64_t *x, size_t n, int64_t &sum) {
+    __m128i a0 = _mm_setzero_si128(), a1 = _mm_setzero_si128();
+    __m128i flags = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(x + i));
+        __m128i x1 = _mm_load_si128(
+            reinterpret_cast<const __m128i*>(x + i + 2));
+        __m128i s0 = _mm_add_epi64(a0, x0), s1 = _mm_add_epi64(a1, x1);
+        flags = _mm_or_si128(flags, _mm_and_si128(_mm_xor_si128(a0, s0),
+                                                  _mm_xor_si128(x0, s0)));
+        flags = _mm_or_si128(flags, _mm_and_si128(_mm_xor_si128(a1, s1),
+                                                  _mm_xor_si128(x1, s1)));
+        a0 = s0;
+        a1 = s1;
+    }
+    if (_mm_movemask_pd(_mm_castsi128_pd(flags)) != 0) return false;
+
+    int64_t part[4], rest;
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(part), a0);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(part + 2), a1);
+    if (!scalar_sum_i64(x + i, n - i, rest)) return false;
+    int64_t s = rest;
+    for (int64_t p : part)
+        if (__builtin_add_overflow(s, p, &s)) return false;
+    sum = s;
+    return true;
+}
+
+static void sse2_map_f64(VecOp op, const double *x, const double *y,
+                         double s, double *out, size_t n) {
+    const __m128d sign = _mm_set1_pd(-0.0);
+    __m128d b = _mm_set1_pd(s);
+    size_t i = 0;
+    switch (op) {
+        case VecOp::SIN: case VecOp::COS: case VecOp::TAN: case VecOp::LOG:
+            return scalar_map_f64(op, x, y, s, out, n);
+        default: break;
+    }
+    for (; i + 2 <= n; i += 2) {
+        __m128d a = _mm_load_pd(x + i), r;
+        if (y != nullptr) b = _mm_load_pd(y + i);
+        switch (op) {
+            case VecOp::ADD:    r = _mm_add_pd(a, b);           break;
+            case VecOp::SUB:    r = _mm_sub_pd(a, b);           break;
+            case VecOp::MUL:    r = _mm_mul_pd(a, b);           break;
+            case VecOp::DIV:    r = _mm_div_pd(a, b);           break;
+            case VecOp::MIN:    r = _mm_min_pd(a, b);           break;
+            case VecOp::MAX:    r = _mm_max_pd(a, b);           break;
+            case VecOp::NEG:    r = _mm_xor_pd(a, sign);        break;
+            case VecOp::ABS:    r = _mm_andnot_pd(sign, a);     break;
+            case VecOp::SQRT:   r = _mm_sqrt_pd(a);             break;
+            default:            r = a;                          break;
+        }
+        _mm_store_pd(out + i, r);
+    }
+    scalar_map_f64(op, x + i, y != nullptr ? y + i : nullptr, s, out + i,
+                   n - i);
+}
+
+/*============================================================================
+ *  AVX2 kernels
+ *===========================================================================*/
+#define TARGET_AVX2 __attribute__((target("avx2")))
+
+TARGET_AVX2
+static double avx2_sum_f64(const double *x, size_t n, double *acc) {
+    __m256d a0 = _mm256_loadu_pd(acc), a1 = _mm256_loadu_pd(acc + 4);
+    size_t i = 0;
+    for (; i + LANES <= n; i += LANES) {
+        a0 = _mm256_add_pd(a0, _mm256_load_pd(x + i));
+        a1 = _mm256_add_pd(a1, _mm256_load_pd(x + i + 4));
+    }
+    _mm256_storeu_pd(acc, a0);
+    _mm256_storeu_pd(acc + 4, a1);
+    return scalar_sum_f64(x + i, n - i, acc);
+}
+
+TARGET_AVX2
+static double avx2_dot_f64(const double *x, const double *y, size_t n,
+                           double *acc) {
+    __m256d a0 = _mm256_loadu_pd(acc), a1 = _mm256_loadu_pd(acc + 4);
+    size_t i = 0;
+    for (; i + LANES <= n; i += LANES) {
+        a0 = _mm256_add_pd(a0, _mm256_mul_pd(_mm256_load_pd(x + i),
+                                             _mm256_load_pd(y + i)));
+        a1 = _mm256_add_pd(a1, _mm256_mul_pd(_mm256_load_pd(x + i + 4),
+                                             _mm256_load_pd(y + i + 4)));
+    }
+    _mm256_storeu_pd(acc, a0);
+    _mm256_storeu_pd(acc + 4, a1);
+    return scalar_dot_f64(x + i, y + i, n - i, acc);
+}
+
+template <bool MIN>
+TARGET_AVX2
+static double avx2_minmax_f64(const double *x, size_t n, double *acc) {
+    __m256d a0 = _mm256_loadu_pd(acc), a1 = _mm256_loadu_pd(acc + 4);
+    size_t i = 0;
+    for (; i + LANES <= n; i += LANES) {
+        __m256d x0 = _mm256_load_pd(x + i), x1 = _mm256_load_pd(x + i + 4);
+        a0 = MIN ? _mm256_min_pd(a0, x0) : _mm256_max_pd(a0, x0);
+        a1 = MIN ? _mm256_min_pd(a1, x1) : _mm256_max_pd(a1, x1);
+    }
+    _mm256_storeu_pd(acc, a0);
+    _mm256_storeu_pd(acc + 4, a1);
+    if (MIN) return scalar_min_f64(x + i, n - i, acc);
+    return scalar_max_f64(x + i, n - i, acc);
+}
+
+TARGET_AVX2
+static bool avx2_sum_i64(const int64_t *x, size_t n, int64_t &sum) {
+    __m256i a = _mm256_setzero_si256(), flags = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i v = _mm256_load_si256(
+            reinterpret_cast<const __m256i*>(x + i));
+        __m256i s = _mm256_add_epi64(a, v);
+        flags = _mm256_or_si256(flags, _mm256_and_si256(
+            _mm256_xor_si256(a, s), _mm256_xor_si256(v, s)));
+        a = s;
+    }
+    if (_mm256_movemask_pd(_mm256_castsi256_pd(flags)) != 0) return false;
+
+    int64_t part[4], rest;
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(part), a);
+    if (!scalar_sum_i64(x + i, n - i, rest)) return false;
+    int64_t s = rest;
+    for (int64_t p : part)
+        if (__builtin_add_overflow(s, p, &s)) return false;
+    sum = s;
+    return true;
+}
+
+template <bool MIN>
+TARGET_AVX2
+static int64_t avx2_minmax_i64(const int64_t *x, size_t n) {
+    if (n < 4) return MIN ? scalar_min_i64(x, n) : scalar_max_i64(x, n);
+    __m256i m = _mm256_load_si256(reinterpret_cast<const __m256i*>(x));
+    size_t i = 4;
+    for (; i + 4 <= n; i += 4) {
+        __m256i v = _mm256_load_si256(
+            reinterpret_cast<const __m256i*>(x + i));
+        __m256i gt = MIN ? _mm256_cmpgt_epi64(m, v)
+                         : _mm256_cmpgt_epi64(v, m);
+        m = _mm256_blendv_epi8(m, v, gt);
+    }
+    int64_t part[4];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(part), m);
+    int64_t r = MIN ? scalar_min_i64(part, 4) : scalar_max_i64(part, 4);
+    if (i == n) return r;
+    int64_t t = MIN ? scalar_min_i64(x + i, n - i)
+                    : scalar_max_i64(x + i, n - i);
+    return MIN ? std::min(r, t) : std::max(r, t);
+}
+
+TARGET_AVX2
+static void avx2_map_f64(VecOp op, const double *x, const double *y,
+                         double s, double *out, size_t n) {
+    const __m256d sign = _mm256_set1_pd(-0.0);
+    __m256d b = _mm256_set1_pd(s);
+    size_t i = 0;
+    switch (op) {
+        case VecOp::SIN: case VecOp::COS: case VecOp::TAN: case VecOp::LOG:
+            return scalar_map_f64(op, x, y, s, out, n);
+        default: break;
+    }
+    for (; i + 4 <= n; i += 4) {
+        __m256d a = _mm256_load_pd(x + i), r;
+        if (y != nullptr) b = _mm256_load_pd(y + i);
+        switch (op) {
+            case VecOp::ADD:    r = _mm256_add_pd(a, b);        break;
+            case VecOp::SUB:    r = _mm256_sub_pd(a, b);        break;
+            case VecOp::MUL:    r = _mm256_mul_pd(a, b);        break;
+            case VecOp::DIV:    r = _mm256_div_pd(a, b);        break;
+            case VecOp::MIN:    r = _mm256_min_pd(a, b);        break;
+            case VecOp::MAX:    r = _mm256_max_pd(a, b);        break;
+            case VecOp::NEG:    r = _mm256_xor_pd(a, sign);     break;
+            case VecOp::ABS:    r = _mm256_andnot_pd(sign, a);  break;
+            case VecOp::SQRT:   r = _mm256_sqrt_pd(a);          break;
+            default:            r = a;                          break;
+        }
+        _mm256_store_pd(out + i, r);
+    }
+    scalar_map_f64(op, x + i, y != nullptr ? y + i : nullptr, s, out + i,
+                   n - i);
+}
+#endif
+
+/*============================================================================
+ *  Dispatch
+ *===========================================================================*/
+struct Kernels {
+    double (*sum_f64)(const double*, size_t, double*);
+    double (*dot_f64)(const double*, const double*, size_t, double*);
+    double (*min_f64)(const double*, size_t, double*);
+    double (*max_f64)(const double*, size_t, double*);
+    bool (*sum_i64)(const int64_t*, size_t, int64_t&);
+    int64_t (*min_i64)(const int64_t*, size_t);
+    int64_t (*max_i64)(const int64_t*, size_t);
+    void (*map_f64)(VecOp, const double*, const double*, double, double*,
+                    size_t);
+};
+
+static const Kernels scalar_kernels = {
+    scalar_sum_f64, scalar_dot_f64, scalar_min_f64, scalar_max_f64,
+    scalar_sum_i64, scalar_min_i64, scalar_max_i64, scalar_map_f64
+};
+#ifdef NUMVEC_X86
+static const Kernels sse2_kernels = {
+    sse2_sum_f64, sse2_dot_f64, sse2_minmax_f64<true>,
+    sse2_minmax_f64<false>, sse2_sum_i64, scalar_min_i64, scalar_max_i64,
+    sse2_map_f64
+};
+static const Kernels avx2_kernels = {
+    avx2_sum_f64, avx2_dot_f64, avx2_minmax_f64<true>,
+    avx2_minmax_f64<false>, avx2_sum_i64, avx2_minmax_i64<true>,
+    avx2_minmax_i64<false>, avx2_map_f64
+};
+#endif
+
+/**
+ * Get the best instruction set the CPU supports
+ * @returns Instruction set
+ */
+static Isa detect_isa() {
+#ifdef NUMVEC_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return Isa::AVX2;
+    if (__builtin_cpu_supports("sse2")) return Isa::SSE2;
+#endif
+    return Isa::SCALAR;
+}
+
+static Isa current_isa = detect_isa();
+
+static const Kernels &kernels() {
+#ifdef NUMVEC_X86
+    if (current_isa == Isa::AVX2) return avx2_kernels;
+    if (current_isa == Isa::SSE2) return sse2_kernels;
+#endif
+    return scalar_kernels;
+}
+
+Isa NumVector::get_isa() {
+    return current_isa;
+}
+
+/**
+ * Run the kernels of an instruction set, at most the best one the CPU
+ * supports. Meant for benchmarks, not for use while vectors are in use by
+ * other threads.
+ * @param isa Instruction set
+ * @returns void
+ */
+void NumVector::set_isa(Isa isa) {
+    current_isa = std::min(isa, detect_isa());
+}
+
+const char *NumVector::isa_name(Isa isa) {
+    switch (isa) {
+        case Isa::SCALAR:   return "scalar";
+        case Isa::SSE2:     return "sse2";
+        case Isa::AVX2:     return "avx2";
+    }
+    return "scalar";
+}
+
+/**
+ * Get the operation of a name, as written in 'vector-map'
+ * @param name Name of the operation
+ * @param op Operation
+ * @returns False if the name is not an operation
+ */
+bool NumVector::parse_op(const std::string &name, VecOp &op) {
+    static const std::pair<const char*, VecOp> ops[] = {
+        { "+", VecOp::ADD }, { "-", VecOp::SUB }, { "*", VecOp::MUL },
+        { "/", VecOp::DIV }, { "min", VecOp::MIN }, { "max", VecOp::MAX },
+        { "abs", VecOp::ABS }, { "sqrt", VecOp::SQRT }, { "sin", VecOp::SIN },
+        { "cos", VecOp::COS }, { "tan", VecOp::TAN }, { "log", VecOp::LOG }
+    };
+    for (const auto &entry : ops) {
+        if (name != entry.first) continue;
+        op = entry.second;
+        return true;
+    }
+    return false;
+}
+
+/*============================================================================
+ *  Constructors
+ *===========================================================================*/
+NumVector::NumVector(ElemType t, size_t n) : type(t), len(n), data(nullptr) {
+    size_t size = std::max<size_t>(n, 1) * sizeof(double);
+    if (n > (SIZE_MAX >> 4) ||
+        posix_memalign(&data, ALIGNMENT, size) != 0)
+        throw "Can't allocate vector of " + std::to_string(n) + " elements";
+    std::memset(data, 0, size);
+    Heap::current().add_external(size);
+}
+
+NumVector::~NumVector() {
+    free(data);
+}
+
+/*============================================================================
+ *  Elements
+ *===========================================================================*/
+/**
+ * Get an element
+ * @param i Index, in range
+ * @returns Float or integer
+ */
+Value NumVector::get(size_t i) const {
+    if (type == ElemType::F64) return Value(f64()[i]);
+    return Value(i64()[i]);
+}
+
+/**
+ * Set an element. Vectors of doubles take any number, vectors of integers
+ * only integers that fit in 64 bits.
+ * @param i Index, in range
+ * @param v Number
+ * @returns void
+ */
+void NumVector::set(size_t i, Value v) {
+    if (type == ElemType::F64) {
+        f64()[i] = num_to_double(v, "vector-set!");
+        return;
+    }
+    if (v.type() != ExpType::INT)
+        throw "Invalid args type for 'vector-set!'";
+    i64()[i] = v.ival();
+}
+
+void NumVector::fill(Value v) {
+    if (len == 0) return;
+    set(0, v);
+    if (type == ElemType::F64) std::fill(f64() + 1, f64() + len, f64()[0]);
+    else std::fill(i64() + 1, i64() + len, i64()[0]);
+}
+
+/*============================================================================
+ *  Reductions
+ *===========================================================================*/
+/**
+ * Sum the elements, like '+' would. A sum of doubles is an integer when it
+ * is integral.
+ * @returns Sum
+ */
+Value NumVector::sum() const {
+    if (type == ElemType::F64) {
+        double acc[LANES] = {};
+        return num_from_double(kernels().sum_f64(f64(), len, acc));
+    }
+    int64_t s;
+    if (kernels().sum_i64(i64(), len, s)) return Value(s);
+    const int64_t *x = i64();
+    return num_sum(len, [x](size_t i) { return Value(x[i]); });
+}
+
+
+/**
+ * Sum the products of the elements of two vectors of the same length.
+ * Integers are multiplied exactly, a product of mixed vectors is done in
+ * doubles.
+ * @param other Vector
+ * @returns Sum of the products
+ */
+Value NumVector::dot(const NumVector &other) const {
+    if (len != other.len)
+        throw "Vectors of different lengths for 'vector-dot'";
+    if (type == ElemType::I64 && other.type == ElemType::I64) {
+        const int64_t *x = i64(), *y = other.i64();
+        int64_t s = 0, p;
+        size_t i = 0;
+        for (; i < len; i++)
+            if (__builtin_mul_overflow(x[i], y[i], &p) ||
+                __builtin_add_overflow(s, p, &s)) break;
+        if (i == len) return Value(s);
+
+        Value acc = Value(int64_t(0));
+        for (i = 0; i < len; i++)
+            acc = num_add_slow(acc, num_mul_slow(Value(x[i]), Value(y[i])));
+        return acc;
+    }
+    std::unique_ptr<NumVector> xbuf, ybuf;
+    double acc[LANES] = {};
+    return num_from_double(kernels().dot_f64(as_f64(xbuf),
+                                             other.as_f64(ybuf), len, acc));
+}
+
+Value NumVector::min() const {
+    if (len == 0) throw "Empty vector for 'vector-min'";
+    if (type == ElemType::I64) return Value(kernels().min_i64(i64(), len));
+    double acc[LANES];
+    std::fill(acc, acc + LANES, f64()[0]);
+    return Value(kernels().min_f64(f64(), len, acc));
+}
+
+Value NumVector::max() const {
+    if (len == 0) throw "Empty vector for 'vector-max'";
+    if (type == ElemType::I64) return Value(kernels().max_i64(i64(), len));
+    double acc[LANES];
+    std::fill(acc, acc + LANES, f64()[0]);
+    return Value(kernels().max_f64(f64(), len, acc));
+}
+
+/*============================================================================
+ *  Element-wise operations
+ *===========================================================================*/
+/**
+ * Get the elements as doubles
+ * @param buf Owner of the converted elements of a vector of integers
+ * @returns Elements, aligned
+ */
+const double *NumVector::as_f64(std::unique_ptr<NumVector> &buf) const {
+    if (type == ElemType::F64) return f64();
+    buf.reset(new NumVector(ElemType::F64, len));
+    for (size_t i = 0; i < len; i++) buf->f64()[i] = double(i64()[i]);
+    return buf->f64();
+}
+
+/* Operations that keep integers integers */
+static bool is_integer_op(VecOp op) {
+    switch (op) {
+        case VecOp::ADD: case VecOp::SUB: case VecOp::MUL: case VecOp::DIV:
+        case VecOp::MIN: case VecOp::MAX: case VecOp::NEG: case VecOp::ABS:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * Apply an integer operation, like the primitive of the same name would.
+ * Results must fit in 64 bits.
+ * @param op Operation
+ * @param a First operand
+ * @param b Second operand, ignored by unary operations
+ * @returns Result
+ */
+static int64_t apply_i64(VecOp op, int64_t a, int64_t b) {
+    int64_t r = a;
+    bool overflow = false;
+    switch (op) {
+        case VecOp::ADD: overflow = __builtin_add_overflow(a, b, &r); break;
+        case VecOp::SUB: overflow = __builtin_sub_overflow(a, b, &r); break;
+        case VecOp::MUL: overflow = __builtin_mul_overflow(a, b, &r); break;
+        case VecOp::DIV:
+            if (b == 0) throw "Division by zero";
+            overflow = a == INT64_MIN && b == -1;
+            if (!overflow) r = a / b;
+            break;
+        case VecOp::MIN: r = a < b ? a : b;                            break;
+        case VecOp::MAX: r = a > b ? a : b;                            break;
+        case VecOp::NEG: overflow = __builtin_sub_overflow(0, a, &r);  break;
+        case VecOp::ABS:
+            overflow = a == INT64_MIN;
+            r = a < 0 ? -a : a;
+            break;
+        default: break;
+    }
+    if (overflow) throw "Integer overflow in 'vector-map'";
+    return r;
+}
+
+/**
+ * Apply an operation element-wise. Integers give integers when the
+ * operation keeps them so, anything else is done in doubles.
+ * @param op Operation
+ * @param other Vector second operand of the same length, or nullptr
+ * @param scalar Number second operand, unbound for unary operations
+ * @returns New vector
+ */
+std::shared_ptr<NumVector> NumVector::apply(VecOp op, const NumVector *other,
+                                            Value scalar) const {
+    if (other != nullptr && other->len != len)
+        throw "Vectors of different lengths for 'vector-map'";
+
+    bool integers = type == ElemType::I64 && is_integer_op(op) &&
+        (other != nullptr ? other->type == ElemType::I64
+                          : scalar.is_unbound() ||
+                            scalar.type() == ExpType::INT);
+    if (integers) {
+        auto out = std::make_shared<NumVector>(ElemType::I64, len);
+        const int64_t *x = i64();
+        const int64_t *y = other != nullptr ? other->i64() : nullptr;
+        int64_t s = scalar.is_unbound() ? 0 : scalar.ival();
+        for (size_t i = 0; i < len; i++)
+            out->i64()[i] = apply_i64(op, x[i], y != nullptr ? y[i] : s);
+        return out;
+    }
+
+    std::unique_ptr<NumVector> xbuf, ybuf;
+    const double *x = as_f64(xbuf);
+    const double *y = other != nullptr ? other->as_f64(ybuf) : nullptr;
+    double s = scalar.is_unbound() ? 0.0
+                                   : num_to_double(scalar, "vector-map");
+    if (op == VecOp::DIV) {
+        // Like '/', dividing doubles by zero is an error
+        bool zero = y == nullptr ? s == 0.0
+                                 : std::find(y, y + len, 0.0) != y + len;
+        if (zero) throw "Division by zero";
+    }
+    auto out = std::make_shared<NumVector>(ElemType::F64, len);
+    kernels().map_f64(op, x, y, s, out->f64(), len);
+    return out;
+}
+
+std::shared_ptr<NumVector> NumVector::map(VecOp op) const {
+    return apply(op, nullptr, Value());
+}
+
+std::shared_ptr<NumVector> NumVector::map(VecOp op,
+                                          const NumVector &other) const {
+    return apply(op, &other, Value());
+}
+
+std::shared_ptr<NumVector> NumVector::map(VecOp op, Value scalar) const {
+    return apply(op, nullptr, scalar);
+}
@@ -0,0 +1,93 @@
+/*============================================================================
+ *  nanoscheme
+ *  Copyright (c) 2019-2020 - Trung Truong
+ *
+ *  File name: numvec.h
+ *  Description: Header file for `NumVector` class, the unboxed vectors of
+ *  64-bit integers or doubles
+ *
+ *==========================================================================*/
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "value.h"
+#ifndef NUMVEC_H_
+#define NUMVEC_H_
+
+enum class ElemType : uint8_t { I64, F64 };
+
+/* Operations of 'vector-map' */
+enum class VecOp {
+    ADD, SUB, MUL, DIV, MIN, MAX,               // Binary
+    NEG, ABS, SQRT, SIN, COS, TAN, LOG          // Unary
+};
+
+/* Instruction sets the kernels are dispatched to, best last */
+enum class Isa { SCALAR, SSE2, AVX2 };
+
+/*============================================================================
+ *  NumVector class
+ *===========================================================================*/
+/**
+ * Fixed-size vector of unboxed elements of one type, stored contiguously
+ * and aligned for the widest loads. A `VECTOR` expression shares its
+ * vector with the copies made of it, so 'vector-set!' is seen through all
+ * of them.
+ *
+ * Reductions and element-wise operations run on SIMD kernels picked once
+ * for the CPU. Every kernel computes the same result on every instruction
+ * set: reductions of doubles always accumulate element `i` into lane
+ * `i % 8` and combine the lanes in the same order, so a sum does not
+ * change with the machine it runs on. Integer reductions are exact, like
+ * the rest of integer arithmetic.
+ */
+class NumVector {
+private:
+    ElemType type;
+    size_t len;
+    void *data;
+
+    const double *as_f64(std::unique_ptr<NumVector> &buf) const;
+    std::shared_ptr<NumVector> apply(VecOp op, const NumVector *other,
+                                     Value scalar) const;
+
+public:
+    /* Constructors, elements are zero */
+    NumVector(ElemType t, size_t n);
+    ~NumVector();
+    NumVector(const NumVector &) = delete;
+    NumVector &operator=(const NumVector &) = delete;
+
+    /* Getters */
+    ElemType elem_type() const { return type; }
+    size_t size() const { return len; }
+    double *f64() const { return static_cast<double*>(data); }
+    int64_t *i64() const { return static_cast<int64_t*>(data); }
+
+    /* Elements */
+    Value get(size_t i) const;
+    void set(size_t i, Value v);
+    void fill(Value v);
+
+    /* Reductions */
+    Value sum() const;
+    Value dot(const NumVector &other) const;
+    Value min() const;
+    Value max() const;
+
+    /* Element-wise operations, into a new vector */
+    std::shared_ptr<NumVector> map(VecOp op) const;
+    std::shared_ptr<NumVector> map(VecOp op, const NumVector &other) const;
+    std::shared_ptr<NumVector> map(VecOp op, Value scalar) const;
+
+    /* Instruction set of the kernels, the best one the CPU supports unless
+       set otherwise */
+    static Isa get_isa();
+    static void set_isa(Isa isa);
+    static const char *isa_name(Isa isa);
+    static bool parse_op(const std::string &name, VecOp &op);
+};
+
+#endif
@@ -0,0 +1,219 @@
+/*============================================================================
+ *  nanoscheme
+ *  Copyright (c) 2019-2020 - Trung Truong
+ *
+ *  File name: optimizer.cpp
+ *  Description: Implementation of `Optimizer` class
+ *
+ *  A lambda body is folded right after it is built, before it is compiled
+ *  or evaluated. The parser already replaces globals bound at that point
+ *  with a copy of their value, so they take part in folding like literals;
+ *  symbols that are not bound yet are left alone. Primitives without side
+ *  effects whose operands are all constants are evaluated once, and an 'if'
+ *  with a constant condition is replaced by the branch it takes. A fold
+ *  that throws, such as a division by zero, is skipped, so that the error
+ *  is raised when the body runs and only if it reaches the expression.
+ *
+ *==========================================================================*/
+#include "optimizer.h"
+
+bool Optimizer::enabled = true;
+OptStats Optimizer::stats;
+
+/*============================================================================
+ *  Helpers
+ *===========================================================================*/
+/**
+ * Check if an expression evaluates to itself
+ * @param e Pointer to expression
+ * @returns True for numbers, literals, strings, quoted lists, vectors and
+ * hash tables
+ */
+bool Optimizer::is_const(Expr *e) {
+    switch (e->type) {
+        case ExpType::INT: case ExpType::BIGINT: case ExpType::FLOAT:
+        case ExpType::LIT: case ExpType::STRING: case ExpType::LIST:
+        case ExpType::VECTOR: case ExpType::HASH:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * Check if a primitive only depends on the values of its operands
+ * @param t Primitive type
+ * @returns True for arithmetic, math, comparisons and type predicates
+ */
+bool Optimizer::is_pure(PrimType t) {
+    switch (t) {
+        case PrimType::ADD: case PrimType::SUB: case PrimType::MUL:
+        case PrimType::DIV: case PrimType::MOD: case PrimType::GT:
+        case PrimType::LT: case PrimType::GE: case PrimType::LE:
+        case PrimType::EQ: case PrimType::EQ_NUM: case PrimType::SIN:
+        case PrimType::COS: case PrimType::TAN: case PrimType::SQRT:
+        case PrimType::LOG: case PrimType::ABS: case PrimType::IS_NUM:
+        case PrimType::IS_SYM: case PrimType::IS_PROC: case PrimType::IS_LIST:
+        case PrimType::IS_STR: case PrimType::IS_BOOL: case PrimType::IS_NULL:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * Count the nodes of an expression tree, including the arguments of
+ * recursive calls
+ * @param e Pointer to expression
+ * @returns Number of nodes
+ */
+size_t Optimizer::count_nodes(Expr *e) {
+    size_t n = 1;
+    if (e->type == ExpType::PRIM) {
+        for (Expr *arg : std::get<1>(e->prim)) n += count_nodes(arg);
+    }
+    else if (e->type == ExpType::PROC &&
+             std::get<1>(e->proc)->type == ExpType::SYMBOL) {
+        for (Expr *arg : *std::get<0>(e->proc)->list.vec)
+            n += count_nodes(arg);
+    }
+    return n;
+}
+
+/**
+ * Allocate the result of a fold
+ * @param v Value of the folded expression
+ * @param arena Arena of the compilation unit
+ * @returns Pointer to constant expression, or nullptr if the value is not
+ * a number or a literal
+ */
+Expr *Optimizer::make_const(Value v, Arena *arena) {
+    if (!v.is_int() && !v.is_float() && !v.is_lit() &&
+        v.type() != ExpType::BIGINT) return nullptr;
+    return arena_new<Expr>(arena, v.to_expr());
+}
+
+/*============================================================================
+ *  Optimizers
+ *===========================================================================*/
+/**
+ * Fold an expression, operands first
+ * @param e Pointer to expression
+ * @param arena Arena of the compilation unit
+ * @returns Pointer to the folded expression, which may be `e` itself
+ */
+Expr *Optimizer::fold_expr(Expr *e, Arena *arena) {
+    if (e->type == ExpType::PRIM) return fold_prim(e, arena);
+
+    // Arguments of a recursive call are evaluated on every call as well
+    if (e->type == ExpType::PROC &&
+        std::get<1>(e->proc)->type == ExpType::SYMBOL) {
+        for (Expr *&arg : *std::get<0>(e->proc)->list.vec)
+            arg = fold_expr(arg, arena);
+    }
+    return e;
+}
+
+/**
+ * Fold a primitive whose operands are constants
+ * @param e Pointer to primitive expression
+ * @param arena Arena of the compilation unit
+ * @returns Pointer to the folded expression, which may be `e` itself
+ */
+Expr *Optimizer::fold_prim(Expr *e, Arena *arena) {
+    PrimType prim_type = std::get<0>(e->prim);
+    ExprArray &args = std::get<1>(e->prim);
+
+    // Nested lambdas were folded when they were built
+    if (prim_type == PrimType::LAMBDA) return e;
+
+    bool all_const = true;
+    for (Expr *&arg : args) {
+        arg = fold_expr(arg, arena);
+        all_const = all_const && is_const(arg);
+    }
+
+    if (prim_type == PrimType::IF) return fold_if(e);
+    if (!is_pure(prim_type)) return e;
+    if (!all_const) return fold_prefix(e, arena);
+
+    Expr *folded = nullptr;
+    try {
+        folded = make_const(e->eval(NO_BINDING, nullptr), arena);
+    }
+    catch (const char*)         { return e; }
+    catch (const std::string &) { return e; }
+    if (folded == nullptr) return e;
+
+    stats.folded++;
+    stats.eliminated += count_nodes(e) - 1;
+    return folded;
+}
+
+/**
+ * Replace an 'if' with a constant condition by the branch it takes
+ * @param e Pointer to 'if' expression, with folded operands
+ * @returns Pointer to the branch taken, or `e` itself
+ */
+Expr *Optimizer::fold_if(Expr *e) {
+    ExprArray &args = std::get<1>(e->prim);
+    if (args.size() != 3 || !is_const(args[0])) return e;
+
+    Expr *branch = args[0]->eval(NO_BINDING, nullptr).is_true()
+                 ? args[1] : args[2];
+    stats.pruned++;
+    stats.eliminated += count_nodes(e) - count_nodes(branch);
+    return branch;
+}
+
+/**
+ * Fold the leading constant operands of '+' and '*', as in
+ * `(* 60 60 x)` to `(* 3600 x)`. Operands are accumulated from the left, so
+ * only a prefix can be folded without changing the result.
+ * @param e Pointer to primitive expression, with folded operands
+ * @param arena Arena of the compilation unit
+ * @returns Pointer to the folded expression, which may be `e` itself
+ */
+Expr *Optimizer::fold_prefix(Expr *e, Arena *arena) {
+    PrimType prim_type = std::get<0>(e->prim);
+    ExprArray &args = std::get<1>(e->prim);
+    if (prim_type != PrimType::ADD && prim_type != PrimType::MUL) return e;
+
+    size_t num_const = 0;
+    while (num_const < args.size() && is_const(args[num_const]))
+        num_const++;
+    if (num_const < 2) return e;
+
+    Expr *folded = nullptr;
+    try {
+        ExprArray prefix = { args.data, num_const };
+        folded = make_const(Expr(prim_type, prefix).eval(NO_BINDING,
+                                                         nullptr), arena);
+    }
+    catch (const char*)         { return e; }
+    catch (const std::string &) { return e; }
+    if (folded == nullptr) return e;
+
+    size_t len = args.size() - num_const + 1;
+    ExprArray rest = { arena->allocate_array(len), len };
+    rest[0] = folded;
+    for (size_t i = 1; i < len; i++) rest[i] = args[num_const + i - 1];
+
+    stats.folded++;
+    stats.eliminated += num_const - 1;
+    return arena_new<Expr>(arena, prim_type, rest);
+}
+
+/**
+ * Fold a lambda body
+ * @param body Pointer to body expression
+ * @param arena Arena of the compilation unit
+ * @returns Pointer to the folded body
+ */
+Expr *Optimizer::optimize_lambda(Expr *body, Arena *arena) {
+    return fold_expr(body, arena);
+}
+
+const OptStats &Optimizer::get_stats() {
+    return stats;
+}
@@ -0,0 +1,52 @@
+/*============================================================================
+ *  nanoscheme
+ *  Copyright (c) 2019-2020 - Trung Truong
+ *
+ *  File name: optimizer.h
+ *  Description: Header file for `Optimizer` class, which folds constant
+ *  expressions of lambda bodies
+ *
+ *==========================================================================*/
+#include <atomic>
+#include <cstddef>
+
+#include "arena.h"
+#include "expr.h"
+#ifndef OPTIMIZER_H_
+#define OPTIMIZER_H_
+
+/* Work done by the optimizer since the start of the program */
+struct OptStats {
+    std::atomic<size_t> folded;     // Primitives reduced to a constant
+    std::atomic<size_t> pruned;     // 'if' reduced to one of its branches
+    std::atomic<size_t> eliminated; // Nodes no longer reachable from a body
+};
+
+/*============================================================================
+ *  Optimizer class
+ *===========================================================================*/
+class Optimizer {
+private:
+    static OptStats stats;
+
+    /* Helpers */
+    static bool is_const(Expr *e);
+    static bool is_pure(PrimType t);
+    static size_t count_nodes(Expr *e);
+    static Expr *make_const(Value v, Arena *arena);
+
+    /* Specific type optimizers */
+    static Expr *fold_expr(Expr *e, Arena *arena);
+    static Expr *fold_prim(Expr *e, Arena *arena);
+    static Expr *fold_if(Expr *e);
+    static Expr *fold_prefix(Expr *e, Arena *arena);
+
+public:
+    /* Lambda bodies are folded when set, see `--no-fold` */
+    static bool enabled;
+
+    static Expr *optimize_lambda(Expr *body, Arena *arena);
+    static const OptStats &get_stats();
+};
+
+#endif
@@ -6,7 +6,13 @@
  *  Description: Implementation of parsing functions
  * 
  *==========================================================================*/
-#include "expr.h"
+#include <cerrno>
+#include <cstdlib>
+#include "arena.h"
+#include "compiler.h"
+#include "memo.h"
+#include "optimizer.h"
+#include "parser.h"
 
 /* Parsing table */
 const std::unordered_map<std::string, PrimType> token_table {
@@ -26,9 +32,61 @@ const std::unordered_map<std::string, PrimType> token_table {
     { "filter"  , PrimType::FILTER },  { "append"    , PrimType::APPEND  },
     { "sin"     , PrimType::SIN    },  { "cos"       , PrimType::COS     },
     { "tan"     , PrimType::TAN    },  { "sqrt"      , PrimType::SQRT    },
-    { "log"     , PrimType::LOG    },  { "abs"       , PrimType::ABS     }
+    { "log"     , PrimType::LOG    },  { "abs"       , PrimType::ABS     },
+    { "pmap"    , PrimType::PMAP   },  { "pfilter"   , PrimType::PFILTER },
+    { "define-memo", PrimType::DEFINE_MEMO },
+    { "make-f64vector", PrimType::MAKE_F64VEC },
+    { "make-i64vector", PrimType::MAKE_I64VEC },
+    { "list->f64vector", PrimType::LIST_TO_F64VEC },
+    { "list->i64vector", PrimType::LIST_TO_I64VEC },
+    { "vector->list", PrimType::VEC_TO_LIST },
+    { "vector?" , PrimType::IS_VEC },  { "vector-length", PrimType::VEC_LEN },
+    { "vector-ref", PrimType::VEC_REF },
+    { "vector-set!", PrimType::VEC_SET },
+    { "vector-sum", PrimType::VEC_SUM },
+    { "vector-dot", PrimType::VEC_DOT },
+    { "vector-min", PrimType::VEC_MIN },
+    { "vector-max", PrimType::VEC_MAX },
+    { "vector-map", PrimType::VEC_MAP },
+    { "make-hash-table", PrimType::MAKE_HASH },
+    { "hash-ref", PrimType::HASH_REF },
+    { "hash-set!", PrimType::HASH_SET },
+    { "hash-remove!", PrimType::HASH_REMOVE },
+    { "hash-count", PrimType::HASH_COUNT },
+    { "string-append", PrimType::STR_APPEND },
+    { "string-length", PrimType::STR_LEN },
+    { "substring", PrimType::SUBSTRING },
+    { "string->number", PrimType::STR_TO_NUM },
+    { "number->string", PrimType::NUM_TO_STR },
+    { "string-split", PrimType::STR_SPLIT },
+    { "runtime-stats", PrimType::RUNTIME_STATS }
 };
 
+/**
+ * Mark the symbols of the names in the parsing table as keywords, so that
+ * dispatching on the head of a form needs no lookup
+ * @returns true
+ */
+static bool intern_keywords() {
+    for (const auto &entry : token_table) {
+        Symbol *sym = Symbol::intern(entry.first);
+        sym->keyword = entry.second;
+        sym->is_keyword = true;
+    }
+    return true;
+}
+
+/**
+ * Get the name of a primitive, as written in source
+ * @param type Primitive type
+ * @returns Name in the parsing table
+ */
+std::string prim_name(PrimType type) {
+    for (const auto &entry : token_table)
+        if (entry.second == type) return entry.first;
+    return "<primitive>";
+}
+
 /**
  * Check if string is int. If string is int, parse the string
  * @param expr String of expression
@@ -36,9 +94,11 @@ const std::unordered_map<std::string, PrimType> token_table {
  * @returns If string is int type, return true and pass parsed string by 
  * reference. Else, return false.
  */
-static inline bool is_int(std::string expr, int64_t &parsed) {
-    try { parsed = std::stol(expr, nullptr); return true; }
-    catch(...) { return false; }
+static inline bool is_int(const std::string &expr, int64_t &parsed) {
+    char *end = nullptr;
+    errno = 0;
+    parsed = strtoll(expr.c_str(), &end, 10);
+    return end != expr.c_str() && errno == 0;
 }
 
 /**
@@ -48,366 +108,446 @@ static inline bool is_int(std::string expr, int64_t &parsed) {
  * @returns If string is float type, return true and pass parsed string by 
  * reference. Else, return false.
  */
-static inline bool is_float(std::string expr, double &parsed) {
-    try { 
-        parsed = std::stod(expr, nullptr); 
-        if (expr.find('.') == std::string::npos) return false; 
-        return true; 
-    }
-    catch(...) { return false; }
+static inline bool is_float(const std::string &expr, double &parsed) {
+    if (expr.find('.') == std::string::npos) return false;
+    char *end = nullptr;
+    errno = 0;
+    parsed = strtod(expr.c_str(), &end);
+    return end != expr.c_str() && errno == 0;
 }
 
+/*============================================================================
+ *  Lexical scopes
+ *===========================================================================*/
 /**
- * Find the closest word in the string before encountering a space
- * or a new line character
- * @param expr String of expression
- * @param parsed Reference to parsed string
- * @returns The next position on the expression string from where the parsed
- * string ends
+ * Parameters of a lambda whose body is being built. Scopes live on the
+ * parser's stack and are chained from the innermost lambda outwards.
+ *
+ * Procedures are flat closures: a parameter of an enclosing lambda is
+ * copied into the procedure when it is made, instead of being reached
+ * through the frames of the enclosing calls. `captures` lists the
+ * variables copied, each with its address in the frame the lambda is
+ * evaluated in. It grows while the body is built, and is only appended
+ * to, so the addresses already handed out stay valid.
  */
-static size_t read_til_space(std::string expr, std::string &parsed) {
-    size_t idx = 0;
-    std::string curr_str = "";
-
-    while (idx < expr.size()) {
-        if (expr[idx] == ' ' || expr[idx] == '\n' || expr[idx] == ')') 
-            break;
-        else curr_str += expr[idx];
-        idx++;
-    }
-    parsed = curr_str;
-    return idx;
-}
+struct Scope {
+    std::vector<const Symbol*> names;
+    const Scope *parent;
+    mutable std::vector<std::tuple<const Symbol*, size_t, size_t>> captures;
+};
 
 /**
- * Find the closest expression in the string before encountering a matching
- * bracket. For every '"', there must be a matching '"' in argument string,
- * else an Exception is thrown.
- * @param expr String of expression
- * @param parsed Reference to parsed string
- * @returns The next position on the expression string from where the parsed
- * string ends
+ * Resolve a variable to its lexical address. At runtime the frame of a
+ * call holds the arguments of the procedure at depth 0, and the variables
+ * it captured at depth 1. A parameter of an enclosing lambda is captured
+ * by every lambda between its use and the lambda binding it.
+ * @param scope Innermost enclosing scope, nullptr outside of any lambda
+ * @param name Variable name
+ * @param depth Reference to number of frames between use and binding
+ * @param slot Reference to index of the variable in its frame
+ * @returns If variable is a parameter of an enclosing lambda, return true
+ * and pass its address by reference. Else, return false.
  */
-static size_t read_til_end_quote(std::string expr, std::string &parsed) {
-    size_t idx = expr.find('\"');
-    if (idx == std::string::npos) throw "Missing '\"'";
-    std::string curr_str = "\"";
-    bool is_open_quote = true;
-    idx++;
-
-    while (is_open_quote && idx < expr.size()) {
-        if (expr[idx] == '\"') {
-            is_open_quote = !is_open_quote;
-            curr_str += expr[idx];
-        }
-        else curr_str += expr[idx];
-        idx++;
-    }
-    if (is_open_quote) throw "Unmatching quote \n>>> '" + expr + "'";
-    parsed = curr_str;
-    return idx;
+static bool resolve_local(const Scope *scope, const Symbol *name,
+                          size_t &depth, size_t &slot) {
+    if (scope == nullptr) return false;
+
+    // Search backwards so that the last duplicate parameter wins
+    depth = 0;
+    for (slot = scope->names.size(); slot-- > 0;)
+        if (scope->names[slot] == name) return true;
+
+    size_t outer_depth, outer_slot;
+    if (!resolve_local(scope->parent, name, outer_depth, outer_slot))
+        return false;
+    depth = 1;
+    for (slot = 0; slot < scope->captures.size(); slot++)
+        if (std::get<0>(scope->captures[slot]) == name) return true;
+    scope->captures.push_back(std::make_tuple(name, outer_depth,
+                                              outer_slot));
+    return true;
 }
 
+static Expr *build_form(TokenStream &ts, size_t idx, Env *env,
+                        Arena *arena, const Scope *scope);
+static Expr *make_memo_lambda(TokenStream &ts, size_t idx, Env *env,
+                              Arena *arena);
+
+/*============================================================================
+ *  Abstract Syntax Tree (AST) implementation
+ *===========================================================================*/
 /**
- * Find the closest expression in the string before encountering a matching
- * bracket. For every '(', there must be a matching ')' in argument string,
- * else an Exception is thrown.
- * @param expr String of expression
- * @param parse Reference to parsed string
- * @returns The next position on the expression string from where the parsed
- * string ends
+ * Helper function - generate variable expression
+ * @param sym Symbol of the variable
+ * @param env Pointer to env
+ * @param arena Arena of the compilation unit
+ * @param scope Innermost enclosing lambda scope
+ * @returns Pointer to local variable, bound value or unbound symbol
  */
-static size_t read_til_end_bracket(std::string expr, std::string &parsed) {
-    size_t idx = expr.find('(');
-    if (idx == std::string::npos) throw "Missing '('";
-    std::string curr_str = "(";
-    int bracket_stack = 1;
-    idx++;
-
-    while (bracket_stack != 0 && idx < expr.size()) {
-        if (expr[idx] == '(')      { bracket_stack++; curr_str += expr[idx]; }
-        else if (expr[idx] == ')') { bracket_stack--; curr_str += expr[idx]; }
-        else                       { curr_str += expr[idx]; }
-        idx++;
+static Expr *make_symbol(const Symbol *sym, Env *env, Arena *arena,
+                         const Scope *scope) {
+    // Parameters of enclosing lambdas shadow everything else and are
+    // resolved to their (depth, slot) address.
+    // Return expression that variable points to if variable is binded to env
+    // Else return a new unbinded symbol
+    size_t depth, slot;
+    if (resolve_local(scope, sym, depth, slot))
+        return arena_new<Expr>(arena, sym, depth, slot);
+
+    Expr *var = env->find_var(sym);
+    if (var != nullptr) {
+        if (var->get_expr_type() == ExpType::PROC)      return var;
+        if (var->get_expr_type() == ExpType::PRIM &&
+            var->get_prim_type() == PrimType::LAMBDA)   return var;
+        
+        return arena_new<Expr>(arena,
+            var->eval(NO_BINDING, nullptr).to_expr());
     }
-    if (bracket_stack != 0) throw "Unmatching brackets \n>>> '" + expr + "'";
-    parsed = curr_str;
-    return idx;
+    else return arena_new<Expr>(arena, sym, nullptr);
 }
 
 /**
- * Parses expression from a given input string
- * @param expr String of expression - format: `(<op> <args1> <args2> ..)`
- * @returns A vector containing all parsed expression string from input.
- * Exception is thrown if input string cannot be parsed (syntax error)
+ * Helper function - intern the identifier of an atom
+ * @param text Text of the atom
+ * @returns Pointer to symbol, or nullptr if the atom is a number or literal
  */
-std::vector<std::string> parse_expr(std::string expr) {
-    if (expr.size() == 0) 
-        throw "Unable to parse empty string";
-    
-    size_t open_brack = expr.find('(');
-    size_t close_brack = expr.find_last_of(')');
-
-    if (open_brack == std::string::npos || close_brack == std::string::npos)
-        throw "Unmatching brackets \n>>> '" + expr + "'";
-
-    size_t idx = open_brack + 1;
-    std::vector<std::string> res;
-
-    while (idx < close_brack) {
-        if (expr[idx] == '(') {
-            std::string parsed = "";
-            int cursor = idx;
-            idx += read_til_end_bracket(expr.substr(cursor), parsed);
-            res.push_back(parsed);
-        }
-        else if (expr[idx] == '\"') {
-            std::string parsed = "";
-            int cursor = idx;
-            idx += read_til_end_quote(expr.substr(cursor), parsed);
-            res.push_back(parsed);
-        }
-        else if (expr[idx] == '\'' && expr[idx+1] == '(') {
-            std::string parsed = "";
-            idx++;
-            int cursor = idx;
-            idx += read_til_end_bracket(expr.substr(cursor), parsed);
-            res.push_back("\'" + parsed);
-        }
-        else if (expr[idx] == ';') {
-            while (idx < close_brack && expr[idx] != '\n') idx++;
-        }
-        else if (expr[idx] == ' ' || expr[idx] == '\n') {
-            idx++;
-        }
-        else if (expr[idx] == ')') throw "Unmatching ')'";
-        else {
-            std::string parsed = "";
-            int cursor = idx;
-            idx += read_til_space(expr.substr(cursor), parsed);
-            res.push_back(parsed);
-        }
-    }
-    return res;
+static const Symbol *atom_symbol(const std::string &text) {
+    int64_t parsed_int;
+    double parsed_float;
+    BigInt parsed_big;
+    if (is_float(text, parsed_float) || is_int(text, parsed_int) ||
+        BigInt::parse(text, parsed_big))
+        return nullptr;
+    if (text == "#t" || text == "#f" || text == "nil") return nullptr;
+    return Symbol::intern(text);
 }
 
-/*============================================================================
- *  Abstract Syntax Tree (AST) implementation
- *===========================================================================*/
-/* Forward declare build_AST funtion */
-Expr *build_AST(std::string expr, Env *env);
-
 /**
  * Helper function - generate number/string/literal/symbol expression 
- * @param expr Input expression string
+ * @param ts Token stream
+ * @param idx Token index of an atom or string token
  * @param env Pointer to env
+ * @param arena Arena of the compilation unit
+ * @param scope Innermost enclosing lambda scope
  * @returns Pointer to allocated number/string/literal/symbol expression
  */
-static Expr *make_const(std::string expr, Env *env) {
+static Expr *make_const(TokenStream &ts, size_t idx, Env *env,
+                        Arena *arena, const Scope *scope) {
+    std::string expr = ts.text(idx);
+
     /* string expression */
-    if (expr.size() > 1 && expr[0] == '"' && expr[expr.size()-1] == '"')
-        return new Expr(expr);
-    
-    auto tokens = parse_expr("(" + expr + ")");
-    if (tokens.size() != 1) throw "Invalid syntax at \n>>> " + expr;
+    if (ts.at(idx).type == TokType::STRING)
+        return arena_new<Expr>(arena, StrView(expr.data() + 1,
+                                              expr.size() - 2));
+
     int64_t parsed_int;
     double parsed_float;
+    BigInt parsed_big;
 
     /* numbers and literals */
-    if (is_float(expr, parsed_float))       return new Expr(parsed_float);
-    else if (is_int(expr, parsed_int))      return new Expr(parsed_int);
-    else if (expr == "#t")                  return new Expr(LitType::TRUE);
-    else if (expr == "#f")                  return new Expr(LitType::FALSE);
-    else if (expr == "nil")                 return new Expr(LitType::NIL);
+    if (is_float(expr, parsed_float))
+        return arena_new<Expr>(arena, parsed_float);
+    else if (is_int(expr, parsed_int))
+        return arena_new<Expr>(arena, parsed_int);
+    else if (BigInt::parse(expr, parsed_big))
+        return arena_new<Expr>(arena, parsed_big);
+    else if (expr == "#t")  return arena_new<Expr>(arena, LitType::TRUE);
+    else if (expr == "#f")  return arena_new<Expr>(arena, LitType::FALSE);
+    else if (expr == "nil") return arena_new<Expr>(arena, LitType::NIL);
     
     /* symbol expression */
-    // Return expression that variable points to if variable is binded to env
-    // Else return a new unbinded symbol
-    else {
-        Expr *var = env->find_var(expr);
-        if (var != nullptr) {
-            if (var->get_expr_type() == ExpType::PROC)      return var;
-            if (var->get_expr_type() == ExpType::PRIM &&
-                var->get_prim_type() == PrimType::LAMBDA)   return var;
-            
-            return new Expr(var->eval(NO_BINDING, nullptr));
-        }
-        else return new Expr(expr, nullptr);
+    else return make_symbol(Symbol::intern(expr), env, arena, scope);
+}
+
+/**
+ * Helper function - generate quoted list expression. Nested brackets
+ * inside the quote are quoted lists as well.
+ * @param ts Token stream
+ * @param idx Token index of a `QUOTE` or `LPAREN` token
+ * @param env Pointer to env
+ * @param arena Arena of the compilation unit
+ * @returns Pointer to allocated list expression
+ */
+static Expr *make_list(TokenStream &ts, size_t idx, Env *env,
+                       Arena *arena) {
+    std::vector<Expr*> *list(arena_new<std::vector<Expr*>>(arena));
+    for (size_t child : ts.children(idx)) {
+        TokType type = ts.at(child).type;
+        if (type == TokType::LPAREN || type == TokType::QUOTE)
+            list->push_back(make_list(ts, child, env, arena));
+        else
+            list->push_back(make_const(ts, child, env, arena, nullptr));
     }
+    return arena_new<Expr>(arena, list);
 }
 
 /**
  * Helper function - generate list expression containing params literals
- * @param expr Input expression string
+ * @param ts Token stream
+ * @param idx Token index of the params form
+ * @param arena Arena of the compilation unit
  * @returns Pointer to allocated list expression
  */
-static Expr *make_params_list(std::string expr) {
-    auto tokens = parse_expr(expr);
-    std::vector<Expr*> *list(new std::vector<Expr*>());
-    for (auto &token : tokens) {
-        list->push_back(new Expr(token));
+static Expr *make_params_list(TokenStream &ts, size_t idx,
+                              Arena *arena) {
+    std::vector<Expr*> *list(arena_new<std::vector<Expr*>>(arena));
+    for (size_t child : ts.children(idx)) {
+        list->push_back(arena_new<Expr>(arena, ts.text(child)));
     }
-    return new Expr(list);
+    return arena_new<Expr>(arena, list);
 }
 
 /**
  * Helper function - generate primitive 'define' or 'set' expression 
- * @param type Either PrimType::DEFINE or PrimType::SET
- * @param tokens Vector containing parsed string tokens for a 'define' or
- * 'set' expression
+ * @param type PrimType::DEFINE, PrimType::SET or PrimType::DEFINE_MEMO
+ * @param ts Token stream
+ * @param forms Token indices of the sub-forms of a 'define' or 'set' 
+ * expression
  * @param env Pointer to env
- * @returns Pointer to allocated expression for var assignment primitive
+ * @param arena Arena of the compilation unit
+ * @returns Pointer to allocated expression for var assignment primitive.
+ * The assignment is evaluated in `env` right away, so the assigned value
+ * is built outside of any enclosing lambda scope.
  */
-static Expr *make_var_assignment(PrimType type, 
-                        std::vector<std::string> &tokens, Env *env) {
+static Expr *make_var_assignment(PrimType type, TokenStream &ts,
+                                 std::vector<size_t> &forms, Env *env,
+                                 Arena *arena) {
     std::vector<Expr*> args_list {};
-    if (tokens.size() != 3 && type == PrimType::DEFINE)
+    if (forms.size() != 3 && type == PrimType::DEFINE)
         throw "Invalid number of arguments for 'define'";
-    if (tokens.size() != 3 && type == PrimType::SET)
+    if (forms.size() != 3 && type == PrimType::SET)
         throw "Invalid number of arguments for 'set!'";
+    if (forms.size() != 3 && type == PrimType::DEFINE_MEMO)
+        throw "Invalid number of arguments for 'define-memo'";
     
-    Expr sym_name = Expr(tokens[1]);
-    env->add_key_value_pair(tokens[1], nullptr);
-    Expr *sym_val = build_AST(tokens[2], env);
+    const Symbol *name = Symbol::intern(ts.text(forms[1]));
+    Expr sym_name = Expr(name, nullptr);
+    env->add_key_value_pair(name, nullptr);
+    Expr *sym_val = type == PrimType::DEFINE_MEMO
+                  ? make_memo_lambda(ts, forms[2], env, arena)
+                  : build_form(ts, forms[2], env, arena, nullptr);
 
     args_list.push_back(&sym_name);
     args_list.push_back(sym_val);
     
     // Add variable binding to environment
-    Expr symbol = Expr(type, &args_list).eval(NO_BINDING, env);
-    return new Expr(symbol);
+    if (type == PrimType::DEFINE_MEMO) type = PrimType::DEFINE;
+    ExprArray args = { args_list.data(), args_list.size() };
+    Value symbol = Expr(type, args).eval(NO_BINDING, env);
+    return arena_new<Expr>(arena, symbol.to_expr());
 }
 
 /**
  * Helper function - generate primitive 'lambda' expression 
- * @param tokens Vector containing parsed string tokens for a 'lambda' 
- * expression
+ * @param ts Token stream
+ * @param forms Token indices of the sub-forms of a 'lambda' expression
  * @param env Pointer to env
+ * @param arena Arena of the compilation unit
+ * @param scope Innermost enclosing lambda scope
+ * @param memo Whether the body keeps a cache of its results, see `Memo`
  * @returns Pointer to allocated expression for lambda primitive
  */
-static Expr *make_lambda(std::vector<std::string> &tokens, Env *env) {
-    std::vector<Expr*> *args_list(new std::vector<Expr*>());
-
-    if (tokens.size() != 3) throw "Missing arguments for 'lambda'";
-    std::string _params = tokens[1];
-    std::string _body   = tokens[2];
-
-    if (_params[0] != '(' || _params[_params.size()-1] != ')')
+static Expr *make_lambda(TokenStream &ts, std::vector<size_t> &forms,
+                         Env *env, Arena *arena, const Scope *scope,
+                         bool memo) {
+    if (forms.size() != 3) throw "Missing arguments for 'lambda'";
+    if (ts.at(forms[1]).type != TokType::LPAREN)
         throw "Missing brackets for closure argument";
-    if (_body[0] != '(' || _body[_body.size()-1] != ')')
+    if (ts.at(forms[2]).type != TokType::LPAREN)
         throw "Missing brackets for closure body";
 
-    Expr *params = make_params_list(_params);
-    Expr *body   = build_AST(_body, env);
+    // Body is built in a new scope holding the lambda's parameters
+    Scope body_scope = { {}, scope, {} };
+    for (size_t param : ts.children(forms[1]))
+        body_scope.names.push_back(Symbol::intern(ts.text(param)));
+
+    Expr *params = make_params_list(ts, forms[1], arena);
+    Expr *body = build_form(ts, forms[2], env, arena, &body_scope);
+    if (Optimizer::enabled) body = Optimizer::optimize_lambda(body, arena);
+    if (VM::enabled) body = Compiler::compile_lambda(body, arena);
+    if (memo) body = arena_new<Expr>(arena, new Memo(body));
+
+    // Captured variables are a third argument, a list of the addresses
+    // they are copied from, see `Expr::make_closure`
+    size_t num_args = body_scope.captures.empty() ? 2 : 3;
+    ExprArray args = { arena->allocate_array(num_args), num_args };
+    args[0] = params;
+    args[1] = body;
+    if (num_args == 3) {
+        std::vector<Expr*> *list(arena_new<std::vector<Expr*>>(arena));
+        for (const auto &capture : body_scope.captures)
+            list->push_back(arena_new<Expr>(arena, std::get<0>(capture),
+                                            std::get<1>(capture),
+                                            std::get<2>(capture)));
+        args[2] = arena_new<Expr>(arena, list);
+    }
+    return arena_new<Expr>(arena, PrimType::LAMBDA, args);
+}
 
-    args_list->push_back(params);
-    args_list->push_back(body);
-    return new Expr(PrimType::LAMBDA, args_list);
+/**
+ * Helper function - generate the lambda of a 'define-memo' expression
+ * @param ts Token stream
+ * @param idx Token index of the value of the 'define-memo' expression
+ * @param env Pointer to env
+ * @param arena Arena of the compilation unit
+ * @returns Pointer to allocated expression for lambda primitive, whose
+ * body is memoized
+ */
+static Expr *make_memo_lambda(TokenStream &ts, size_t idx, Env *env,
+                              Arena *arena) {
+    if (ts.at(idx).type != TokType::LPAREN)
+        throw "Non-lambda value for 'define-memo'";
+    std::vector<size_t> forms = ts.children(idx);
+    if (forms.empty() || ts.at(forms[0]).type != TokType::ATOM ||
+        ts.text(forms[0]) != "lambda")
+        throw "Non-lambda value for 'define-memo'";
+    return make_lambda(ts, forms, env, arena, nullptr, true);
 }
 
 /**
  * Helper function - generic dispatcher to generate primitive expression
- * @param tokens Vector containing parsed string tokens for input 
- * expression
+ * @param type Primitive type of the head of the form
+ * @param ts Token stream
+ * @param forms Token indices of the sub-forms of the input expression
  * @param env Pointer to env
+ * @param arena Arena of the compilation unit
+ * @param scope Innermost enclosing lambda scope
  * @returns Pointer to allocated primitive expression
  */
-static Expr *make_prim(std::vector<std::string> &tokens, Env *env) {
-    const auto prim_type = token_table.find(tokens[0]);
-
-    if (prim_type == token_table.end())
-        throw "Undefined primitive type: '" + prim_type->first + "'";
-
+static Expr *make_prim(PrimType type, TokenStream &ts,
+                       std::vector<size_t> &forms, Env *env, Arena *arena,
+                       const Scope *scope) {
     /* var define and assignment */
-    if (prim_type->first == "define" || prim_type->first == "set!")
-        return make_var_assignment(prim_type->second, tokens, env);
+    if (type == PrimType::DEFINE || type == PrimType::SET ||
+        type == PrimType::DEFINE_MEMO)
+        return make_var_assignment(type, ts, forms, env, arena);
     
     /* lambda function */
-    else if (prim_type->first == "lambda")
-        return make_lambda(tokens, env);
+    else if (type == PrimType::LAMBDA)
+        return make_lambda(ts, forms, env, arena, scope, false);
 
     /* other primitives */
     else {
-        std::vector<Expr*> *args_list(new std::vector<Expr*>());
-        for (size_t i = 1; i < tokens.size(); i++)
-            args_list->push_back(build_AST(tokens[i], env));
+        ExprArray args = { arena->allocate_array(forms.size() - 1),
+                           forms.size() - 1 };
+        for (size_t i = 1; i < forms.size(); i++)
+            args[i - 1] = build_form(ts, forms[i], env, arena, scope);
 
-        return new Expr(prim_type->second, args_list);
+        return arena_new<Expr>(arena, type, args);
     }
 }
 
 /**
  * Helper function - generate procedure call expression 
- * @param tokens Vector containing string tokens for procedure call
+ * @param ts Token stream
+ * @param forms Token indices of the sub-forms of the procedure call
  * expression
+ * @param head Symbol of the caller if it is an identifier, else nullptr
  * @param env Pointer to env
+ * @param arena Arena of the compilation unit
+ * @param scope Innermost enclosing lambda scope
  * @returns Pointer to allocated procedure call expression
  */
-Expr *make_proc_call(std::vector<std::string> tokens, Env *env) {
-    std::vector<Expr*> *bindings(new std::vector<Expr*>());
-
-    if (tokens.size() < 2) throw "Too few arguments for procedure call";
-    Expr *caller = build_AST(tokens[0], env);
-
-    for (size_t i = 1; i < tokens.size(); i++)
-        bindings->push_back(build_AST(tokens[i], env));
+static Expr *make_proc_call(TokenStream &ts, std::vector<size_t> &forms,
+                            const Symbol *head, Env *env, Arena *arena,
+                            const Scope *scope) {
+    std::vector<Expr*> *bindings(arena_new<std::vector<Expr*>>(arena));
+
+    if (forms.size() < 2) throw "Too few arguments for procedure call";
+    Expr *caller = head != nullptr
+                 ? make_symbol(head, env, arena, scope)
+                 : build_form(ts, forms[0], env, arena, scope);
+
+    std::vector<Value> values {};
+    for (size_t i = 1; i < forms.size(); i++) {
+        bindings->push_back(build_form(ts, forms[i], env, arena, scope));
+        values.push_back(Value(bindings->back()));
+    }
 
     // If caller has procedure type, evaluate caller with bindings
     if (caller->get_expr_type() == ExpType::PROC)
-        return new Expr((caller->eval(bindings, env)));
+        return arena_new<Expr>(arena, caller->eval(&values, env).to_expr());
 
     // If caller has lambda type, evaluate the caller first to 
     // obtain procedure, then proceed to evaluate procedure
     else if (caller->get_expr_type() == ExpType::PRIM && 
-             caller->get_prim_type() == PrimType::LAMBDA)
-        return new Expr((caller->eval(bindings, env).eval(bindings, env)));
+             caller->get_prim_type() == PrimType::LAMBDA) {
+        Value proc = caller->eval(&values, env);
+        return arena_new<Expr>(arena,
+            proc.obj()->eval(&values, env).to_expr());
+    }
 
     // If caller has symbol type, return new procedure with unbounded symbol.
     // See `expr.cpp::90` for more explanation
     else if (caller->get_expr_type() == ExpType::SYMBOL) {
-        bool found = env->is_in_env(tokens[0]);
-        Expr *found_expr = env->find_var(tokens[0]);
+        const Symbol *name = caller->get_symbol();
+        bool found = env->is_in_env(name);
+        Expr *found_expr = env->find_var(name);
         if (found && found_expr != nullptr) return found_expr;
         else if (found && found_expr == nullptr) 
-            return new Expr(new Expr(bindings), caller, env);
-        else throw "Unknown procedure identifier: '" + tokens[0] + "'";
+            return arena_new<Expr>(arena, arena_new<Expr>(arena, bindings),
+                                   caller, env);
+        else throw "Unknown procedure identifier: '" + name->name + "'";
     }
-    
+
+    // Parameters are not bound yet while the lambda body is built
+    else if (caller->get_expr_type() == ExpType::LOCAL)
+        throw "Unknown procedure identifier: '" + head->name + "'";
+
     // Invalid caller type
-    else throw "'" + tokens[0] + "' cannot be procedurally called";
+    else throw "'" + ts.text(forms[0]) + "' cannot be procedurally called";
 }
 
 /**
- * Recursively generates AST based on input string
- * @param expr String of expressions
+ * Helper function - recursively generates AST from a token stream. Every 
+ * token is visited once, sub-forms are handed down by token index instead
+ * of being re-parsed.
+ * @param ts Token stream
+ * @param idx Token index of the form to build
  * @param env Pointer to Env
+ * @param arena Arena of the compilation unit
+ * @param scope Innermost enclosing lambda scope
  * @returns Pointer to root AST node
  */
-Expr *build_AST(std::string expr, Env *env) {
-    size_t open_brack = expr.find('(');
-    size_t close_brack = expr.find_last_of(')');
+static Expr *build_form(TokenStream &ts, size_t idx, Env *env,
+                        Arena *arena, const Scope *scope) {
+    const Token &tok = ts.at(idx);
 
     /* number - string - literal - symbol expression */
-    if (open_brack == std::string::npos || close_brack == std::string::npos)
-        return make_const(expr, env);
+    if (tok.type == TokType::ATOM || tok.type == TokType::STRING)
+        return make_const(ts, idx, env, arena, scope);
     
     /* list expression */
-    if (expr[0] == '\'') {
-        auto tokens = parse_expr(expr.substr(1));
-        std::vector<Expr*> *list(new std::vector<Expr*>());
-        for (auto &token : tokens) {
-            list->push_back(make_const(token, env));
-        }
-        return new Expr(list);
-    }
+    if (tok.type == TokType::QUOTE)
+        return make_list(ts, idx, env, arena);
 
-    auto tokens = parse_expr(expr);
-    if (tokens.size() == 0) throw "Can't parse expression of length zero";
+    std::vector<size_t> forms = ts.children(idx);
+    if (forms.size() == 0) throw "Can't parse expression of length zero";
 
     /* primitive expression */
-    if (token_table.find(tokens[0]) != token_table.end())
-        return make_prim(tokens, env);
+    const Symbol *head = nullptr;
+    if (ts.at(forms[0]).type == TokType::ATOM) {
+        head = atom_symbol(ts.text(forms[0]));
+        if (head != nullptr && head->is_keyword)
+            return make_prim(head->keyword, ts, forms, env, arena, scope);
+    }
 
     /* procedure call expression */
-    return make_proc_call(tokens, env);
+    return make_proc_call(ts, forms, head, env, arena, scope);
+}
+
+/**
+ * Generate AST of a top-level form. Variables that are parameters of a
+ * lambda are resolved to their lexical address on the way, so evaluating
+ * them never looks up a name.
+ * @param ts Token stream
+ * @param idx Token index of the form to build
+ * @param env Pointer to Env
+ * @param arena Arena of the compilation unit
+ * @returns Pointer to root AST node
+ */
+Expr *build_AST(TokenStream &ts, size_t idx, Env *env, Arena *arena) {
+    static const bool keywords = intern_keywords();
+    (void)keywords;
+    return build_form(ts, idx, env, arena, nullptr);
 }
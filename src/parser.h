@@ -6,8 +6,10 @@
  *  Description: Function signatures for parsing functions
  * 
  *==========================================================================*/
+#include "arena.h"
 #include "env.h"
 #include "expr.h"
+#include "lexer.h"
 
-std::vector<std::string> parse_expr(std::string expr);
-Expr *build_AST(std::string expr, Env *env);
\ No newline at end of file
+Expr *build_AST(TokenStream &ts, size_t idx, Env *env, Arena *arena);
+std::string prim_name(PrimType type);
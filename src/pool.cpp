@@ -0,0 +1,202 @@
+/*============================================================================
+ *  nanoscheme
+ *  Copyright (c) 2019-2020 - Trung Truong
+ *
+ *  File name: pool.cpp
+ *  Description: Implementation of `Pool` class
+ *
+ *  Tasks evaluate expressions, so they allocate. Collection is paused for
+ *  the whole job, since the collector only scans the stack of the main
+ *  thread, and every participant allocates into its own list of objects
+ *  that is handed to the heap once it ran out of tasks. A task that starts
+ *  another job, such as a nested `pmap`, runs it inline, and so does a
+ *  thread of a `Server`, which already allocates into its own list.
+ *
+ *==========================================================================*/
+#include <algorithm>
+#include "gc.h"
+#include "pool.h"
+
+/* Number of participants of the current pool, 0 for one per core */
+static size_t pool_threads = 0;
+
+/* Set while the thread is running tasks of a job */
+static thread_local bool in_job = false;
+
+/* Constructors */
+Pool::Pool(size_t num_threads)
+    : job(nullptr), generation(0), busy(0),
+      stopping(false), failed(false), error(nullptr) {
+    if (num_threads == 0) num_threads = 1;
+    for (size_t i = 0; i < num_threads; i++)
+        workers.emplace_back(new Worker());
+    for (size_t i = 1; i < num_threads; i++)
+        threads.emplace_back(&Pool::loop, this, i);
+}
+
+/* Destructor */
+Pool::~Pool() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread &t : threads) t.join();
+}
+
+/**
+ * Pool used by the parallel primitives. It is created on first use, with
+ * the number of threads set by `set_num_threads`.
+ * @returns Reference to the pool
+ */
+Pool &Pool::current() {
+    static std::unique_ptr<Pool> pool;
+    size_t n = pool_threads;
+    if (n == 0) n = std::max(1u, std::thread::hardware_concurrency());
+    if (pool == nullptr || pool->size() != n) {
+        pool.reset();
+        pool.reset(new Pool(n));
+    }
+    return *pool;
+}
+
+/**
+ * Set the number of threads of the current pool, see `--threads`. Must not
+ * be called while a job runs.
+ * @param n Number of threads, including the calling one. 0 for one thread
+ * per core.
+ * @returns void
+ */
+void Pool::set_num_threads(size_t n) {
+    pool_threads = n;
+}
+
+/* Getters */
+size_t Pool::size() const {
+    return workers.size();
+}
+
+/*============================================================================
+ *  Workers
+ *===========================================================================*/
+/**
+ * Take the next task of a participant, stealing one if its own deque is
+ * empty
+ * @param self Index of the participant
+ * @param task Reference to the task taken
+ * @returns False if no task is left anywhere
+ */
+bool Pool::next_task(size_t self, size_t &task) {
+    {
+        Worker &own = *workers[self];
+        std::lock_guard<std::mutex> guard(own.lock);
+        if (!own.tasks.empty()) {
+            task = own.tasks.back();
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+    for (size_t i = 1; i < workers.size(); i++) {
+        Worker &victim = *workers[(self + i) % workers.size()];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.tasks.empty()) {
+            task = victim.tasks.front();
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Run tasks of the current job until none is left. Once a task failed,
+ * the remaining ones are only drained.
+ * @param self Index of the participant
+ * @returns void
+ */
+void Pool::work(size_t self) {
+    GCLocal local;
+    Heap::current().attach_thread(&local);
+    in_job = true;
+
+    size_t task;
+    while (next_task(self, task)) {
+        if (failed) continue;
+        try {
+            (*job)(task);
+        }
+        catch (...) {
+            std::lock_guard<std::mutex> guard(lock);
+            if (!failed) error = std::current_exception();
+            failed = true;
+        }
+    }
+
+    in_job = false;
+    Heap::current().detach_thread();
+}
+
+/**
+ * Main loop of a pool thread: wait for a job, work on it, report back
+ * @param self Index of the participant
+ * @returns void
+ */
+void Pool::loop(size_t self) {
+    size_t seen = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            wake.wait(guard, [&] {
+                return stopping || generation != seen;
+            });
+            if (stopping) return;
+            seen = generation;
+        }
+        work(self);
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (--busy == 0) done.notify_one();
+        }
+    }
+}
+
+/*============================================================================
+ *  Jobs
+ *===========================================================================*/
+/**
+ * Run every task of a job and wait for all of them. The first exception
+ * thrown by a task is rethrown in the calling thread.
+ * @param num_tasks Number of tasks
+ * @param task Function called with the index of each task, from any thread
+ * @returns void
+ */
+void Pool::run(size_t num_tasks, const std::function<void(size_t)> &task) {
+    GCPause pause;
+    if (in_job || threads.empty() || Heap::is_attached()) {
+        for (size_t i = 0; i < num_tasks; i++) task(i);
+        return;
+    }
+
+    for (size_t i = 0; i < workers.size(); i++) {
+        size_t lo = i * num_tasks / workers.size();
+        size_t hi = (i + 1) * num_tasks / workers.size();
+        for (size_t t = lo; t < hi; t++) workers[i]->tasks.push_back(t);
+    }
+    job = &task;
+    failed = false;
+    error = nullptr;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        generation++;
+        busy = threads.size();
+    }
+    wake.notify_all();
+
+    work(0);
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        done.wait(guard, [&] { return busy == 0; });
+    }
+    job = nullptr;
+    if (error != nullptr) std::rethrow_exception(error);
+}
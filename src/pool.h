@@ -0,0 +1,70 @@
+/*============================================================================
+ *  nanoscheme
+ *  Copyright (c) 2019-2020 - Trung Truong
+ *
+ *  File name: pool.h
+ *  Description: Header file for `Pool` class, a work-stealing thread pool
+ *  running the parallel list primitives
+ *
+ *==========================================================================*/
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#ifndef POOL_H_
+#define POOL_H_
+
+/*============================================================================
+ *  Pool class
+ *===========================================================================*/
+/**
+ * A job is a number of independent tasks, identified by their index. Each
+ * participant starts with a contiguous share of the tasks in its own deque
+ * and takes from its back; once empty, it steals from the front of the
+ * others. The calling thread is one of the participants.
+ */
+class Pool {
+private:
+    struct Worker {
+        std::mutex lock;
+        std::deque<size_t> tasks;
+    };
+
+    std::vector<std::thread> threads;
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const std::function<void(size_t)> *job;
+    size_t generation;
+    size_t busy;
+    bool stopping;
+    std::atomic<bool> failed;
+    std::exception_ptr error;
+
+    /* Workers */
+    bool next_task(size_t self, size_t &task);
+    void work(size_t self);
+    void loop(size_t self);
+
+public:
+    /* Constructors */
+    Pool(size_t num_threads);
+    ~Pool();
+    static Pool &current();
+    static void set_num_threads(size_t n);
+
+    /* Getters */
+    size_t size() const;
+
+    /* Jobs */
+    void run(size_t num_tasks, const std::function<void(size_t)> &task);
+};
+
+#endif
@@ -0,0 +1,332 @@
+/*============================================================================
+ *  nanoscheme
+ *  Copyright (c) 2019-2020 - Trung Truong
+ *
+ *  File name: profiler.cpp
+ *  Description: Implementation of `Profiler` class
+ *
+ *  The timer signal runs on whichever thread was interrupted, so it only
+ *  reads the shadow stack of that thread, which can not change under it,
+ *  and appends to a sample buffer mapped once at start; a slot is reserved
+ *  with an atomic add, nothing is allocated or locked. Samples are turned
+ *  into names when the report is written. Frames of primitives only stay
+ *  in a stack when they are innermost, or when they call procedures like
+ *  'map' does, so that `(+ (f x) 1)` is charged to `f` rather than `+`.
+ *
+ *==========================================================================*/
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <set>
+#include "parser.h"
+#include "profiler.h"
+
+/* Frames kept per thread, deeper ones are counted but not recorded */
+static const size_t MAX_DEPTH = 1 << 20;
+/* Innermost frames recorded per sample */
+static const size_t SAMPLE_DEPTH = 256;
+/* Words of the sample buffer, 128MB mapped but only touched when used */
+static const size_t SAMPLE_WORDS = size_t(1) << 24;
+static const int INTERVAL_US = 1000;
+
+bool Profiler::enabled = false;
+std::string Profiler::folded_path = "nscm.folded";
+std::mutex Profiler::lock;
+std::vector<Profiler::Thread*> Profiler::threads;
+std::unordered_map<uintptr_t, std::string> Profiler::names;
+
+static thread_local Profiler::Thread *current_thread = nullptr;
+
+// A sample is a header, one plus twice its number of frames plus one if
+// frames were left out, followed by the frames from outermost to innermost
+static uintptr_t *samples = nullptr;
+static std::atomic<size_t> sample_end(0);
+static std::atomic<size_t> dropped(0);
+
+/**
+ * Record the shadow stack of the interrupted thread. Async-signal-safe.
+ * @param signum SIGPROF
+ * @returns void
+ */
+static void take_sample(int) {
+    int saved_errno = errno;
+    Profiler::Thread *t = current_thread;
+    size_t depth = t == nullptr ? 0 : t->depth;
+    depth = std::min(depth, MAX_DEPTH);
+    size_t n = std::min(depth, SAMPLE_DEPTH);
+    size_t pos = sample_end.fetch_add(n + 1);
+    if (pos + n + 1 > SAMPLE_WORDS) dropped++;
+    else {
+        for (size_t i = 0; i < n; i++)
+            samples[pos + 1 + i] = t->frames[depth - n + i].id;
+        samples[pos] = 1 + (n << 1) + (depth > n ? 1 : 0);
+    }
+    errno = saved_errno;
+}
+
+/*============================================================================
+ *  Control
+ *===========================================================================*/
+/**
+ * Start sampling every millisecond of CPU time used by the process
+ * @returns void
+ */
+void Profiler::start() {
+    void *mem = mmap(nullptr, SAMPLE_WORDS * sizeof(uintptr_t),
+                     PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mem == MAP_FAILED) throw "Can't map the sample buffer of profiler";
+    samples = static_cast<uintptr_t*>(mem);
+    enabled = true;
+
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_handler = take_sample;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, nullptr);
+
+    struct itimerval timer = { { 0, INTERVAL_US }, { 0, INTERVAL_US } };
+    setitimer(ITIMER_PROF, &timer, nullptr);
+}
+
+/**
+ * Stop sampling. Frames still on the shadow stacks are popped as usual.
+ * @returns void
+ */
+void Profiler::stop() {
+    struct itimerval timer = { { 0, 0 }, { 0, 0 } };
+    setitimer(ITIMER_PROF, &timer, nullptr);
+    signal(SIGPROF, SIG_IGN);
+    enabled = false;
+}
+
+/*============================================================================
+ *  Shadow stack
+ *===========================================================================*/
+/**
+ * Get the shadow stack of the calling thread, creating it on first use.
+ * Stacks are kept until exit, for the report.
+ * @returns Pointer to the thread's stack and counts
+ */
+Profiler::Thread *Profiler::thread() {
+    if (current_thread != nullptr) return current_thread;
+
+    void *mem = mmap(nullptr, MAX_DEPTH * sizeof(Frame),
+                     PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mem == MAP_FAILED) throw "Can't map the shadow stack of profiler";
+    Thread *t = new Thread();
+    t->frames = static_cast<Frame*>(mem);
+    t->depth = 0;
+    t->toplevel_allocs = 0;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        threads.push_back(t);
+    }
+    // Published last, the timer signal may read it at any point
+    std::atomic_signal_fence(std::memory_order_release);
+    current_thread = t;
+    return t;
+}
+
+size_t Profiler::depth() {
+    return thread()->depth;
+}
+
+void Profiler::push(uintptr_t id) {
+    Thread *t = thread();
+    size_t d = t->depth;
+    if (d < MAX_DEPTH) t->frames[d] = Frame { id, 0 };
+    std::atomic_signal_fence(std::memory_order_release);
+    t->depth = d + 1;
+}
+
+/**
+ * Replace the innermost frame, for a call in tail position
+ * @param id Procedure or primitive
+ * @returns void
+ */
+void Profiler::replace(uintptr_t id) {
+    Thread *t = thread();
+    size_t d = t->depth;
+    if (d == 0 || d > MAX_DEPTH) return;
+    flush(t, t->frames[d - 1]);
+    t->frames[d - 1] = Frame { id, 0 };
+}
+
+void Profiler::pop_to(size_t depth) {
+    Thread *t = thread();
+    while (t->depth > depth) {
+        size_t d = t->depth - 1;
+        if (d < MAX_DEPTH) flush(t, t->frames[d]);
+        t->depth = d;
+    }
+}
+
+/**
+ * Count an allocation on the innermost frame of the calling thread
+ * @returns void
+ */
+void Profiler::count_alloc() {
+    Thread *t = thread();
+    size_t d = t->depth;
+    if (d == 0) t->toplevel_allocs++;
+    else if (d <= MAX_DEPTH) t->frames[d - 1].allocs++;
+}
+
+/**
+ * Take back the last allocation counted on the innermost frame of the
+ * calling thread. The frame of a call is allocated while its caller is
+ * innermost, so it is taken back from the caller and counted again once
+ * the callee is entered.
+ * @returns void
+ */
+void Profiler::uncount_alloc() {
+    Thread *t = thread();
+    size_t d = t->depth;
+    if (d == 0) {
+        if (t->toplevel_allocs > 0) t->toplevel_allocs--;
+    }
+    else if (d <= MAX_DEPTH && t->frames[d - 1].allocs > 0)
+        t->frames[d - 1].allocs--;
+}
+
+/**
+ * Add a popped frame to the counts of its thread
+ * @param t Thread
+ * @param f Frame
+ * @returns void
+ */
+void Profiler::flush(Thread *t, const Frame &f) {
+    Counts &c = t->counts[f.id];
+    c.calls++;
+    c.allocs += f.allocs;
+}
+
+/*============================================================================
+ *  Names and report
+ *===========================================================================*/
+/**
+ * Name the procedures of a lambda after the symbol it is bound to
+ * @param sym Symbol
+ * @param val Bound expression, ignored unless it is a lambda
+ * @returns void
+ */
+void Profiler::name(const Symbol *sym, const Expr *val) {
+    if (val->type != ExpType::PRIM ||
+        std::get<0>(val->prim) != PrimType::LAMBDA ||
+        std::get<1>(val->prim).size() < 2) return;
+    std::lock_guard<std::mutex> guard(lock);
+    names[proc_id(std::get<1>(val->prim)[1])] = sym->name;
+}
+
+std::string Profiler::name_of(uintptr_t id) {
+    if (id & 1) return prim_name(PrimType(id >> 4));
+    if (id == GC_ID) return "[gc]";
+    auto itr = names.find(id);
+    return itr == names.end() ? "<lambda>" : itr->second;
+}
+
+/* Primitives that call procedures, kept in stacks when not innermost */
+static bool calls_procedures(uintptr_t id) {
+    return id == Profiler::prim_id(PrimType::MAP) ||
+           id == Profiler::prim_id(PrimType::FILTER) ||
+           id == Profiler::prim_id(PrimType::PMAP) ||
+           id == Profiler::prim_id(PrimType::PFILTER);
+}
+
+/**
+ * Write the flat profile to a stream, and the samples as folded stacks,
+ * one `outer;..;inner count` line per distinct stack, to `folded_path`
+ * @param out Stream of the flat profile
+ * @returns void
+ */
+void Profiler::report(std::ostream &out) {
+    struct Entry {
+        size_t self;
+        size_t total;
+        size_t calls;
+        size_t allocs;
+    };
+    std::lock_guard<std::mutex> guard(lock);
+    std::map<std::string, Entry> entries;
+    std::map<std::string, size_t> folded;
+
+    size_t num_samples = 0;
+    size_t end = std::min(sample_end.load(), SAMPLE_WORDS);
+    std::vector<std::string> stack;
+    std::set<std::string> seen;
+    for (size_t pos = 0; pos < end && samples[pos] != 0; ) {
+        size_t header = samples[pos] - 1;
+        size_t n = header >> 1;
+        stack.clear();
+        if (header & 1) stack.push_back("[truncated]");
+        for (size_t i = 0; i < n; i++) {
+            uintptr_t id = samples[pos + 1 + i];
+            if ((id & 1) && i + 1 < n && !calls_procedures(id)) continue;
+            stack.push_back(name_of(id));
+        }
+        if (stack.empty()) stack.push_back("[toplevel]");
+        pos += n + 1;
+        num_samples++;
+
+        std::string key;
+        seen.clear();
+        for (const std::string &s : stack) {
+            key += (key.empty() ? "" : ";") + s;
+            if (seen.insert(s).second) entries[s].total++;
+        }
+        entries[stack.back()].self++;
+        folded[key]++;
+    }
+
+    for (Thread *t : threads) {
+        entries["[toplevel]"].allocs += t->toplevel_allocs;
+        for (const auto &count : t->counts) {
+            Entry &e = entries[name_of(count.first)];
+            e.calls += count.second.calls;
+            e.allocs += count.second.allocs;
+        }
+    }
+
+    std::ofstream file(folded_path);
+    for (const auto &stack : folded)
+        file << stack.first << " " << stack.second << "\n";
+
+    std::vector<std::pair<std::string, Entry>> rows(entries.begin(),
+                                                    entries.end());
+    std::stable_sort(rows.begin(), rows.end(),
+        [](const std::pair<std::string, Entry> &a,
+           const std::pair<std::string, Entry> &b) {
+            if (a.second.self != b.second.self)
+                return a.second.self > b.second.self;
+            return a.second.total > b.second.total;
+        });
+
+    out << "Profile samples:     " << num_samples << " of "
+        << INTERVAL_US / 1000 << " ms, " << dropped.load() << " dropped\n"
+        << "Profile stacks:      "
+        << (file ? folded_path : "can't write '" + folded_path + "'")
+        << "\n"
+        << std::setw(8) << "self" << std::setw(8) << "total"
+        << std::setw(12) << "calls" << std::setw(12) << "allocs"
+        << "  name\n";
+    double scale = num_samples == 0 ? 0.0 : 100.0 / num_samples;
+    out << std::fixed << std::setprecision(1);
+    for (const auto &row : rows) {
+        out << std::setw(7) << row.second.self * scale << "%"
+            << std::setw(7) << row.second.total * scale << "%"
+            << std::setw(12) << row.second.calls
+            << std::setw(12) << row.second.allocs
+            << "  " << row.first << "\n";
+    }
+    out << std::defaultfloat;
+}
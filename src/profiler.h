@@ -0,0 +1,116 @@
+/*============================================================================
+ *  nanoscheme
+ *  Copyright (c) 2019-2020 - Trung Truong
+ *
+ *  File name: profiler.h
+ *  Description: Header file for `Profiler` class, the sampling profiler of
+ *  Scheme procedures and primitives
+ *
+ *==========================================================================*/
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "expr.h"
+#ifndef PROFILER_H_
+#define PROFILER_H_
+
+/*============================================================================
+ *  Profiler class
+ *===========================================================================*/
+/**
+ * Every thread keeps a shadow stack of the procedures and primitives it is
+ * evaluating. A procedure is identified by its body and named after the
+ * symbol 'define' or 'set!' bound its lambda to; a primitive by its type.
+ * A timer interrupts the program every millisecond of CPU time and copies
+ * the shadow stack of the interrupted thread into a sample buffer, and
+ * allocations are counted on the innermost frame when they are made. The
+ * frame of a call is made before the callee is entered, so its evaluators
+ * move that allocation to the callee, see `uncount_alloc`.
+ *
+ * Nothing is recorded unless `enabled` is set, which `start` does, so the
+ * evaluators only test the flag when profiling is off.
+ */
+class Profiler {
+public:
+    struct Frame {
+        uintptr_t id;
+        size_t allocs;                  // Made while innermost
+    };
+    struct Counts {
+        size_t calls;
+        size_t allocs;
+    };
+
+    /* Shadow stack and counts of one thread */
+    struct Thread {
+        Frame *frames;
+        volatile size_t depth;          // Read by the timer signal
+        std::unordered_map<uintptr_t, Counts> counts;
+        size_t toplevel_allocs;
+    };
+
+private:
+    static std::mutex lock;
+    static std::vector<Thread*> threads;
+    static std::unordered_map<uintptr_t, std::string> names;
+
+    static Thread *thread();
+    static void flush(Thread *t, const Frame &f);
+    static std::string name_of(uintptr_t id);
+
+public:
+    static bool enabled;
+    static std::string folded_path;
+
+    static void start();
+    static void stop();
+    static void report(std::ostream &out);
+
+    /* Names of procedures, recorded when their lambda is bound */
+    static void name(const Symbol *sym, const Expr *val);
+    static uintptr_t proc_id(const Expr *body) {
+        return reinterpret_cast<uintptr_t>(body);
+    }
+    static uintptr_t prim_id(PrimType type) {
+        return (uintptr_t(type) << 4) | 1;
+    }
+    static const uintptr_t GC_ID = 2;   // Collections, named "[gc]"
+
+    /* Shadow stack of the calling thread */
+    static size_t depth();
+    static void push(uintptr_t id);
+    static void replace(uintptr_t id);
+    static void pop_to(size_t depth);
+    static void count_alloc();
+    static void uncount_alloc();
+};
+
+/**
+ * Frames pushed by one evaluation, popped when it returns or throws. Calls
+ * in tail position replace the frame of the evaluation they take over.
+ */
+class ProfScope {
+private:
+    size_t depth;
+    bool pushed;
+
+public:
+    ProfScope() : depth(0), pushed(false) {}
+    ~ProfScope() { if (pushed) Profiler::pop_to(depth); }
+    ProfScope(const ProfScope &) = delete;
+    ProfScope &operator=(const ProfScope &) = delete;
+
+    void enter(uintptr_t id) {
+        if (pushed) return Profiler::replace(id);
+        depth = Profiler::depth();
+        pushed = true;
+        Profiler::push(id);
+    }
+};
+
+#endif
@@ -0,0 +1,366 @@
+/*============================================================================
+ *  nanoscheme
+ *  Copyright (c) 2019-2020 - Trung Truong
+ *
+ *  File name: server.cpp
+ *  Description: Implementation of `Server` class
+ *
+ *  The collector only scans the stack of the main thread, so threads
+ *  evaluate requests the way the threads of a `Pool` run tasks: they
+ *  allocate into their own list of objects, handed to the heap once the
+ *  request is answered, and no collection runs meanwhile. When a thread
+ *  finds that a collection is due it wakes the main thread, which stops
+ *  threads from starting new requests, waits for the running ones and
+ *  collects. Session envs are roots until their connection is closed.
+ *
+ *==========================================================================*/
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "expr.h"
+#include "gc.h"
+#include "lexer.h"
+#include "parser.h"
+#include "server.h"
+#include "writer.h"
+
+static const int MAX_EVENTS = 64;
+static const size_t READ_SIZE = 64 * 1024;
+
+/**
+ * Make an error of a failed system call
+ * @param what Description of the call
+ * @returns Error message, with the reason set in `errno`
+ */
+static std::string sys_error(const std::string &what) {
+    return what + ": " + std::strerror(errno);
+}
+
+/**
+ * Send a whole buffer on a non-blocking socket, waiting while the peer
+ * does not read
+ * @param fd Socket
+ * @param data Buffer
+ * @param len Length of the buffer
+ * @returns False if the peer is gone
+ */
+static bool send_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n >= 0) {
+            data += n;
+            len -= n;
+        }
+        else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            struct pollfd p = { fd, POLLOUT, 0 };
+            poll(&p, 1, -1);
+        }
+        else if (errno != EINTR) return false;
+    }
+    return true;
+}
+
+/* Constructors */
+Server::Server(const std::string &p, Env *env, size_t num_threads)
+    : path(p), global_env(env), listen_fd(-1), epoll_fd(-1), wake_fd(-1),
+      connections(), threads(), ready(), running(0), collecting(false),
+      stopping(false) {
+    struct sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+        throw "Socket path '" + path + "' is too long";
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+    // A socket left by a previous server is replaced, any other file kept
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(path.c_str());
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                       0);
+    if (listen_fd < 0) throw sys_error("Can't create socket");
+    if (bind(listen_fd, reinterpret_cast<struct sockaddr*>(&addr),
+             sizeof(addr)) < 0)
+        throw sys_error("Can't bind '" + path + "'");
+    if (listen(listen_fd, SOMAXCONN) < 0)
+        throw sys_error("Can't listen on '" + path + "'");
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epoll_fd < 0 || wake_fd < 0) throw sys_error("Can't create epoll");
+    for (int fd : { listen_fd, wake_fd }) {
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+    }
+
+    if (num_threads == 0) num_threads = 1;
+    for (size_t i = 0; i < num_threads; i++)
+        threads.emplace_back(&Server::loop, this);
+}
+
+/* Destructor */
+Server::~Server() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread &t : threads) t.join();
+
+    for (auto &entry : connections) {
+        close(entry.first);
+        if (entry.second->env != nullptr)
+            Heap::current().remove_root(entry.second->env);
+    }
+    for (int fd : { listen_fd, epoll_fd, wake_fd })
+        if (fd >= 0) close(fd);
+    unlink(path.c_str());
+}
+
+/*============================================================================
+ *  Main thread
+ *===========================================================================*/
+/**
+ * Accept the connections and read the requests of clients, until a system
+ * call fails
+ * @returns void
+ */
+void Server::run() {
+    struct epoll_event events[MAX_EVENTS];
+    for (;;) {
+        int n = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) throw sys_error("Can't wait for clients");
+
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == listen_fd) accept_connections();
+            else if (fd == wake_fd) {
+                uint64_t count;
+                while (read(wake_fd, &count, sizeof(count)) > 0) {}
+            }
+            else {
+                auto itr = connections.find(fd);
+                if (itr != connections.end()) read_connection(itr->second);
+            }
+        }
+        if (Heap::current().collection_due()) collect();
+    }
+}
+
+/**
+ * Accept every pending connection
+ * @returns void
+ */
+void Server::accept_connections() {
+    for (;;) {
+        int fd = accept4(listen_fd, nullptr, nullptr,
+                         SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) return;
+
+        ConnectionRef conn(new Connection { fd, nullptr, "", {}, false,
+                                            false });
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.fd = fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            close(fd);
+            continue;
+        }
+        connections[fd] = conn;
+    }
+}
+
+/**
+ * Read what a client sent and queue its complete requests. Once it hung
+ * up, the connection is closed after its last request was answered.
+ * @param conn Connection
+ * @returns void
+ */
+void Server::read_connection(ConnectionRef conn) {
+    std::vector<std::string> requests;
+    bool hung_up = false;
+    char buf[READ_SIZE];
+    for (;;) {
+        ssize_t n = read(conn->fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (n <= 0) {
+            hung_up = true;
+            break;
+        }
+
+        size_t start = 0;
+        for (ssize_t i = 0; i < n; i++) {
+            if (buf[i] != '\0') continue;
+            conn->input.append(buf + start, i - start);
+            requests.push_back(std::move(conn->input));
+            conn->input.clear();
+            start = i + 1;
+        }
+        conn->input.append(buf + start, n - start);
+    }
+    if (hung_up) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, nullptr);
+        connections.erase(conn->fd);
+    }
+
+    bool notify = false;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        for (std::string &request : requests)
+            conn->requests.push_back(std::move(request));
+        conn->closed = hung_up;
+        if (!conn->busy && !conn->requests.empty()) {
+            conn->busy = true;
+            ready.push_back(conn);
+            notify = true;
+        }
+        else if (!conn->busy && conn->closed) finish_connection(*conn);
+    }
+    if (notify) wake.notify_one();
+}
+
+/**
+ * Collect once the requests being evaluated are answered. Threads do not
+ * start new requests, nor close connections, until the collection is over.
+ * @returns void
+ */
+void Server::collect() {
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        collecting = true;
+        idle.wait(guard, [this] { return running == 0; });
+        Heap::current().safepoint();
+        collecting = false;
+    }
+    wake.notify_all();
+}
+
+/*============================================================================
+ *  Threads
+ *===========================================================================*/
+/**
+ * Main loop of a thread: take the next connection with a request, answer
+ * it, and queue the connection again if it has more
+ * @returns void
+ */
+void Server::loop() {
+    for (;;) {
+        ConnectionRef conn;
+        std::string request;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            wake.wait(guard, [this] {
+                return stopping || (!collecting && !ready.empty());
+            });
+            if (stopping) return;
+            conn = ready.front();
+            ready.pop_front();
+            request = std::move(conn->requests.front());
+            conn->requests.pop_front();
+            running++;
+        }
+
+        std::string response = eval_request(*conn, request);
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (--running == 0 && collecting) idle.notify_one();
+        }
+        response.push_back('\0');
+        send_all(conn->fd, response.data(), response.size());
+
+        bool notify = false, due = false;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (!conn->requests.empty()) {
+                ready.push_back(conn);
+                notify = true;
+            }
+            else {
+                conn->busy = false;
+                if (conn->closed) finish_connection(*conn);
+            }
+            due = Heap::current().collection_due();
+        }
+        if (notify) wake.notify_one();
+
+        // The main thread collects once it is woken up
+        if (due) {
+            uint64_t one = 1;
+            if (write(wake_fd, &one, sizeof(one)) < 0) {}
+        }
+    }
+}
+
+/**
+ * Evaluate a request in the session env of its connection
+ * @param conn Connection
+ * @param request Source of the request
+ * @returns Response, the printed results and errors
+ */
+std::string Server::eval_request(Connection &conn,
+                                 const std::string &request) {
+    GCLocal local;
+    Heap::current().attach_thread(&local);
+    if (conn.env == nullptr) {
+        Frame session_frame {};
+        conn.env = gc_new<Env>(session_frame, global_env);
+        Heap::current().add_root(conn.env);
+    }
+
+    Writer out;
+    Arena *arena = Heap::current().new_arena();
+    try {
+        TokenStream ts(request);
+        while (ts.has_next()) {
+            Expr *expr = build_AST(ts, ts.next(), conn.env, arena);
+            if (expr->get_expr_type() == ExpType::PRIM)
+                out.write_value(expr->eval(NO_BINDING, conn.env));
+            else
+                out.write_value(Value(expr));
+            out.put('\n');
+        }
+    }
+    catch (const char* e) {
+        out.write("ERR: ");
+        out.write(e);
+        out.put('\n');
+    }
+    catch (const std::string &e) {
+        out.write("ERR: " + e);
+        out.put('\n');
+    }
+    catch (...) {
+        out.write("Unexpected error\n");
+    }
+    arena->release();
+
+    Heap::current().detach_thread();
+    return out.str();
+}
+
+/**
+ * Close a connection that hung up and has no request left. The caller
+ * holds the lock.
+ * @param conn Connection
+ * @returns void
+ */
+void Server::finish_connection(Connection &conn) {
+    close(conn.fd);
+    conn.fd = -1;
+    if (conn.env != nullptr) Heap::current().remove_root(conn.env);
+    conn.env = nullptr;
+}
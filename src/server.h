@@ -0,0 +1,86 @@
+/*============================================================================
+ *  nanoscheme
+ *  Copyright (c) 2019-2020 - Trung Truong
+ *
+ *  File name: server.h
+ *  Description: Header file for `Server` class, which evaluates requests
+ *  of clients connected to a unix socket
+ *
+ *==========================================================================*/
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "env.h"
+#ifndef SERVER_H_
+#define SERVER_H_
+
+/*============================================================================
+ *  Server class
+ *===========================================================================*/
+/**
+ * A request is source text ended by a NUL byte. It is evaluated like a
+ * line of the REPL, and the response is what the REPL would print for it,
+ * ended by a NUL byte as well. A client may send several requests without
+ * waiting; they are answered in order.
+ *
+ * The main thread accepts connections and reads requests with epoll, a
+ * fixed set of threads evaluates them. Each connection has its own session
+ * env on top of the global env, which holds the prelude and is never
+ * written once the server runs, so definitions of one client are not seen
+ * by the others. The requests of a connection run one at a time.
+ */
+class Server {
+private:
+    struct Connection {
+        int fd;
+        Env *env;                       // Created by the first request
+        std::string input;              // Start of the next request
+        std::deque<std::string> requests;
+        bool busy;                      // Queued or running on a thread
+        bool closed;                    // Hung up, answered its requests
+    };
+    typedef std::shared_ptr<Connection> ConnectionRef;
+
+    std::string path;
+    Env *global_env;
+    int listen_fd;
+    int epoll_fd;
+    int wake_fd;
+    std::unordered_map<int, ConnectionRef> connections;
+
+    // Shared with the threads
+    std::vector<std::thread> threads;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    std::deque<ConnectionRef> ready;
+    size_t running;
+    bool collecting;
+    bool stopping;
+
+    /* Main thread */
+    void accept_connections();
+    void read_connection(ConnectionRef conn);
+    void collect();
+
+    /* Threads */
+    void loop();
+    std::string eval_request(Connection &conn, const std::string &request);
+    void finish_connection(Connection &conn);
+
+public:
+    /* Constructors */
+    Server(const std::string &p, Env *env, size_t num_threads);
+    ~Server();
+
+    void run();
+};
+
+#endif
@@ -0,0 +1,113 @@
+/*============================================================================
+ *  nanoscheme
+ *  Copyright (c) 2019-2020 - Trung Truong
+ *
+ *  File name: strview.cpp
+ *  Description: Implementation of `StrView` class
+ *
+ *  The written length of a buffer is claimed with a compare-and-swap, so
+ *  strings shared by the threads of 'pmap' can append to the same buffer:
+ *  one of them claims the room, the others copy.
+ *
+ *==========================================================================*/
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include "gc.h"
+#include "strview.h"
+
+static const size_t MIN_CAPACITY = 16;
+
+/*============================================================================
+ *  StrBuffer
+ *===========================================================================*/
+StrBuffer::StrBuffer(size_t n) : chars(nullptr), capacity(n), used(0) {
+    chars = static_cast<char*>(malloc(n));
+    if (chars == nullptr) throw "Can't allocate string";
+    Heap::current().add_external(n);
+}
+
+StrBuffer::~StrBuffer() {
+    free(chars);
+}
+
+/*============================================================================
+ *  StrView
+ *===========================================================================*/
+/**
+ * Make a string of its own buffer, as large as the characters
+ * @param s Characters
+ * @param n Number of characters
+ */
+StrView::StrView(const char *s, size_t n) : buf(), start(0), len(n) {
+    if (n == 0) return;
+    buf = std::make_shared<StrBuffer>(n);
+    std::memcpy(buf->chars, s, n);
+    buf->used.store(n, std::memory_order_relaxed);
+}
+
+StrView::StrView(const std::string &s) : StrView(s.data(), s.size()) {}
+
+/**
+ * Get a substring, sharing the characters
+ * @param from Index of the first character
+ * @param to Index after the last character
+ * @returns Substring
+ */
+StrView StrView::substr(size_t from, size_t to) const {
+    if (from == to) return StrView();
+    return StrView(buf, start + from, to - from);
+}
+
+/**
+ * Append characters, in place if the string ends where the characters
+ * written to its buffer end and there is room for them. Otherwise both are
+ * copied to a new buffer, twice as large as needed.
+ * @param s Characters
+ * @param n Number of characters
+ * @returns String of the characters of this one followed by `s`
+ */
+StrView StrView::append(const char *s, size_t n) const {
+    if (n == 0) return *this;
+    if (len == 0) return StrView(s, n);
+
+    size_t end = start + len;
+    if (n <= buf->capacity - end &&
+        buf->used.compare_exchange_strong(end, end + n)) {
+        std::memcpy(buf->chars + start + len, s, n);
+        return StrView(buf, start, len + n);
+    }
+
+    auto grown = std::make_shared<StrBuffer>(
+        std::max(MIN_CAPACITY, 2 * (len + n)));
+    std::memcpy(grown->chars, data(), len);
+    std::memcpy(grown->chars + len, s, n);
+    grown->used.store(len + n, std::memory_order_relaxed);
+    return StrView(std::move(grown), 0, len + n);
+}
+
+StrView StrView::append(const StrView &other) const {
+    if (len == 0) return other;
+    return append(other.data(), other.len);
+}
+
+/*============================================================================
+ *  Comparison
+ *===========================================================================*/
+bool StrView::operator==(const StrView &other) const {
+    return len == other.len && std::memcmp(data(), other.data(), len) == 0;
+}
+
+/**
+ * Hash the characters, FNV-1a
+ * @returns Hash
+ */
+size_t StrView::hash() const {
+    uint64_t h = 0xcbf29ce484222325ull;
+    const unsigned char *p = reinterpret_cast<const unsigned char*>(data());
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 0x100000001b3ull;
+    }
+    return size_t(h);
+}
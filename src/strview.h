@@ -0,0 +1,77 @@
+/*============================================================================
+ *  nanoscheme
+ *  Copyright (c) 2019-2020 - Trung Truong
+ *
+ *  File name: strview.h
+ *  Description: Header file for `StrView` class, the immutable strings of
+ *  Scheme programs
+ *
+ *==========================================================================*/
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <string>
+#ifndef STRVIEW_H_
+#define STRVIEW_H_
+
+/* Characters shared by strings, see `StrView` */
+struct StrBuffer {
+    char *chars;
+    size_t capacity;
+    std::atomic<size_t> used;           // Characters written so far
+
+    StrBuffer(size_t n);
+    ~StrBuffer();
+    StrBuffer(const StrBuffer &) = delete;
+    StrBuffer &operator=(const StrBuffer &) = delete;
+};
+
+/*============================================================================
+ *  StrView class
+ *===========================================================================*/
+/**
+ * Immutable string, a range of characters of a buffer shared with other
+ * strings. Copies and substrings share the buffer of the string they are
+ * made from instead of copying its characters, so a small substring keeps
+ * the whole buffer alive.
+ *
+ * Characters of a buffer never change once written. A string that ends
+ * where the written characters of its buffer end appends in place, into
+ * the room left after them, and the first string to claim that room gets
+ * it; any other string appending to the same buffer copies. Buffers grow
+ * by doubling, so a string built by appending to the previous one in a
+ * loop takes time linear in its length.
+ */
+class StrView {
+private:
+    std::shared_ptr<StrBuffer> buf;
+    size_t start;
+    size_t len;
+
+    StrView(std::shared_ptr<StrBuffer> b, size_t from, size_t n)
+        : buf(std::move(b)), start(from), len(n) {}
+
+public:
+    /* Constructors */
+    StrView() : buf(), start(0), len(0) {}
+    StrView(const char *s, size_t n);
+    explicit StrView(const std::string &s);
+
+    /* Getters */
+    const char *data() const { return len == 0 ? "" : buf->chars + start; }
+    size_t size() const { return len; }
+    char operator[](size_t i) const { return buf->chars[start + i]; }
+    std::string str() const { return std::string(data(), len); }
+
+    /* Strings made from this one */
+    StrView substr(size_t from, size_t to) const;
+    StrView append(const char *s, size_t n) const;
+    StrView append(const StrView &other) const;
+
+    /* Comparison */
+    bool operator==(const StrView &other) const;
+    bool operator!=(const StrView &other) const { return !(*this == other); }
+    size_t hash() const;
+};
+
+#endif
@@ -0,0 +1,32 @@
+/*============================================================================
+ *  nanoscheme
+ *  Copyright (c) 2019-2020 - Trung Truong
+ *
+ *  File name: symbol.cpp
+ *  Description: Implementation of `Symbol` class
+ *
+ *==========================================================================*/
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include "symbol.h"
+
+/* Constructors */
+Symbol::Symbol(const std::string &n)
+    : name(n), is_keyword(false), keyword() {}
+
+/**
+ * Get the symbol of a name, creating it on first use. Symbols are never
+ * freed.
+ * @param name Identifier
+ * @returns Pointer to the unique symbol of the name
+ */
+Symbol *Symbol::intern(const std::string &name) {
+    static std::mutex lock;
+    static std::unordered_map<std::string, std::unique_ptr<Symbol>> table;
+
+    std::lock_guard<std::mutex> guard(lock);
+    std::unique_ptr<Symbol> &sym = table[name];
+    if (sym == nullptr) sym.reset(new Symbol(name));
+    return sym.get();
+}
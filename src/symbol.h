@@ -0,0 +1,39 @@
+/*============================================================================
+ *  nanoscheme
+ *  Copyright (c) 2019-2020 - Trung Truong
+ *
+ *  File name: symbol.h
+ *  Description: Header file for `Symbol` class, the interned identifiers
+ *  shared by the parser, `Env` and the evaluators
+ *
+ *==========================================================================*/
+#include <string>
+#ifndef SYMBOL_H_
+#define SYMBOL_H_
+
+/* Forward-declaration of `PrimType`, see expr.h */
+enum class PrimType;
+
+/*============================================================================
+ *  Symbol class
+ *===========================================================================*/
+/**
+ * An identifier is interned once per occurrence, by the parser. Every
+ * occurrence of a name maps to the same symbol for the life of the
+ * process, so symbols are compared and hashed by address. A symbol naming
+ * a primitive, such as `if` or `car`, knows which one.
+ */
+class Symbol {
+private:
+    /* Constructors, symbols are only created by `intern` */
+    Symbol(const std::string &n);
+
+public:
+    const std::string name;
+    bool is_keyword;
+    PrimType keyword;
+
+    static Symbol *intern(const std::string &name);
+};
+
+#endif
@@ -0,0 +1,57 @@
+/*============================================================================
+ *  nanoscheme
+ *  Copyright (c) 2019-2020 - Trung Truong
+ *
+ *  File name: value.cpp
+ *  Description: Implementation of `Value` class
+ *
+ *==========================================================================*/
+#include "expr.h"
+#include "writer.h"
+
+/**
+ * Box an integer that does not fit in an immediate
+ * @param i Integer
+ * @returns Bits of a pointer to a collected integer expression
+ */
+uint64_t Value::box_int(int64_t i) {
+    return reinterpret_cast<uintptr_t>(gc_new<Expr>(i));
+}
+
+/*============================================================================
+ *  Conversions
+ *===========================================================================*/
+/**
+ * Get a pointer to an expression holding the value, so it can be stored in
+ * a list or bound by name
+ * @returns Pointer to the expression, allocated on the heap if the value
+ * is an immediate
+ */
+Expr *Value::box() const {
+    if (is_int())   return gc_new<Expr>(ival());
+    if (is_float()) return gc_new<Expr>(fval());
+    if (is_lit())   return gc_new<Expr>(lit());
+    return obj();
+}
+
+/**
+ * Copy the value into an expression
+ * @returns Expression holding the value
+ */
+Expr Value::to_expr() const {
+    if (is_int())   return Expr(ival());
+    if (is_float()) return Expr(fval());
+    if (is_lit())   return Expr(lit());
+    return Expr(*obj());
+}
+
+/*============================================================================
+ *  IOs
+ *===========================================================================*/
+/**
+ * Print value to the writer of the calling thread, see `Writer::out`
+ * @returns void
+ */
+void Value::print_to_console() const {
+    Writer::out().write_value(*this);
+}
@@ -0,0 +1,103 @@
+/*============================================================================
+ *  nanoscheme
+ *  Copyright (c) 2019-2020 - Trung Truong
+ *
+ *  File name: value.h
+ *  Description: Header file for `Value` class, the tagged word that
+ *  evaluating an expression produces
+ *
+ *==========================================================================*/
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#ifndef VALUE_H_
+#define VALUE_H_
+
+/* Forward-declartion of `Expr` class */
+class Expr;
+
+/*============================================================================
+ *  Enums and constants
+ *===========================================================================*/
+enum class ExpType {
+    LIT, INT, BIGINT, FLOAT, STRING, LIST, SYMBOL, LOCAL, PROC, PRIM, CODE,
+    MEMO, VECTOR, HASH
+};
+enum class LitType { TRUE, FALSE, NIL };
+
+/*============================================================================
+ *  Value class
+ *===========================================================================*/
+/**
+ * A value is a single 64-bit word. Integers that fit in 48 bits, floats and
+ * literals are stored in the word itself, so evaluating numeric code does
+ * not allocate. Anything else is a plain pointer to an `Expr` on the heap
+ * or in an arena, which the collector's stack scan sees like any other
+ * pointer. The top 16 bits tell the cases apart:
+ *
+ *   0000 | pointer      pointer to `Expr`, or nullptr for an unbound value
+ *   0000 | l << 4 | 2   literal `l`
+ *   0001 .. FFF1        float, with 2^48 added to its IEEE 754 bits
+ *   FFFF | integer      48-bit two's complement integer
+ */
+class Value {
+private:
+    uint64_t bits;
+
+    static const uint64_t TAG_MASK      = 0xFFFF000000000000ull;
+    static const uint64_t INT_TAG       = 0xFFFF000000000000ull;
+    static const uint64_t FLOAT_OFFSET  = 0x0001000000000000ull;
+    static const uint64_t LIT_TAG       = 0x2;
+
+    static uint64_t box_int(int64_t i);
+
+public:
+    static const int64_t MAX_IMMEDIATE_INT = (int64_t(1) << 47) - 1;
+    static const int64_t MIN_IMMEDIATE_INT = -(int64_t(1) << 47);
+
+    /* Constructors */
+    Value() : bits(0) {}
+    Value(int64_t i) {
+        if (i < MIN_IMMEDIATE_INT || i > MAX_IMMEDIATE_INT) bits = box_int(i);
+        else bits = INT_TAG | (uint64_t(i) & ~TAG_MASK);
+    }
+    Value(double f) {
+        // Every NaN is stored as the same quiet NaN, which keeps the tag
+        // space of integers free
+        if (f != f) f = NAN;
+        std::memcpy(&bits, &f, sizeof(bits));
+        bits += FLOAT_OFFSET;
+    }
+    Value(LitType l) : bits((uint64_t(l) << 4) | LIT_TAG) {}
+    inline Value(Expr *e);
+
+    /* Tags */
+    bool is_unbound() const { return bits == 0; }
+    bool is_int() const     { return (bits & TAG_MASK) == INT_TAG; }
+    bool is_float() const {
+        return (bits & TAG_MASK) != 0 && (bits & TAG_MASK) != INT_TAG;
+    }
+    bool is_lit() const {
+        return (bits & TAG_MASK) == 0 && (bits & 0xF) == LIT_TAG;
+    }
+    bool is_obj() const {
+        return (bits & TAG_MASK) == 0 && (bits & 0x7) == 0 && bits != 0;
+    }
+
+    /* Getters. Numbers and literals may be boxed, see `Value(int64_t)` */
+    inline ExpType type() const;
+    inline int64_t ival() const;
+    inline double fval() const;
+    inline LitType lit() const;
+    Expr *obj() const { return reinterpret_cast<Expr*>(uintptr_t(bits)); }
+    inline bool is_true() const;
+
+    /* Conversions to expressions */
+    Expr *box() const;
+    Expr to_expr() const;
+
+    /* IO */
+    void print_to_console() const;
+};
+
+#endif
@@ -0,0 +1,412 @@
+/*============================================================================
+ *  nanoscheme
+ *  Copyright (c) 2019-2020 - Trung Truong
+ *
+ *  File name: vm.cpp
+ *  Description: Implementation of `VM` class
+ *
+ *  Every call runs in its own invocation of `VM::run`, with the operand
+ *  stack in the native frame so the collector scans it like any other
+ *  local. Calls in tail position take over the invocation of their caller
+ *  instead, so tail recursion runs in constant native stack. Frames are
+ *  regular slotted `Env`s, so closures created by the VM and by the
+ *  tree-walker can call each other freely.
+ *
+ *==========================================================================*/
+#include <cmath>
+#include "number.h"
+#include "profiler.h"
+#include "vm.h"
+
+#if defined(__GNUC__)
+#define VM_COMPUTED_GOTO
+#endif
+
+bool VM::enabled = false;
+
+/*============================================================================
+ *  Helpers
+ *===========================================================================*/
+/**
+ * Load a bound expression or list element. Values are used as they are,
+ * anything else is evaluated in `env` like the tree-walker would.
+ * @param v Bound value or list element
+ * @param env Pointer to env
+ * @returns Stack value
+ */
+Value VM::load(Value v, Env *env) {
+    if (!v.is_obj()) return v;
+    switch (v.obj()->type) {
+        case ExpType::INT: case ExpType::BIGINT: case ExpType::FLOAT:
+        case ExpType::LIT: case ExpType::STRING: case ExpType::LIST:
+        case ExpType::VECTOR: case ExpType::HASH:
+        case ExpType::PROC:
+            return v;
+        default:
+            return v.obj()->eval(NO_BINDING, env);
+    }
+}
+
+/**
+ * Apply a procedure to a single list element, for 'map' and 'filter'
+ * @param proc Pointer to procedure expression
+ * @param arg List element
+ * @param env Pointer to env of the caller
+ * @returns Result of the call
+ */
+Value VM::apply(Expr *proc, Value arg, Env *env) {
+    Expr *params = std::get<0>(proc->proc);
+    Expr *body   = std::get<1>(proc->proc);
+    Env  *tail   = std::get<2>(proc->proc);
+
+    if (body->type == ExpType::CODE && params->list.vec->size() == 1) {
+        ProfScope scope;
+        if (Profiler::enabled) scope.enter(Profiler::proc_id(body));
+        Env *new_env = gc_new<Env>(tail, 1);
+        new_env->slots[0] = load(arg, tail);
+        return run(body->code, new_env);
+    }
+
+    // Anything else takes the same path as in the tree-walker
+    std::vector<Value> args { arg };
+    return proc->eval(&args, env);
+}
+
+static inline Value make_lit(bool b) {
+    return Value(b ? LitType::TRUE : LitType::FALSE);
+}
+
+/* Pop two numbers and push the comparison of them */
+#define VM_COMPARE(OP, NAME) {                                              \
+    Value b = *--sp, a = *--sp;                                             \
+    *sp++ = make_lit(num_compare(CmpOp::OP, a, b, NAME));                   \
+}
+
+/*============================================================================
+ *  List operations and calls
+ *
+ *  These run in their own native frames rather than in `VM::run`, so that
+ *  their temporaries do not stay on the stack, where the collector would
+ *  keep them alive, for as long as the calling procedure runs. For the
+ *  same reason the interpreter loop clears the stack slots it pops.
+ *===========================================================================*/
+Value VM::car(Value l, Env *env) {
+    if (l.type() != ExpType::LIST)
+        throw "Argument for 'car' is not list type";
+    if (l.obj()->list_empty()) return Value(LitType::NIL);
+    return load(ListCursor(l.obj()).get(), env);
+}
+
+Value VM::cdr(Value l) {
+    if (l.type() != ExpType::LIST)
+        throw "Argument for 'cdr' is not list type";
+    return l.obj()->list_cdr();
+}
+
+Value VM::cons(Value a, Value b) {
+    if (a.type() == ExpType::LIST || b.type() != ExpType::LIST)
+        throw "Invalid arguments type for 'cons'";
+    Expr *rest = b.obj()->list_empty() ? nullptr : b.obj();
+    return Value(gc_new<Expr>(a, rest));
+}
+
+Value VM::map(Value fun, Value iter, Env *env) {
+    if (fun.type() != ExpType::PROC || iter.type() != ExpType::LIST)
+        throw "Invalid arguments type for 'map'";
+    ProfScope scope;
+    if (Profiler::enabled) scope.enter(Profiler::prim_id(PrimType::MAP));
+    ListBuilder l;
+    for (ListCursor c(iter.obj()); !c.done(); c.next())
+        l.push(apply(fun.obj(), c.get(), env));
+    return l.finish(nullptr);
+}
+
+Value VM::filter(Value fun, Value iter, Env *env) {
+    if (fun.type() != ExpType::PROC || iter.type() != ExpType::LIST)
+        throw "Invalid arguments type for 'filter'";
+    ProfScope scope;
+    if (Profiler::enabled) scope.enter(Profiler::prim_id(PrimType::FILTER));
+    ListBuilder l;
+    for (ListCursor c(iter.obj()); !c.done(); c.next()) {
+        Value applied_elem = apply(fun.obj(), c.get(), env);
+        if (applied_elem.type() != ExpType::LIT)
+            throw "Decider function does not return lit type";
+        if (applied_elem.lit() == LitType::TRUE) l.push(c.get());
+    }
+    return l.finish(nullptr);
+}
+
+/**
+ * Bind the arguments of a recursive call node, see `Expr::eval_proc`. The
+ * caller counts the frame as an allocation of the callee once it entered
+ * it.
+ * @param node Pointer to procedure expression with a symbol as body
+ * @param args Pointer to the evaluated arguments on the operand stack
+ * @param argc Number of arguments
+ * @param env Pointer to env of the caller
+ * @param new_env Set to the frame of the call
+ * @returns Body of the called procedure
+ */
+Expr *VM::bind(Expr *node, Value *args, int32_t argc, Env *env,
+               Env *&new_env) {
+    Expr *sym = std::get<1>(node->proc);
+    Env *tail = std::get<2>(node->proc);
+    Expr *params, *body;
+
+    // Fast path for a procedure bound by 'define'
+    Expr *found_val = env->find_var(std::get<0>(sym->sym));
+    if (found_val != nullptr && found_val->type == ExpType::PRIM &&
+        std::get<0>(found_val->prim) == PrimType::LAMBDA &&
+        std::get<1>(found_val->prim).size() == 2) {
+        params = std::get<1>(found_val->prim)[0];
+        body   = std::get<1>(found_val->prim)[1];
+    }
+    else {
+        Value caller = sym->eval(NO_BINDING, env);
+        if (caller.type() != ExpType::PROC)
+            throw "Eval failed: Not procedure type!";
+        params = std::get<0>(caller.obj()->proc);
+        body   = std::get<1>(caller.obj()->proc);
+    }
+    if (params->type != ExpType::LIST ||
+        params->list.vec->size() != size_t(argc))
+        throw "Non-matching number of args for procedure call";
+
+    new_env = gc_new<Env>(tail, size_t(argc));
+    if (Profiler::enabled) Profiler::uncount_alloc();
+    for (int32_t i = 0; i < argc; i++)
+        new_env->slots[i] = args[i];
+    return body;
+}
+
+/**
+ * Call the procedure named by a recursive call node
+ * @param node Pointer to procedure expression with a symbol as body
+ * @param args Pointer to the evaluated arguments on the operand stack
+ * @param argc Number of arguments
+ * @param env Pointer to env of the caller
+ * @returns Result of the call
+ */
+Value VM::call(Expr *node, Value *args, int32_t argc, Env *env) {
+    Env *new_env = nullptr;
+    Expr *body = bind(node, args, argc, env, new_env);
+    ProfScope scope;
+    if (Profiler::enabled) {
+        scope.enter(Profiler::proc_id(body));
+        Profiler::count_alloc();
+    }
+
+    if (body->type == ExpType::CODE) return run(body->code, new_env);
+    return walk(body, new_env);
+}
+
+/**
+ * Evaluate a body that was not compiled with the tree-walker
+ * @param body Pointer to procedure body
+ * @param new_env Pointer to the frame of the call
+ * @returns Result of the body
+ */
+Value VM::walk(Expr *body, Env *new_env) {
+    std::vector<Value> eval_params_list(new_env->slots);
+    return body->eval(&eval_params_list, new_env);
+}
+
+/*============================================================================
+ *  Interpreter loop
+ *===========================================================================*/
+#ifdef VM_COMPUTED_GOTO
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#define TARGET(op)  L_##op
+#define DISPATCH()  goto *labels[*pc++]
+#else
+#define TARGET(op)  case int32_t(OpCode::op)
+#define DISPATCH()  goto dispatch
+#endif
+
+/**
+ * Run compiled lambda body
+ * @param code Pointer to compiled body
+ * @param env Pointer to the frame of the call
+ * @returns Result of the body
+ */
+Value VM::run(Code *code, Env *env) {
+    // Cleared, so that whatever earlier calls left in this part of the
+    // native stack is not mistaken for live references by the collector
+    Value stack[VM_STACK_SIZE];
+    Value *sp = stack;
+    const int32_t *pc = code->ops;
+    const Value *consts = code->consts;
+
+#ifdef VM_COMPUTED_GOTO
+    // Same order as `OpCode`
+    static void *labels[] = {
+        &&L_CONST, &&L_LOCAL0, &&L_LOCAL, &&L_GLOBAL, &&L_EVAL, &&L_CLOSURE,
+        &&L_JUMP, &&L_JUMP_UNLESS, &&L_ADD, &&L_MUL, &&L_SUB, &&L_DIV,
+        &&L_MOD, &&L_GT, &&L_LT, &&L_GE, &&L_LE, &&L_EQ_NUM, &&L_CAR,
+        &&L_CDR, &&L_IS_NULL, &&L_CONS, &&L_MAP, &&L_FILTER, &&L_CALL,
+        &&L_TAIL_CALL, &&L_RETURN
+    };
+    DISPATCH();
+#else
+dispatch:
+    switch (*pc++) {
+#endif
+
+    /*======================= Loads ===================================*/
+    TARGET(CONST): {
+        *sp++ = consts[*pc++];
+        DISPATCH();
+    }
+    TARGET(LOCAL0): {
+        *sp++ = env->slots[*pc++];
+        DISPATCH();
+    }
+    TARGET(LOCAL): {
+        Expr *var = consts[*pc++].obj();
+        Value found_val = env->find_slot(std::get<1>(var->local),
+                                         std::get<2>(var->local));
+        if (found_val.is_unbound())
+            throw "Unknown identifier: '" + std::get<0>(var->local)->name +
+                  "'";
+        *sp++ = found_val;
+        DISPATCH();
+    }
+    TARGET(GLOBAL): {
+        Expr *sym = consts[*pc++].obj();
+        Expr *found_val = env->find_var(std::get<0>(sym->sym));
+        if (found_val == nullptr)
+            throw "Unknown identifier: '" + std::get<0>(sym->sym)->name +
+                  "'";
+        *sp++ = load(found_val, env);
+        DISPATCH();
+    }
+    TARGET(EVAL): {
+        *sp++ = consts[*pc++].obj()->eval(NO_BINDING, env);
+        DISPATCH();
+    }
+    TARGET(CLOSURE): {
+        *sp++ = consts[*pc++].obj()->make_closure(env);
+        DISPATCH();
+    }
+
+    /*======================= Control flow ============================*/
+    TARGET(JUMP): {
+        pc = code->ops + *pc;
+        DISPATCH();
+    }
+    TARGET(JUMP_UNLESS): {
+        if ((--sp)->is_true()) pc++;
+        else pc = code->ops + *pc;
+        DISPATCH();
+    }
+
+    /*======================= Arith operations ========================*/
+    TARGET(ADD): {
+        int32_t argc = *pc++;
+        const Value *args = sp -= argc;
+        *sp++ = num_sum(argc, [args](size_t i) { return args[i]; });
+        DISPATCH();
+    }
+    TARGET(MUL): {
+        int32_t argc = *pc++;
+        const Value *args = sp -= argc;
+        *sp++ = num_product(argc, [args](size_t i) { return args[i]; });
+        DISPATCH();
+    }
+    TARGET(SUB): {
+        Value b = *--sp, a = *--sp;
+        *sp++ = num_sub(a, b);
+        DISPATCH();
+    }
+    TARGET(DIV): {
+        Value b = *--sp, a = *--sp;
+        *sp++ = num_div(a, b);
+        DISPATCH();
+    }
+    TARGET(MOD): {
+        Value b = *--sp, a = *--sp;
+        *sp++ = num_mod(a, b);
+        DISPATCH();
+    }
+
+    /*======================= Comparators =============================*/
+    TARGET(GT):     { VM_COMPARE(GT, ">");  DISPATCH(); }
+    TARGET(LT):     { VM_COMPARE(LT, "<");  DISPATCH(); }
+    TARGET(GE):     { VM_COMPARE(GE, ">="); DISPATCH(); }
+    TARGET(LE):     { VM_COMPARE(LE, "<="); DISPATCH(); }
+    TARGET(EQ_NUM): { VM_COMPARE(EQ, "=");  DISPATCH(); }
+
+    /*======================= List operations =========================*/
+    TARGET(CAR):     { sp[-1] = car(sp[-1], env);  DISPATCH(); }
+    TARGET(CDR):     { sp[-1] = cdr(sp[-1]);       DISPATCH(); }
+    TARGET(IS_NULL): {
+        if (sp[-1].type() != ExpType::LIST)
+            throw "Invalid argument type for 'null?'";
+        sp[-1] = make_lit(sp[-1].obj()->list_empty());
+        DISPATCH();
+    }
+    TARGET(CONS): {
+        sp--;
+        sp[-1] = cons(sp[-1], sp[0]);
+        sp[0] = Value();
+        DISPATCH();
+    }
+    TARGET(MAP): {
+        sp--;
+        sp[-1] = map(sp[-1], sp[0], env);
+        sp[0] = Value();
+        DISPATCH();
+    }
+    TARGET(FILTER): {
+        sp--;
+        sp[-1] = filter(sp[-1], sp[0], env);
+        sp[0] = Value();
+        DISPATCH();
+    }
+
+    /*======================= Procedure calls =========================*/
+    TARGET(CALL): {
+        Expr *node = consts[*pc++].obj();
+        int32_t argc = *pc++;
+        sp -= argc;
+        Heap::clear_stack();
+        Value res = call(node, sp, argc, env);
+        for (int32_t i = 0; i < argc; i++) sp[i] = Value();
+        *sp++ = res;
+        DISPATCH();
+    }
+    TARGET(TAIL_CALL): {
+        Expr *node = consts[*pc++].obj();
+        int32_t argc = *pc++;
+        sp -= argc;
+        Env *new_env = nullptr;
+        Expr *body = bind(node, sp, argc, env, new_env);
+        for (int32_t i = 0; i < argc; i++) sp[i] = Value();
+        if (Profiler::enabled) {
+            Profiler::replace(Profiler::proc_id(body));
+            Profiler::count_alloc();
+        }
+        if (body->type != ExpType::CODE) return walk(body, new_env);
+
+        // Nothing is left on the operand stack in tail position, so the
+        // callee takes over this invocation
+        code = body->code;
+        consts = code->consts;
+        pc = code->ops;
+        env = new_env;
+        DISPATCH();
+    }
+    TARGET(RETURN): {
+        return *--sp;
+    }
+
+#ifndef VM_COMPUTED_GOTO
+    }
+    throw "Eval failed: Invalid opcode";
+#endif
+}
+
+#ifdef VM_COMPUTED_GOTO
+#pragma GCC diagnostic pop
+#endif
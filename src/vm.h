@@ -0,0 +1,86 @@
+/*============================================================================
+ *  nanoscheme
+ *  Copyright (c) 2019-2020 - Trung Truong
+ *
+ *  File name: vm.h
+ *  Description: Header file for `VM` class, a stack based virtual machine
+ *  running lambda bodies compiled to bytecode
+ *
+ *==========================================================================*/
+#include <cstdint>
+
+#include "env.h"
+#include "expr.h"
+#include "value.h"
+#ifndef VM_H_
+#define VM_H_
+
+/*============================================================================
+ *  Bytecode
+ *===========================================================================*/
+/**
+ * Every instruction is an opcode word followed by its operands. `k` is an
+ * index into the constant pool, `n` an argument count, `t` a jump target.
+ */
+enum class OpCode : int32_t {
+    CONST,          // k      push constant
+    LOCAL0,         // s      push slot of the innermost frame
+    LOCAL,          // k      push variable constant from enclosing frame
+    GLOBAL,         // k      push value of unresolved symbol constant
+    EVAL,           // k      push value of expression, by tree-walking
+    CLOSURE,        // k      push procedure of lambda constant
+    JUMP,           // t      jump
+    JUMP_UNLESS,    // t      pop condition, jump if it is false
+    ADD, MUL,       // n      pop n numbers, push result
+    SUB, DIV, MOD,  //        pop 2 numbers, push result
+    GT, LT, GE, LE, EQ_NUM,
+    CAR, CDR, IS_NULL, CONS, MAP, FILTER,
+    CALL,           // k n    pop n arguments, call procedure constant
+    TAIL_CALL,      // k n    same as CALL, reusing the frame of the caller
+    RETURN          //        pop and return result
+};
+
+/**
+ * Compiled lambda body. It is allocated in the arena of the lambda as a
+ * single object, with the constant pool and the instructions stored right
+ * behind it.
+ */
+struct Code {
+    Value *consts;
+    size_t num_consts;
+    int32_t *ops;
+    size_t max_stack;
+};
+
+/* Size of the operand stack of a single call */
+static const size_t VM_STACK_SIZE = 32;
+
+/*============================================================================
+ *  VM class
+ *===========================================================================*/
+class VM {
+private:
+    /* Helpers */
+    static Value load(Value v, Env *env);
+    static Value apply(Expr *proc, Value arg, Env *env);
+
+    /* List operations and calls */
+    static Value car(Value l, Env *env);
+    static Value cdr(Value l);
+    static Value cons(Value a, Value b);
+    static Value map(Value fun, Value iter, Env *env);
+    static Value filter(Value fun, Value iter, Env *env);
+    static Expr *bind(Expr *node, Value *args, int32_t argc, Env *env,
+                      Env *&new_env);
+    static Value call(Expr *node, Value *args, int32_t argc, Env *env);
+    static Value walk(Expr *body, Env *new_env);
+
+public:
+    /* Lambda bodies are compiled to bytecode when set, see `--vm` */
+    static bool enabled;
+
+    /* Interpreter loop */
+    static Value run(Code *code, Env *env);
+};
+
+#endif
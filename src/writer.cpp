@@ -0,0 +1,303 @@
+/*============================================================================
+ *  nanoscheme
+ *  Copyright (c) 2019-2020 - Trung Truong
+ *
+ *  File name: writer.cpp
+ *  Description: Implementation of `Writer` class
+ *
+ *  Values are printed the way `std::ostream` printed them before: integers
+ *  in decimal, floats as with `%g`, lists with their elements separated by
+ *  spaces. Numbers are formatted into the buffer directly instead of going
+ *  through the locale facets of a stream, and lists are walked with an
+ *  explicit stack of cursors, so deep nesting can not overflow the C++
+ *  stack.
+ *
+ *==========================================================================*/
+#include <cstdio>
+#include <iostream>
+#include "numvec.h"
+#include "writer.h"
+
+std::mutex Writer::sink_lock;
+
+/* Writer that `out` returns on the running thread, if redirected */
+static thread_local Writer *redirected = nullptr;
+
+/* Constructors */
+Writer::Writer() : buf(), sink(nullptr) {}
+
+Writer::Writer(std::ostream &s) : buf(), sink(&s) {
+    buf.reserve(FLUSH_SIZE);
+}
+
+/* Destructor */
+Writer::~Writer() {
+    flush();
+}
+
+/**
+ * Get the writer of the calling thread to stdout, or the one it was
+ * redirected to
+ * @returns Writer, flushed when the thread exits
+ */
+Writer &Writer::out() {
+    if (redirected != nullptr) return *redirected;
+    thread_local Writer writer(std::cout);
+    return writer;
+}
+
+/**
+ * Make `out` return another writer on the calling thread, such as one
+ * rendering in memory, until it is redirected again
+ * @param w Writer, or nullptr to print to stdout again
+ * @returns void
+ */
+void Writer::redirect(Writer *w) {
+    redirected = w;
+}
+
+/*============================================================================
+ *  Writers
+ *===========================================================================*/
+void Writer::write(const char *s, size_t n) {
+    buf.append(s, n);
+    if (sink != nullptr && buf.size() >= FLUSH_SIZE) flush();
+}
+
+void Writer::write(const char *s) {
+    write(s, std::strlen(s));
+}
+
+void Writer::write(const std::string &s) {
+    write(s.data(), s.size());
+}
+
+/**
+ * Write an integer in decimal, two digits at a time
+ * @param i Integer
+ * @returns void
+ */
+void Writer::write_int(int64_t i) {
+    static const char digits[] =
+        "00010203040506070809101112131415161718192021222324252627282930313233"
+        "34353637383940414243444546474849505152535455565758596061626364656667"
+        "6869707172737475767778798081828384858687888990919293949596979899";
+    char tmp[20];
+    char *end = tmp + sizeof(tmp), *p = end;
+
+    // Negated as unsigned so that the minimum integer does not overflow
+    uint64_t n = i < 0 ? 0 - uint64_t(i) : uint64_t(i);
+    while (n >= 100) {
+        size_t d = (n % 100) * 2;
+        n /= 100;
+        *--p = digits[d + 1];
+        *--p = digits[d];
+    }
+    if (n >= 10) {
+        *--p = digits[n * 2 + 1];
+        *--p = digits[n * 2];
+    }
+    else *--p = char('0' + n);
+    if (i < 0) *--p = '-';
+    write(p, end - p);
+}
+
+/**
+ * Write a float with six significant digits, as `%g` does. Integral floats
+ * that are printed without an exponent take the integer path, others in
+ * the range printed without an exponent are scaled to six digits and
+ * written as an integer with a decimal point. A float whose seventh digit
+ * is too close to a tie to round it safely that way, and any float with an
+ * exponent, is left to `snprintf`.
+ * @param d Float
+ * @returns void
+ */
+void Writer::write_float(double d) {
+    static const double powers[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9
+    };
+    if (d > -1e6 && d < 1e6 && d == std::trunc(d) &&
+        !(d == 0 && std::signbit(d))) {
+        write_int(int64_t(d));
+        return;
+    }
+
+    double a = std::fabs(d);
+    if (a >= 1e-4 && a < 1e6) {
+        int exp = int(std::floor(std::log10(a)));
+        double scaled = a * powers[5 - exp];
+        double frac = scaled - std::floor(scaled);
+        double digits = std::floor(scaled + 0.5);
+        if (std::fabs(frac - 0.5) > 1e-6 && digits >= 1e5 && digits < 1e6) {
+            char tmp[16];
+            char *p = tmp;
+            if (d < 0) *p++ = '-';
+            if (exp < 0) {
+                *p++ = '0';
+                *p++ = '.';
+                for (int i = -1; i > exp; i--) *p++ = '0';
+            }
+
+            int64_t n = int64_t(digits);
+            char six[6];
+            for (int i = 5; i >= 0; i--, n /= 10) six[i] = char('0' + n % 10);
+            int len = 6;
+            while (len > 0 && six[len - 1] == '0' && len > exp + 1) len--;
+            for (int i = 0; i < len; i++) {
+                if (i == exp + 1 && exp >= 0) *p++ = '.';
+                *p++ = six[i];
+            }
+            write(tmp, p - tmp);
+            return;
+        }
+    }
+
+    char tmp[32];
+    int n = std::snprintf(tmp, sizeof(tmp), "%g", d);
+    write(tmp, n);
+}
+
+/**
+ * Report a value that can not be printed. A writer to a stream reports it
+ * on stderr, after flushing what was printed before it; a writer rendering
+ * in memory keeps it in its buffer.
+ * @param msg Message
+ * @returns void
+ */
+void Writer::write_error(const std::string &msg) {
+    if (sink == nullptr) return write(msg);
+    flush();
+    std::cerr << msg;
+}
+
+/**
+ * Write a value that is not a list, following the bindings of symbols
+ * @param v Value
+ * @returns Pointer to the list to print instead, or nullptr
+ */
+Expr *Writer::write_atom(Value v) {
+    if (v.is_int())     { write_int(v.ival()); return nullptr; }
+    if (v.is_float())   { write_float(v.fval()); return nullptr; }
+    if (v.is_lit()) {
+        switch (v.lit()) {
+            case LitType::TRUE:     write("#t", 2); break;
+            case LitType::FALSE:    write("#f", 2); break;
+            case LitType::NIL:      write("()", 2); break;
+        }
+        return nullptr;
+    }
+    if (!v.is_obj()) return nullptr;
+
+    Expr *e = v.obj();
+    while (e->type == ExpType::SYMBOL && std::get<1>(e->sym) != nullptr)
+        e = std::get<1>(e->sym);
+
+    switch (e->type) {
+        case ExpType::INT:      write_int(e->ival); break;
+        case ExpType::BIGINT:   write(e->bval.to_string()); break;
+        case ExpType::FLOAT:    write_float(e->fval); break;
+        case ExpType::STRING:
+            write("\"", 1);
+            write(e->sval.data(), e->sval.size());
+            write("\"", 1);
+            break;
+        case ExpType::PROC:     write("<procedure>", 11); break;
+        case ExpType::HASH:     write("<hash-table>", 12); break;
+        case ExpType::LIST:     return e;
+        case ExpType::VECTOR: {
+            const NumVector &vec = *e->nvec;
+            bool f64 = vec.elem_type() == ElemType::F64;
+            write(f64 ? "#f64(" : "#i64(", 5);
+            for (size_t i = 0; i < vec.size(); i++) {
+                if (i > 0) write(" ", 1);
+                if (f64) write_float(vec.f64()[i]);
+                else write_int(vec.i64()[i]);
+            }
+            write(")", 1);
+            break;
+        }
+        case ExpType::SYMBOL:
+            write_error("Unknown symbol '" + std::get<0>(e->sym)->name +
+                        "'");
+            break;
+        case ExpType::LOCAL:
+            write_error("Unevaluated local '" +
+                        std::get<0>(e->local)->name + "'");
+            break;
+        case ExpType::PRIM:
+            switch (std::get<0>(e->prim)) {
+                case PrimType::LAMBDA:  write("<closure>", 9); break;
+                case PrimType::DEFINE:  break;
+                case PrimType::SET:     break;
+                default:                write("<primitive>", 11); break;
+            }
+            break;
+        case ExpType::LIT:
+            return write_atom(Value(e->lit));
+        default: break;
+    }
+    return nullptr;
+}
+
+/**
+ * Write a value. Lists are walked iteratively, each open list keeps a
+ * cursor to its next element.
+ * @param v Value
+ * @returns void
+ */
+void Writer::write_value(Value v) {
+    struct Open {
+        ListCursor cursor;
+        bool first;
+    };
+    std::vector<Open> open;
+
+    while (true) {
+        Expr *list = write_atom(v);
+        if (list != nullptr) {
+            put('(');
+            open.push_back({ ListCursor(list), true });
+        }
+
+        // Move to the next element, closing the lists that are done
+        while (true) {
+            if (open.empty()) return;
+            Open &top = open.back();
+            if (top.cursor.done()) {
+                put(')');
+                open.pop_back();
+                continue;
+            }
+            if (!top.first) put(' ');
+            top.first = false;
+            v = top.cursor.get();
+            top.cursor.next();
+            break;
+        }
+    }
+}
+
+/**
+ * Forward the buffer to the stream of the writer, if any
+ * @returns void
+ */
+void Writer::flush() {
+    if (sink == nullptr || buf.empty()) return;
+    {
+        std::lock_guard<std::mutex> guard(sink_lock);
+        sink->write(buf.data(), buf.size());
+        sink->flush();
+    }
+    buf.clear();
+}
+
+/*============================================================================
+ *  Memory buffer
+ *===========================================================================*/
+const std::string &Writer::str() const {
+    return buf;
+}
+
+void Writer::clear() {
+    buf.clear();
+}
@@ -0,0 +1,71 @@
+/*============================================================================
+ *  nanoscheme
+ *  Copyright (c) 2019-2020 - Trung Truong
+ *
+ *  File name: writer.h
+ *  Description: Header file for `Writer` class, the buffered output of
+ *  printed values
+ *
+ *==========================================================================*/
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+#include "expr.h"
+#ifndef WRITER_H_
+#define WRITER_H_
+
+/*============================================================================
+ *  Writer class
+ *===========================================================================*/
+/**
+ * Output buffer. A writer either renders into memory, read back with `str`,
+ * or forwards its buffer to a stream in one call whenever it fills up and
+ * at the explicit flush points of the caller. Each thread prints through
+ * its own writer to stdout, see `out`; a flush is a single write to the
+ * stream, so the output of different threads only interleaves at flushes.
+ * A thread may print into another writer instead, see `redirect`.
+ */
+class Writer {
+private:
+    std::string buf;
+    std::ostream *sink;                 // nullptr when rendering in memory
+
+    static const size_t FLUSH_SIZE = 64 * 1024;
+    static std::mutex sink_lock;
+
+    /* Helpers */
+    void write_error(const std::string &msg);
+    Expr *write_atom(Value v);
+
+public:
+    /* Constructors */
+    Writer();
+    Writer(std::ostream &s);
+    ~Writer();
+    Writer(const Writer &) = delete;
+    Writer &operator=(const Writer &) = delete;
+    static Writer &out();
+    static void redirect(Writer *w);
+
+    /* Writers */
+    void put(char c) {
+        buf.push_back(c);
+        if (sink != nullptr && buf.size() >= FLUSH_SIZE) flush();
+    }
+    void write(const char *s, size_t n);
+    void write(const char *s);
+    void write(const std::string &s);
+    void write_int(int64_t i);
+    void write_float(double d);
+    void write_value(Value v);
+    void flush();
+
+    /* Buffer of a writer rendering in memory */
+    const std::string &str() const;
+    void clear();
+};
+
+#endif
@@ -0,0 +1,122 @@
+/*============================================================================
+ *  nanoscheme
+ *  Copyright (c) 2019-2020 - Trung Truong
+ *
+ *  File name: profiler.cpp
+ *
+ *  Description: Tests of the names given to procedures by the profiler
+ *  Usage: Run `make test`
+ *
+ *  A lambda that refers to parameters of enclosing lambdas carries the
+ *  addresses of the variables it captures as a third argument. Calling
+ *  the procedures of such a lambda must be reported under the name it is
+ *  bound to, not as an anonymous lambda.
+ *
+ *==========================================================================*/
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include "../src/arena.h"
+#include "../src/env.h"
+#include "../src/expr.h"
+#include "../src/gc.h"
+#include "../src/profiler.h"
+
+static int failures = 0;
+
+static void check(bool ok, const std::string &what) {
+    std::cout << (ok ? "ok      " : "FAILED  ") << what << "\n";
+    if (!ok) failures++;
+}
+
+/**
+ * Check that a row of a profile report names a procedure
+ * @param report Report printed by `Profiler::report`
+ * @param name Name of the procedure
+ * @returns True if a row ends with the name
+ */
+static bool has_row(const std::string &report, const std::string &name) {
+    std::istringstream lines(report);
+    std::string line;
+    while (std::getline(lines, line))
+        if (line.size() > name.size() + 2 &&
+            line.compare(line.size() - name.size() - 2, std::string::npos,
+                         "  " + name) == 0)
+            return true;
+    return false;
+}
+
+/**
+ * Bind a closure that captures a parameter of the lambda it is made in,
+ * call it and look for its name in the report. Definitions are built
+ * outside of any lambda scope, so the lambda `(lambda (x) (+ x a))` of a
+ * call to `(lambda (a) ...)` is put together here the way the parser
+ * builds it.
+ * @returns void
+ */
+static void test_capturing_closure() {
+    Frame frame {};
+    Env *global_env = gc_new<Env>(frame);
+    Heap::current().add_root(global_env);
+    Arena *arena = Heap::current().new_arena();
+
+    const Symbol *x = Symbol::intern("x");
+    const Symbol *a = Symbol::intern("a");
+    std::vector<Expr*> *params(arena_new<std::vector<Expr*>>(arena));
+    params->push_back(arena_new<Expr>(arena, std::string("x")));
+    std::vector<Expr*> *captures(arena_new<std::vector<Expr*>>(arena));
+    captures->push_back(arena_new<Expr>(arena, a, 0, 0));
+
+    // (+ x a), with 'x' an argument and 'a' the first captured variable
+    ExprArray sum_args = { arena->allocate_array(2), 2 };
+    sum_args[0] = arena_new<Expr>(arena, x, 0, 0);
+    sum_args[1] = arena_new<Expr>(arena, a, 1, 0);
+
+    ExprArray lambda_args = { arena->allocate_array(3), 3 };
+    lambda_args[0] = arena_new<Expr>(arena, params);
+    lambda_args[1] = arena_new<Expr>(arena, PrimType::ADD, sum_args);
+    lambda_args[2] = arena_new<Expr>(arena, captures);
+    Expr *lambda = arena_new<Expr>(arena, PrimType::LAMBDA, lambda_args);
+
+    // (define add <lambda>)
+    Expr name(Symbol::intern("add"), nullptr);
+    Expr *define_args[] = { &name, lambda };
+    Expr(PrimType::DEFINE, ExprArray { define_args, 2 })
+        .eval(NO_BINDING, global_env);
+
+    // The frame of a call to the enclosing lambda, with 'a' bound to 5
+    Env *call_frame = gc_new<Env>(global_env, 1);
+    call_frame->set_slot(0, Value(int64_t(5)));
+    Value add = lambda->eval(NO_BINDING, call_frame);
+    check(add.type() == ExpType::PROC, "'add' makes a procedure");
+
+    std::vector<Value> args { Value(int64_t(1)) };
+    Value sum = add.obj()->eval(&args, global_env);
+    check(sum.is_int() && sum.ival() == 6, "(add 1) is 6");
+
+    std::ostringstream report;
+    Profiler::report(report);
+    check(has_row(report.str(), "add"), "the call is reported as 'add'");
+    check(!has_row(report.str(), "<lambda>"), "no call is anonymous");
+
+    arena->release();
+    Heap::current().remove_root(global_env);
+}
+
+/*============================================================================
+ *  Main driver
+ *===========================================================================*/
+int main() {
+    Heap::current().set_stack_base(__builtin_frame_address(0));
+    Profiler::folded_path = "/dev/null";
+    Profiler::start();
+
+    try {
+        test_capturing_closure();
+    }
+    catch (const char *e)         { check(false, e); }
+    catch (const std::string &e)  { check(false, e); }
+
+    Profiler::stop();
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}